@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <list>
 #include <ctime>
 
@@ -11,9 +12,14 @@
 #include <simgear/math/SGGeometry.hxx>
 #include <simgear/io/sg_binobj.hxx>
 #include <simgear/misc/texcoord.hxx>
+#include <simgear/threads/SGGuard.hxx>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
 
 #include <terragear/tg_polygon.hxx>
 #include <terragear/tg_chopper.hxx>
+#include <terragear/tg_node_grid.hxx>
 #include <terragear/tg_unique_geod.hxx>
 #include <terragear/tg_unique_vec3f.hxx>
 #include <terragear/tg_unique_vec2f.hxx>
@@ -211,15 +217,160 @@ bool Airport::isDebugFeature( int feat )
 }
 
 
+// Run task(i) for every i in [0, count) on up to gBuildThreads threads.
+// Threads take the next index from a shared counter, as polygons differ
+// a lot in cost.  A task only touches its own slot of the lists it works
+// on, so the result is the same as running them in order.
+template <class Task>
+class ParallelBuild
+{
+public:
+    ParallelBuild( Task& t, unsigned int c ) : task(t), count(c), next(0), prefix(DebugGetPrefix()) {}
+
+    void Run( void )
+    {
+        unsigned int threads = std::min( (unsigned int)std::max( gBuildThreads, 1 ), count );
+
+        if ( threads <= 1 ) {
+            for ( unsigned int i = 0; i < count; i++ ) {
+                task( i );
+            }
+            return;
+        }
+
+        boost::thread_group group;
+        for ( unsigned int t = 0; t < threads; t++ ) {
+            group.create_thread( boost::bind( &ParallelBuild::Work, this ) );
+        }
+        group.join_all();
+    }
+
+private:
+    void Work( void )
+    {
+        // log as the airport's thread
+        DebugRegisterPrefix( prefix );
+
+        while ( true ) {
+            unsigned int i;
+            {
+                SGGuard<SGMutex> g( lock );
+                if ( next >= count ) {
+                    return;
+                }
+                i = next++;
+            }
+            task( i );
+        }
+    }
+
+    Task&        task;
+    unsigned int count;
+    unsigned int next;
+    std::string  prefix;
+    SGMutex      lock;
+};
+
+template <class Task>
+static void RunParallel( Task task, unsigned int count )
+{
+    ParallelBuild<Task> build( task, count );
+    build.Run();
+}
+
+// bezier conversion of linear features
+class FinishFeatureTask
+{
+public:
+    FinishFeatureTask( FeatureList& f ) : features(f) {}
+    void operator()( unsigned int i ) { features[i]->Finish(); }
+
+private:
+    FeatureList& features;
+};
+
+// add the nodes of other polygons lying on an edge, to avoid T
+// intersections.  The node grid is only read.
+class AddColinearNodesTask
+{
+public:
+    AddColinearNodesTask( tgpolygon_list& p, const tgNodeGrid& g ) : polys(p), grid(g) {}
+    void operator()( unsigned int i )
+    {
+        polys[i] = tgPolygon::AddColinearNodes( polys[i], grid );
+        TG_LOG(SG_GENERAL, SG_DEBUG, "total size after add nodes = " << polys[i].TotalNodes());
+    }
+
+private:
+    tgpolygon_list&   polys;
+    const tgNodeGrid& grid;
+};
+
+class CleanLineTask
+{
+public:
+    CleanLineTask( tgpolygon_list& p ) : polys(p) {}
+    void operator()( unsigned int i )
+    {
+        tgPolygon poly = polys[i];
+
+        poly = tgPolygon::RemoveCycles( poly );
+        poly = tgPolygon::RemoveDups( poly );
+        poly = tgPolygon::RemoveBadContours( poly );
+
+        polys[i] = poly;
+    }
+
+private:
+    tgpolygon_list& polys;
+};
+
+class SnapPolyTask
+{
+public:
+    SnapPolyTask( tgpolygon_list& p ) : polys(p) {}
+    void operator()( unsigned int i )
+    {
+        tgPolygon poly = polys[i];
+
+        poly = tgPolygon::Snap( poly, gSnap );
+        poly = tgPolygon::RemoveDups( poly );
+        poly = tgPolygon::RemoveBadContours( poly );
+
+        polys[i] = poly;
+    }
+
+private:
+    tgpolygon_list& polys;
+};
+
+class TesselateTask
+{
+public:
+    TesselateTask( tgpolygon_list& p ) : polys(p) {}
+    void operator()( unsigned int i )
+    {
+        TG_LOG(SG_GENERAL, SG_DEBUG, "contours before " << polys[i].Contours() << " total points before = " << polys[i].TotalNodes());
+        polys[i].Tesselate();
+        TG_LOG(SG_GENERAL, SG_DEBUG, "triangles after = " << polys[i].Triangles());
+        polys[i].Texture();
+    }
+
+private:
+    tgpolygon_list& polys;
+};
+
 // TODO : Add somewhere
 // Determine node elevations of a point_list based on the provided
 // TGAptSurface.  Offset is added to the final elevation
 static std::vector<SGGeod> calc_elevations( const tgSurface& surf, const std::vector<SGGeod>& geod_nodes, double offset )
 {
     std::vector<SGGeod> result = geod_nodes;
+    std::vector<double> elevs;
+
+    surf.query( geod_nodes, elevs );
     for ( unsigned int i = 0; i < result.size(); ++i ) {
-        double elev = surf.query( result[i] );
-        result[i].setElevationM( elev + offset );
+        result[i].setElevationM( elevs[i] + offset );
     }
 
     return result;
@@ -229,22 +380,20 @@ static std::vector<SGGeod> calc_elevations( const tgSurface& surf, const std::ve
 static tgContour calc_elevations( const tgSurface& surf, const tgContour& geod_nodes, double offset )
 {
     tgContour result = geod_nodes;
+    std::vector<SGGeod> nodes;
+    std::vector<double> elevs;
+
     for ( unsigned int i = 0; i < result.GetSize(); ++i ) {
-        SGGeod node = result.GetNode(i);
-        double elev = surf.query( node );
-        node.setElevationM( elev + offset );
-        result.SetNode( i, node );
+        nodes.push_back( result.GetNode(i) );
     }
 
-    return result;
-}
-
-static double calc_elevation( const tgSurface& surf, const SGGeod& node, double offset )
-{
-    double elev = surf.query( node );
-    elev += offset;
+    surf.query( nodes, elevs );
+    for ( unsigned int i = 0; i < result.GetSize(); ++i ) {
+        nodes[i].setElevationM( elevs[i] + offset );
+        result.SetNode( i, nodes[i] );
+    }
 
-    return elev;
+    return result;
 }
 
 
@@ -253,10 +402,25 @@ static double calc_elevation( const tgSurface& surf, const SGGeod& node, double
 static tgPolygon calc_elevations( const tgSurface& surf, const tgPolygon& poly, double offset )
 {
     tgPolygon result;
+    std::vector<SGGeod> nodes;
+    std::vector<double> elevs;
+
+    // query the nodes of all contours at once
+    for ( unsigned int i = 0; i < poly.Contours(); ++i ) {
+        for ( unsigned int j = 0; j < poly.ContourSize( i ); ++j ) {
+            nodes.push_back( poly.GetNode( i, j ) );
+        }
+    }
+
+    surf.query( nodes, elevs );
 
+    unsigned int k = 0;
     for ( unsigned int i = 0; i < poly.Contours(); ++i ) {
-        tgContour contour = poly.GetContour( i );
-        tgContour elevated = calc_elevations( surf, contour, offset );
+        tgContour elevated = poly.GetContour( i );
+        for ( unsigned int j = 0; j < elevated.GetSize(); ++j, ++k ) {
+            nodes[k].setElevationM( elevs[k] + offset );
+            elevated.SetNode( j, nodes[k] );
+        }
 
         result.AddContour( elevated );
     }
@@ -329,6 +493,9 @@ void Airport::BuildBtg(const std::string& root, const string_list& elev_src )
         }
     }
 
+    // convert the bezier contours of all linear features
+    RunParallel( FinishFeatureTask( features ), features.size() );
+
     TG_LOG(SG_GENERAL, SG_INFO, "Parse Complete - Runways: " << runways.size() << " Pavements: " << pavements.size() << " Features: " << features.size() << " Taxiways: " << taxiways.size() );
 
     // Starting to clip the polys (for now - only UNIX builds)
@@ -626,60 +793,24 @@ void Airport::BuildBtg(const std::string& root, const string_list& elev_src )
     log_time = time(0);
     TG_LOG( SG_GENERAL, SG_ALERT, "Finished collecting nodes for " << icao << " at " << DebugTimeToString(log_time) );
 
-    // second pass : runways
-    for ( unsigned int k = 0; k < rwy_polys.size(); ++k )
-    {
-        tgPolygon poly = rwy_polys[k];
-        poly = tgPolygon::AddColinearNodes( poly, tmp_pvmt_nodes );
-        TG_LOG(SG_GENERAL, SG_DEBUG, "total size after add nodes = " << poly.TotalNodes());
-        rwy_polys[k] = poly;
-    }
+    // index the nodes once, for all the edge queries
+    tgNodeGrid pvmt_grid( tmp_pvmt_nodes.get_list() );
+    tgNodeGrid feat_grid( tmp_feat_nodes.get_list() );
 
-    // second pass : and pavements
-    for ( unsigned int k = 0; k < pvmt_polys.size(); ++k )
-    {
-        tgPolygon poly = pvmt_polys[k];
-        poly = tgPolygon::AddColinearNodes( poly, tmp_pvmt_nodes );
-        TG_LOG(SG_GENERAL, SG_DEBUG, "total size after add nodes = " << poly.TotalNodes());
-        pvmt_polys[k] = poly;
-    }
-
-    // second pass : and lines
-    for ( unsigned int k = 0; k < line_polys.size(); ++k )
-    {
-        tgPolygon poly = line_polys[k];
-        poly = tgPolygon::AddColinearNodes( poly, tmp_feat_nodes );
-        TG_LOG(SG_GENERAL, SG_DEBUG, "total size after add nodes = " << poly.TotalNodes());
-        line_polys[k] = poly;
-    }
+    // second pass : runways, pavements and lines
+    RunParallel( AddColinearNodesTask( rwy_polys, pvmt_grid ), rwy_polys.size() );
+    RunParallel( AddColinearNodesTask( pvmt_polys, pvmt_grid ), pvmt_polys.size() );
+    RunParallel( AddColinearNodesTask( line_polys, feat_grid ), line_polys.size() );
 
     log_time = time(0);
     TG_LOG( SG_GENERAL, SG_ALERT, "Finished adding intermediate nodes for " << icao << " at " << DebugTimeToString(log_time) );
 
-    for ( unsigned int k = 0; k < line_polys.size(); ++k )
-    {
-        tgPolygon poly = line_polys[k];
-
-#if 1
-        poly = tgPolygon::RemoveCycles( poly );
-        poly = tgPolygon::RemoveDups( poly );
-        poly = tgPolygon::RemoveBadContours( poly );
-
-//        poly = tgPolygon::Simplify( poly );
-//        poly = tgPolygon::RemoveTinyContours( poly );
-//        poly = tgPolygon::RemoveSpikes( poly );
-//        poly = tgPolygon::RemoveDups( poly );
-//        poly = tgPolygon::RemoveBadContours( poly );
-//        poly = tgPolygon::RemoveTinyContours( poly );
-#endif
-
-        line_polys[k] = poly;
-    }
+    RunParallel( CleanLineTask( line_polys ), line_polys.size() );
 
     log_time = time(0);
     TG_LOG( SG_GENERAL, SG_ALERT, "Finished cleaning polys for " << icao << " at " << DebugTimeToString(log_time) );
 
-    base_poly = tgPolygon::AddColinearNodes( base_poly, tmp_pvmt_nodes );
+    base_poly = tgPolygon::AddColinearNodes( base_poly, pvmt_grid );
     base_poly = tgPolygon::Snap( base_poly, gSnap );
 
     // Finally find slivers in base
@@ -689,22 +820,8 @@ void Airport::BuildBtg(const std::string& root, const string_list& elev_src )
     tgPolygon::MergeSlivers( pvmt_polys, slivers );
 
     // Then snap rwy and pavement to grid (was done right after adding intermediate nodes...)
-    for ( unsigned int k = 0; k < rwy_polys.size(); ++k )
-    {
-    	tgPolygon poly = rwy_polys[k];
-        poly = tgPolygon::Snap(poly, gSnap);
-        poly = tgPolygon::RemoveDups( poly );
-        poly = tgPolygon::RemoveBadContours( poly );
-    	rwy_polys[k] = poly;
-    }
-    for ( unsigned int k = 0; k < pvmt_polys.size(); ++k )
-    {
-    	tgPolygon poly = pvmt_polys[k];
-        poly = tgPolygon::Snap(poly, gSnap);
-        poly = tgPolygon::RemoveDups( poly );
-        poly = tgPolygon::RemoveBadContours( poly );
-    	pvmt_polys[k] = poly;
-    }
+    RunParallel( SnapPolyTask( rwy_polys ), rwy_polys.size() );
+    RunParallel( SnapPolyTask( pvmt_polys ), pvmt_polys.size() );
 
     cleanup_end.stamp();
     cleanup_time = cleanup_end - cleanup_start;
@@ -715,45 +832,19 @@ void Airport::BuildBtg(const std::string& root, const string_list& elev_src )
     if ( rwy_polys.size() )
     {
         TG_LOG(SG_GENERAL, SG_INFO, "Tesselating " << rwy_polys.size() << " Runway Polys " );
-        for ( unsigned int i = 0; i < rwy_polys.size(); ++i )
-        {
-            TG_LOG(SG_GENERAL, SG_DEBUG, "Tesselating runway poly = " << i + 1 << " of " << rwy_polys.size() );
-
-            TG_LOG(SG_GENERAL, SG_DEBUG, "contours before " << rwy_polys[i].Contours() << " total points before = " << rwy_polys[i].TotalNodes());
-            rwy_polys[i].Tesselate();
-            TG_LOG(SG_GENERAL, SG_DEBUG, "triangles after = " << rwy_polys[i].Triangles());
-            rwy_polys[i].Texture();
-        }
+        RunParallel( TesselateTask( rwy_polys ), rwy_polys.size() );
     }
 
     if ( pvmt_polys.size() )
     {
-        // tesselate the polygons and prepair them for final output
         TG_LOG(SG_GENERAL, SG_INFO, "Tesselating " << pvmt_polys.size() << " Pavement Polys " );
-        for ( unsigned int i = 0; i < pvmt_polys.size(); ++i )
-        {
-            TG_LOG(SG_GENERAL, SG_DEBUG, "Tesselating pavement poly = " << i + 1 << " of " << pvmt_polys.size() );
-
-            TG_LOG(SG_GENERAL, SG_DEBUG, "contours before " << pvmt_polys[i].Contours() << " total points before = " << pvmt_polys[i].TotalNodes());
-            pvmt_polys[i].Tesselate();
-            TG_LOG(SG_GENERAL, SG_DEBUG, "triangles after = " << pvmt_polys[i].Triangles());
-            pvmt_polys[i].Texture();
-        }
+        RunParallel( TesselateTask( pvmt_polys ), pvmt_polys.size() );
     }
 
     if ( line_polys.size() )
     {
-        // tesselate the polygons and prepair them for final output
         TG_LOG(SG_GENERAL, SG_INFO, "Tesselating " << line_polys.size() << " Linear Feature Polys " );
-        for ( unsigned int i = 0; i < line_polys.size(); ++i )
-        {
-            TG_LOG(SG_GENERAL, SG_DEBUG, "Tesselating line poly = " << i + 1 << " of " << line_polys.size() );
-
-            TG_LOG(SG_GENERAL, SG_DEBUG, "contours before " << line_polys[i].Contours() << " total points before = " << line_polys[i].TotalNodes());
-            line_polys[i].Tesselate();
-            TG_LOG(SG_GENERAL, SG_DEBUG, "triangles after = " << line_polys[i].Triangles());
-            line_polys[i].Texture();
-        }
+        RunParallel( TesselateTask( line_polys ), line_polys.size() );
     }
 
     /* before tessellating the base, make sure there are no
@@ -1065,10 +1156,18 @@ void Airport::BuildBtg(const std::string& root, const string_list& elev_src )
 
     // add light points
     // pass one, calculate raw elevations from Array
+    std::vector<SGGeod> light_nodes;
+    std::vector<double> light_elevations;
     for ( unsigned int i = 0; i < rwy_lights.size(); ++i ) {
         for ( unsigned int j = 0; j < rwy_lights[i].ContourSize(); j++ ) {
-            double light_elevation = calc_elevation( apt_surf, rwy_lights[i].GetNode(j), 0.0 );
-            rwy_lights[i].SetElevation(j, light_elevation);
+            light_nodes.push_back( rwy_lights[i].GetNode(j) );
+        }
+    }
+
+    apt_surf.query( light_nodes, light_elevations );
+    for ( unsigned int i = 0, k = 0; i < rwy_lights.size(); ++i ) {
+        for ( unsigned int j = 0; j < rwy_lights[i].ContourSize(); j++, k++ ) {
+            rwy_lights[i].SetElevation(j, light_elevations[k]);
         }
     }
 
@@ -1157,77 +1256,94 @@ void Airport::BuildBtg(const std::string& root, const string_list& elev_src )
         throw sg_exception("error writing file. :-(");
     }
 
+    // collect the object references, written to the index when done
+    IndexWriter index_writer( objpath );
+
     // write out airport object reference
-    write_index( objpath, b, name );
+    index_writer.AddObject( b, name );
 
 #if 0 // TODO : along with taxiway signs
     // write out tower references
     for ( i = 0; i < (int)tower_nodes.size(); ++i )
     {
-        write_index_shared( objpath, b, tower_nodes[i],
-                            "Models/Airport/tower.xml",
-                            0.0 );
+        index_writer.AddShared( b, tower_nodes[i],
+                                "Models/Airport/tower.xml",
+                                0.0 );
     }
 #endif
 
+    // calc elevations of the object references
+    TG_LOG(SG_GENERAL, SG_DEBUG, "Computing windsock, beacon and sign node elevations");
+
+    std::vector<SGGeod> ref_geods;
+    for ( unsigned int i = 0; i < windsocks.size(); ++i ) {
+        ref_geods.push_back( windsocks[i]->GetLoc() );
+    }
+    for ( unsigned int i = 0; i < beacons.size(); ++i ) {
+        ref_geods.push_back( beacons[i]->GetLoc() );
+    }
+    for ( unsigned int i = 0; i < signs.size(); ++i ) {
+        ref_geods.push_back( signs[i]->GetLoc() );
+    }
+    ref_geods = calc_elevations( apt_surf, ref_geods, 0.0 );
+
     SGGeod ref_geod;
-    // calc elevations and write out windsock references
-    TG_LOG(SG_GENERAL, SG_DEBUG, "Computing windsock node elevations");
+    unsigned int ref = 0;
 
+    // write out windsock references
     for ( unsigned int i = 0; i < windsocks.size(); ++i )
     {
-        SGGeod ref_geod = windsocks[i]->GetLoc();
-        ref_geod.setElevationM( calc_elevation( apt_surf, ref_geod, 0.0 ) );
+        ref_geod = ref_geods[ref++];
 
         if ( windsocks[i]->IsLit() )
         {
-            write_index_shared( objpath, b, ref_geod,
-                                "Models/Airport/windsock_lit.xml", 0.0 );
+            index_writer.AddShared( b, ref_geod,
+                                    "Models/Airport/windsock_lit.xml", 0.0 );
         }
         else
         {
-            write_index_shared( objpath, b, ref_geod,
-                                "Models/Airport/windsock.xml", 0.0 );
+            index_writer.AddShared( b, ref_geod,
+                                    "Models/Airport/windsock.xml", 0.0 );
         }
     }
 
     // write out beacon references
     for ( unsigned int i = 0; i < beacons.size(); ++i )
     {
-        ref_geod = beacons[i]->GetLoc();
-        ref_geod.setElevationM( calc_elevation( apt_surf, ref_geod, 0.0 ) );
+        ref_geod = ref_geods[ref++];
 
-        write_index_shared( objpath, b, ref_geod,
-                            "Models/Airport/beacon.xml",
-                            0.0 );
+        index_writer.AddShared( b, ref_geod,
+                                "Models/Airport/beacon.xml",
+                                0.0 );
     }
 
     // write out taxiway signs references
     for ( unsigned int i = 0; i < signs.size(); ++i )
     {
-        ref_geod = signs[i]->GetLoc();
-        ref_geod.setElevationM( calc_elevation( apt_surf, ref_geod, 0.0 ) );
-        write_object_sign( objpath, b, ref_geod,
-                            signs[i]->GetDefinition(),
-                            signs[i]->GetHeading(),
-                            signs[i]->GetSize() );
+        ref_geod = ref_geods[ref++];
+        index_writer.AddSign( b, ref_geod,
+                              signs[i]->GetDefinition(),
+                              signs[i]->GetHeading(),
+                              signs[i]->GetSize() );
     }
 
     // write out water buoys
     for ( unsigned int i = 0; i < waterrunways.size(); ++i )
     {
-        tgContour buoys = waterrunways[i]->GetBuoys();
+        tgContour buoys = calc_elevations( apt_surf, waterrunways[i]->GetBuoys(), 0.0 );
 
         for ( unsigned int j = 0; j < buoys.GetSize(); ++j )
         {
             ref_geod = buoys.GetNode(j);
-            ref_geod.setElevationM( calc_elevation( apt_surf, ref_geod, 0.0 ) );
-            write_index_shared( objpath, b, ref_geod,
-                                "Models/Airport/water_rw_buoy.xml",
-                                0.0 );
+            index_writer.AddShared( b, ref_geod,
+                                    "Models/Airport/water_rw_buoy.xml",
+                                    0.0 );
         }
     }
 
+    // one append per index file
+    index_writer.Flush();
+
     std::string holepath = root + "/AirportArea";
     tgChopper chopper( holepath );
 
@@ -0,0 +1,502 @@
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <fstream>
+#include <algorithm>
+#include <limits>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <zlib.h>
+
+#include <simgear/debug/logstream.hxx>
+#include <simgear/io/lowlevel.hxx>
+#include <simgear/timing/timestamp.hxx>
+
+#include "airport.hxx"
+#include "parser.hxx"
+#include "apt_index.hxx"
+
+#define APT_INDEX_MAGIC     (0x41494458)    // 'AIDX'
+#define APT_INDEX_VERSION   (2)
+
+// bytes hashed at each end of apt.dat
+#define APT_INDEX_HASH_SIZE (64*1024)
+
+static inline int grid_cell( int lon, int lat )
+{
+    return (lat + 90) * 360 + (lon + 180);
+}
+
+// read the lat and lon fields starting at token lat_field of a runway or
+// helipad definition, without building the runway or helipad
+static bool read_coords( const char* def, int lat_field, SGGeod& p )
+{
+    double lat = 0.0, lon = 0.0;
+    int    field = 0;
+
+    while ( *def && field <= lat_field + 1 ) {
+        while ( *def == ' ' || *def == '\t' ) {
+            def++;
+        }
+        if ( !*def || *def == '\r' || *def == '\n' ) {
+            break;
+        }
+
+        if ( field == lat_field ) {
+            lat = strtod( def, NULL );
+        } else if ( field == lat_field + 1 ) {
+            lon = strtod( def, NULL );
+            p = SGGeod::fromDeg( lon, lat );
+            return true;
+        }
+
+        while ( *def && *def != ' ' && *def != '\t' ) {
+            def++;
+        }
+        field++;
+    }
+
+    return false;
+}
+
+static bool by_pos( const AptIndexEntry* a, const AptIndexEntry* b )
+{
+    return a->pos < b->pos;
+}
+
+AptIndex::AptIndex( const std::string& datafile )
+{
+    filename   = datafile;
+    file_size  = 0;
+    file_mtime = 0;
+    file_hash  = 0;
+}
+
+// size, modification time, and an FNV-1a hash of the first and last
+// APT_INDEX_HASH_SIZE bytes of the data file
+bool AptIndex::Stamp( void )
+{
+    struct stat buf;
+    if ( stat( filename.c_str(), &buf ) != 0 ) {
+        return false;
+    }
+    file_size  = buf.st_size;
+    file_mtime = buf.st_mtime;
+
+    std::ifstream in( filename.c_str(), std::ios::in | std::ios::binary );
+    if ( !in.is_open() ) {
+        return false;
+    }
+
+    std::vector<char> block( APT_INDEX_HASH_SIZE );
+    uint64_t hash = 14695981039346656037ULL;
+
+    for ( int end = 0; end < 2; end++ ) {
+        if ( end ) {
+            in.clear();
+            in.seekg( std::max( (int64_t)0, file_size - APT_INDEX_HASH_SIZE ), std::ios::beg );
+        }
+        in.read( &block[0], block.size() );
+
+        std::streamsize len = in.gcount();
+        for ( std::streamsize i = 0; i < len; i++ ) {
+            hash ^= (unsigned char)block[i];
+            hash *= 1099511628211ULL;
+        }
+    }
+    file_hash = hash;
+
+    return true;
+}
+
+bool AptIndex::Load( void )
+{
+    SGTimeStamp start;
+    std::string index_file = filename + ".idx";
+
+    start.stamp();
+    if ( !Stamp() ) {
+        TG_LOG( SG_GENERAL, SG_ALERT, "Cannot stat file: " << filename );
+        return false;
+    }
+
+    if ( Read( index_file ) ) {
+        TG_LOG( SG_GENERAL, SG_INFO, "Read index of " << entries.size() << " airports from " << index_file << " in " << SGTimeStamp::now() - start );
+        return true;
+    }
+
+    TG_LOG( SG_GENERAL, SG_INFO, "Indexing " << filename );
+    if ( !Build() ) {
+        return false;
+    }
+    TG_LOG( SG_GENERAL, SG_INFO, "Indexed " << entries.size() << " airports in " << SGTimeStamp::now() - start );
+
+    // not being able to save it only costs the next run another pass
+    if ( !Write( index_file ) ) {
+        TG_LOG( SG_GENERAL, SG_ALERT, "Could not save index " << index_file );
+    }
+
+    return true;
+}
+
+bool AptIndex::Read( const std::string& index_file )
+{
+    gzFile fp = gzopen( index_file.c_str(), "rb" );
+    if ( !fp ) {
+        return false;
+    }
+
+    int                 magic = 0, version = 0;
+    int64_t             size = -1, mtime = -1, hash = 0;
+    unsigned int        count = 0;
+
+    sgClearReadError();
+    sgReadInt( fp, &magic );
+    sgReadInt( fp, &version );
+    sgReadLongLong( fp, &size );
+    sgReadLongLong( fp, &mtime );
+    sgReadLongLong( fp, &hash );
+
+    if ( sgReadError() || magic != APT_INDEX_MAGIC || version != APT_INDEX_VERSION ||
+         size != file_size || mtime != file_mtime || (uint64_t)hash != file_hash ) {
+        TG_LOG( SG_GENERAL, SG_INFO, "Index " << index_file << " is out of date" );
+        gzclose( fp );
+        return false;
+    }
+
+    sgReadUInt( fp, &count );
+    entries.resize( count );
+    for ( unsigned int i = 0; i < count && !sgReadError(); i++ ) {
+        AptIndexEntry& entry = entries[i];
+        char*          icao = NULL;
+        int64_t        pos = 0;
+        unsigned int   num_points = 0;
+
+        sgReadString( fp, &icao );
+        if ( icao ) {
+            entry.icao = icao;
+            delete[] icao;
+        }
+        sgReadLongLong( fp, &pos );
+        entry.pos = pos;
+
+        sgReadUInt( fp, &entry.num_runways );
+        sgReadUInt( fp, &entry.num_helipads );
+        sgReadUInt( fp, &entry.num_pavements );
+        sgReadUInt( fp, &entry.num_features );
+        sgReadUInt( fp, &entry.num_nodes );
+
+        sgReadUInt( fp, &num_points );
+        for ( unsigned int j = 0; j < num_points && !sgReadError(); j++ ) {
+            double lon, lat;
+            sgReadDouble( fp, &lon );
+            sgReadDouble( fp, &lat );
+            entry.points.push_back( SGGeod::fromDeg( lon, lat ) );
+        }
+    }
+    gzclose( fp );
+
+    if ( sgReadError() ) {
+        TG_LOG( SG_GENERAL, SG_ALERT, "Error reading index " << index_file );
+        entries.clear();
+        return false;
+    }
+
+    for ( unsigned int i = 0; i < entries.size(); i++ ) {
+        if ( by_icao.find( entries[i].icao ) == by_icao.end() ) {
+            by_icao[entries[i].icao] = i;
+        }
+        AddToGrid( i );
+    }
+
+    return true;
+}
+
+bool AptIndex::Write( const std::string& index_file ) const
+{
+    // write to a temporary and rename, so a concurrent run never sees
+    // half an index
+    std::string tmp_file = index_file + ".tmp";
+
+    gzFile fp = gzopen( tmp_file.c_str(), "wb6" );
+    if ( !fp ) {
+        return false;
+    }
+
+    sgWriteInt( fp, APT_INDEX_MAGIC );
+    sgWriteInt( fp, APT_INDEX_VERSION );
+    sgWriteLongLong( fp, file_size );
+    sgWriteLongLong( fp, file_mtime );
+    sgWriteLongLong( fp, (int64_t)file_hash );
+
+    sgWriteUInt( fp, entries.size() );
+    for ( unsigned int i = 0; i < entries.size(); i++ ) {
+        const AptIndexEntry& entry = entries[i];
+
+        sgWriteString( fp, entry.icao.c_str() );
+        sgWriteLongLong( fp, entry.pos );
+        sgWriteUInt( fp, entry.num_runways );
+        sgWriteUInt( fp, entry.num_helipads );
+        sgWriteUInt( fp, entry.num_pavements );
+        sgWriteUInt( fp, entry.num_features );
+        sgWriteUInt( fp, entry.num_nodes );
+        sgWriteUInt( fp, entry.points.size() );
+        for ( unsigned int j = 0; j < entry.points.size(); j++ ) {
+            sgWriteDouble( fp, entry.points[j].getLongitudeDeg() );
+            sgWriteDouble( fp, entry.points[j].getLatitudeDeg() );
+        }
+    }
+
+    if ( gzclose( fp ) != Z_OK ) {
+        remove( tmp_file.c_str() );
+        return false;
+    }
+
+    remove( index_file.c_str() );
+    return rename( tmp_file.c_str(), index_file.c_str() ) == 0;
+}
+
+// One pass over apt.dat, collecting the same runway and helipad points
+// the bounding box test used to read on every run
+bool AptIndex::Build( void )
+{
+    char    line[2048];
+    char*   def;
+    char*   tok;
+    long    cur_pos;
+    bool    in_airport = false;
+    SGGeod  p;
+
+    std::ifstream in( filename.c_str() );
+    if ( !in.is_open() )
+    {
+        TG_LOG( SG_GENERAL, SG_ALERT, "Cannot open file: " << filename );
+        return false;
+    }
+
+    entries.clear();
+    by_icao.clear();
+    grid.clear();
+
+    while ( in.good() )
+    {
+        // remember the position of this line
+        cur_pos = in.tellg();
+
+        // get a line
+        in.getline(line, 2048);
+        if ( in.fail() && !in.eof() ) {
+            // overlong line - skip the rest of it
+            in.clear();
+            in.ignore( std::numeric_limits<std::streamsize>::max(), '\n' );
+        }
+        def = &line[0];
+
+        // Get the number code
+        tok = strtok(def, " \t\r\n");
+        if ( !tok ) {
+            continue;
+        }
+        def += strlen(tok)+1;
+
+        int code = atoi(tok);
+        switch(code)
+        {
+            case LAND_AIRPORT_CODE:
+            case SEA_AIRPORT_CODE:
+            case HELIPORT_CODE:
+            {
+                Airport airport( code, def );
+
+                AptIndexEntry entry;
+                entry.icao = airport.GetIcao();
+                entry.pos  = cur_pos;
+                entry.num_runways   = 0;
+                entry.num_helipads  = 0;
+                entry.num_pavements = 0;
+                entry.num_features  = 0;
+                entry.num_nodes     = 0;
+                entries.push_back( entry );
+
+                if ( by_icao.find( entry.icao ) == by_icao.end() ) {
+                    by_icao[entry.icao] = entries.size() - 1;
+                }
+                in_airport = true;
+            }
+            break;
+
+            // only the coordinates are needed : field numbers as in the
+            // Runway, WaterRunway and Helipad constructors
+            case LAND_RUNWAY_CODE:
+                if ( in_airport ) {
+                    if ( read_coords( def, 8, p ) ) {
+                        entries.back().points.push_back( p );
+                    }
+                    if ( read_coords( def, 17, p ) ) {
+                        entries.back().points.push_back( p );
+                    }
+                    entries.back().num_runways++;
+                }
+                break;
+
+            case WATER_RUNWAY_CODE:
+                if ( in_airport ) {
+                    if ( read_coords( def, 3, p ) ) {
+                        entries.back().points.push_back( p );
+                    }
+                    if ( read_coords( def, 6, p ) ) {
+                        entries.back().points.push_back( p );
+                    }
+                    entries.back().num_runways++;
+                }
+                break;
+
+            case HELIPAD_CODE:
+                if ( in_airport ) {
+                    if ( read_coords( def, 1, p ) ) {
+                        entries.back().points.push_back( p );
+                    }
+                    entries.back().num_helipads++;
+                }
+                break;
+
+            case TAXIWAY_CODE:
+            case PAVEMENT_CODE:
+            case BOUNDRY_CODE:
+                if ( in_airport ) {
+                    entries.back().num_pavements++;
+                }
+                break;
+
+            case LINEAR_FEATURE_CODE:
+                if ( in_airport ) {
+                    entries.back().num_features++;
+                }
+                break;
+
+            case NODE_CODE:
+            case BEZIER_NODE_CODE:
+            case CLOSE_NODE_CODE:
+            case CLOSE_BEZIER_NODE_CODE:
+            case TERM_NODE_CODE:
+            case TERM_BEZIER_NODE_CODE:
+                if ( in_airport ) {
+                    entries.back().num_nodes++;
+                }
+                break;
+
+            case END_OF_FILE:
+                in_airport = false;
+                break;
+
+            default:
+                break;
+        }
+
+        if ( code == END_OF_FILE ) {
+            break;
+        }
+    }
+
+    for ( unsigned int i = 0; i < entries.size(); i++ ) {
+        AddToGrid( i );
+    }
+
+    return true;
+}
+
+void AptIndex::AddToGrid( unsigned int e )
+{
+    AptIndexEntry& entry = entries[e];
+
+    if ( entry.points.empty() ) {
+        // can never match a bounding box
+        return;
+    }
+
+    entry.min_lon = entry.max_lon = entry.points[0].getLongitudeDeg();
+    entry.min_lat = entry.max_lat = entry.points[0].getLatitudeDeg();
+    for ( unsigned int i = 1; i < entry.points.size(); i++ ) {
+        entry.min_lon = std::min( entry.min_lon, entry.points[i].getLongitudeDeg() );
+        entry.max_lon = std::max( entry.max_lon, entry.points[i].getLongitudeDeg() );
+        entry.min_lat = std::min( entry.min_lat, entry.points[i].getLatitudeDeg() );
+        entry.max_lat = std::max( entry.max_lat, entry.points[i].getLatitudeDeg() );
+    }
+
+    int lon0 = std::max( -180, (int)floor( entry.min_lon ) );
+    int lon1 = std::min(  179, (int)floor( entry.max_lon ) );
+    int lat0 = std::max(  -90, (int)floor( entry.min_lat ) );
+    int lat1 = std::min(   89, (int)floor( entry.max_lat ) );
+
+    for ( int lat = lat0; lat <= lat1; lat++ ) {
+        for ( int lon = lon0; lon <= lon1; lon++ ) {
+            grid[grid_cell( lon, lat )].push_back( e );
+        }
+    }
+}
+
+long AptIndex::FindAirport( const std::string& icao ) const
+{
+    std::map<std::string, unsigned int>::const_iterator it = by_icao.find( icao );
+
+    if ( it == by_icao.end() ) {
+        return -1;
+    }
+
+    return entries[it->second].pos;
+}
+
+const AptIndexEntry* AptIndex::GetAirport( const std::string& icao ) const
+{
+    std::map<std::string, unsigned int>::const_iterator it = by_icao.find( icao );
+
+    if ( it == by_icao.end() ) {
+        return NULL;
+    }
+
+    return &entries[it->second];
+}
+
+void AptIndex::FindAirports( long start_pos, const tgRectangle& boundingBox,
+                             std::vector<const AptIndexEntry*>& airports ) const
+{
+    const SGGeod& min = boundingBox.getMin();
+    const SGGeod& max = boundingBox.getMax();
+
+    int lon0 = std::max( -180, (int)floor( min.getLongitudeDeg() ) );
+    int lon1 = std::min(  179, (int)floor( max.getLongitudeDeg() ) );
+    int lat0 = std::max(  -90, (int)floor( min.getLatitudeDeg() ) );
+    int lat1 = std::min(   89, (int)floor( max.getLatitudeDeg() ) );
+
+    std::vector<bool> seen( entries.size(), false );
+
+    for ( int lat = lat0; lat <= lat1; lat++ ) {
+        for ( int lon = lon0; lon <= lon1; lon++ ) {
+            std::map<int, std::vector<unsigned int> >::const_iterator cell = grid.find( grid_cell( lon, lat ) );
+            if ( cell == grid.end() ) {
+                continue;
+            }
+
+            for ( unsigned int i = 0; i < cell->second.size(); i++ ) {
+                unsigned int e = cell->second[i];
+                const AptIndexEntry& entry = entries[e];
+
+                if ( seen[e] || entry.pos < start_pos ) {
+                    continue;
+                }
+                seen[e] = true;
+
+                for ( unsigned int j = 0; j < entry.points.size(); j++ ) {
+                    if ( boundingBox.isInside( entry.points[j] ) ) {
+                        airports.push_back( &entry );
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    std::sort( airports.begin(), airports.end(), by_pos );
+}
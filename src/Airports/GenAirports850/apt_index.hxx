@@ -0,0 +1,82 @@
+#ifndef _APT_INDEX_HXX_
+#define _APT_INDEX_HXX_
+
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <simgear/compiler.h>
+#include <simgear/math/SGMath.hxx>
+#include <terragear/tg_rectangle.hxx>
+
+// One airport of the apt.dat file : where its definition starts, and the
+// points genapts tests against a bounding box (runway ends and helipads)
+class AptIndexEntry
+{
+public:
+    std::string         icao;
+    long                pos;
+    std::vector<SGGeod> points;
+
+    // what the airport is made of, for build cost estimates
+    unsigned int        num_runways;
+    unsigned int        num_helipads;
+    unsigned int        num_pavements;
+    unsigned int        num_features;
+    unsigned int        num_nodes;
+
+    // extent of points
+    double              min_lon, min_lat;
+    double              max_lon, max_lat;
+};
+
+// Index over an apt.dat file.
+//
+// Built with one pass over the file, and saved next to it as
+// <apt.dat>.idx.  The saved index is used as long as the size,
+// modification time and a hash of the start and end of apt.dat still
+// match.  Airports are looked up by ICAO, and by bounding box through a
+// one degree grid over their extents.
+class AptIndex
+{
+public:
+    AptIndex( const std::string& datafile );
+
+    // load the saved index, or build and save a new one
+    bool Load( void );
+
+    // position of the first definition of icao, or -1
+    long FindAirport( const std::string& icao ) const;
+    const AptIndexEntry* GetAirport( const std::string& icao ) const;
+
+    // airports starting at or after start_pos with a runway end or
+    // helipad inside the box, in file order
+    void FindAirports( long start_pos, const tgRectangle& boundingBox,
+                       std::vector<const AptIndexEntry*>& airports ) const;
+
+    unsigned int size( void ) const { return entries.size(); }
+
+private:
+    bool Read( const std::string& index_file );
+    bool Write( const std::string& index_file ) const;
+    bool Build( void );
+    void AddToGrid( unsigned int entry );
+
+    bool Stamp( void );
+
+    std::string                 filename;
+
+    // identity of the indexed file
+    int64_t                     file_size;
+    int64_t                     file_mtime;
+    uint64_t                    file_hash;
+
+    std::vector<AptIndexEntry>  entries;
+    std::map<std::string, unsigned int> by_icao;
+
+    // 1x1 degree cells -> entries whose extent touches them
+    std::map<int, std::vector<unsigned int> > grid;
+};
+
+#endif
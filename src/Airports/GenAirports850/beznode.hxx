@@ -9,6 +9,7 @@
 #include <simgear/math/SGMath.hxx>
 
 #include "debug.hxx"
+#include "pool.hxx"
 
 inline double LinearDistance( const SGGeod& p0, const SGGeod& p1 )
 {
@@ -119,6 +120,8 @@ inline double CalculateTheta( const SGVec3d& dirCur, const SGVec3d& dirNext, con
 class BezNode 
 {
 public:
+    AIRPORT_POOLED( BEZ_NODE )
+
     BezNode( SGGeod l )
     {
         loc   = l;
@@ -1,10 +1,50 @@
 #include <ctime>
+
+#include <boost/thread/tss.hpp>
+
 #include "debug.hxx"
 
-std::map<long, std::string> thread_prefix_map;
+TG_THREAD_LOCAL char tg_log_prefix[TG_LOG_PREFIX_LEN];
+
+// the thread's stream, created on first use and deleted when the thread
+// exits, and whether it is in use
+static boost::thread_specific_ptr<std::ostringstream> thread_stream;
+static TG_THREAD_LOCAL bool thread_stream_busy;
 
 void DebugRegisterPrefix( const std::string& prefix ) {
-    thread_prefix_map[SGThread::current()] = prefix;
+    strncpy( tg_log_prefix, prefix.c_str(), TG_LOG_PREFIX_LEN - 1 );
+    tg_log_prefix[TG_LOG_PREFIX_LEN - 1] = '\0';
+}
+
+const char* DebugGetPrefix( void ) {
+    return tg_log_prefix;
+}
+
+TGLogLine::TGLogLine()
+{
+    if ( thread_stream_busy ) {
+        os    = new std::ostringstream;
+        owned = true;
+    } else {
+        if ( !thread_stream.get() ) {
+            thread_stream.reset( new std::ostringstream );
+        }
+        os    = thread_stream.get();
+        owned = false;
+        thread_stream_busy = true;
+
+        os->str( "" );
+        os->clear();
+    }
+}
+
+TGLogLine::~TGLogLine()
+{
+    if ( owned ) {
+        delete os;
+    } else {
+        thread_stream_busy = false;
+    }
 }
 
 std::string DebugTimeToString(time_t& tt)
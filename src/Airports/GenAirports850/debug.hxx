@@ -1,4 +1,5 @@
 #include <map>
+#include <sstream>
 #include <string>
 #include <cstring>
 #include <vector>
@@ -14,17 +15,41 @@ typedef std::map<std::string, std::vector<int>, std::less<std::string> > debug_m
 typedef debug_map::iterator debug_map_iterator;
 typedef debug_map::const_iterator debug_map_const_iterator;
 
-/* This map maps thread IDs to ICAO prefixes */
-extern std::map<long, std::string> thread_prefix_map;
+#if defined(_MSC_VER)
+#  define TG_THREAD_LOCAL __declspec(thread)
+#else
+#  define TG_THREAD_LOCAL __thread
+#endif
+
+/* Each thread's log prefix (the ICAO it works on), set once per airport.
+   Thread local, so logging needs no lookup or locking */
+#define TG_LOG_PREFIX_LEN   (16)
+extern TG_THREAD_LOCAL char tg_log_prefix[TG_LOG_PREFIX_LEN];
 
 extern void DebugRegisterPrefix( const std::string& prefix );
+extern const char* DebugGetPrefix( void );
 extern std::string DebugTimeToString(time_t& tt);
 
+/* Formats one log line in the thread's reused stream - a new stream is
+   only made when a log message logs something itself */
+class TGLogLine
+{
+public:
+    TGLogLine();
+    ~TGLogLine();
+
+    std::ostringstream& stream( void ) { return *os; }
+
+private:
+    std::ostringstream* os;
+    bool                owned;
+};
+
 #define TG_LOG(C,P,M)  do {                                         \
     if(sglog().would_log(C,P)) {                                    \
-        std::ostringstream os;                                      \
-        os << thread_prefix_map[SGThread::current()] << ":" << M;   \
-        sglog().log(C, P, __FILE__, __LINE__, os.str());            \
+        TGLogLine line;                                             \
+        line.stream() << tg_log_prefix << ":" << M;                 \
+        sglog().log(C, P, __FILE__, __LINE__, line.stream().str()); \
     }                                                               \
 } while(0)
 #endif
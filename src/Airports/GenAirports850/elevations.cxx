@@ -28,9 +28,10 @@
 #include <simgear/math/SGMath.hxx>
 #include <simgear/debug/logstream.hxx>
 
-#include <Array/array.hxx>
+#include <terragear/tg_surface.hxx>
 
 #include "global.hxx"
+#include "elevations.hxx"
 #include "debug.hxx"
 
 
@@ -39,87 +40,19 @@
 double tgAverageElevation( const std::string &root, const string_list elev_src,
                                const std::vector<SGGeod> points_source )
 {
-    bool done = false;
-    unsigned int i;
-    TGArray array;
-
-    // make a copy so our routine is non-destructive.
-    std::vector<SGGeod> points = points_source;
-
     // just bail if no work to do
-    if ( points.empty() ) {
+    if ( points_source.empty() ) {
         return 0.0;
     }
 
-    // set all elevations to -9999
-    for ( i = 0; i < points.size(); ++i ) {
-        points[i].setElevationM( -9999.0 );
-    }
-
-    while ( !done ) {
-        // find first node with -9999 elevation
-        SGGeod first = SGGeod();
-        bool found_one = false;
-        for ( i = 0; i < points.size(); ++i ) {
-            if ( points[i].getElevationM() < -9000.0 && !found_one ) {
-                first = points[i];
-                TG_LOG( SG_GENERAL, SG_DEBUG, "found first = " << first );
-
-                found_one = true;
-            }
-        }
-
-        if ( found_one ) {
-            SGBucket b( first );
-            std::string base = b.gen_base_path();
-
-            // try the various elevation sources
-            i = 0;
-            bool found_file = false;
-            while ( !found_file && i < elev_src.size() ) {
-                std::string array_path = root + "/" + elev_src[i] + "/" + base + "/" + b.gen_index_str();
-
-                if ( array.open(array_path) ) {
-                    found_file = true;
-                    TG_LOG( SG_GENERAL, SG_DEBUG, "Using array_path = " << array_path );
-                }
-                i++;
-            }
-
-            // this will fill in a zero structure if no array data
-            // found/opened
-            array.parse( b );
-
-            // this will do a hasty job of removing voids by inserting
-            // data from the nearest neighbor (sort of)
-            array.remove_voids();
-
-            // update all the non-updated elevations that are inside
-            // this array file
-            double elev;
-            done = true;
-            for ( i = 0; i < points.size(); ++i ) {
-                if ( points[i].getElevationM() < -9000.0 ) {
-                    done = false;
-                    elev = array.altitude_from_grid( points[i].getLongitudeDeg() * 3600.0,
-                                                     points[i].getLatitudeDeg() * 3600.0 );
-                    if ( elev > -9000 ) {
-                        points[i].setElevationM( elev );
-                    }
-                }
-            }
-
-            array.close();
-        } else {
-            done = true;
-        }
-    }
+    std::vector<double> elevations;
+    tgCalcElevations( root, elev_src, points_source, elevations );
 
     // now find the average height of the queried points
     double total = 0.0;
     int count = 0;
-    for ( i = 0; i < points.size(); ++i ) {
-        total += points[i].getElevationM();
+    for ( unsigned int i = 0; i < elevations.size(); ++i ) {
+        total += elevations[i];
         count++;
     }
     double average = total / (double) count;
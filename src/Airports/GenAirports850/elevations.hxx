@@ -27,9 +27,3 @@
 double tgAverageElevation( const std::string &root, const string_list elev_src,
                            const std::vector<SGGeod> points_source );
 
-// lookup node elevations for each point in the specified nurbs++
-// matrix.
-void tgCalcElevations( const std::string &root, const string_list elev_src, tgMatrix& Pts, double average );
-
-// clamp all elevations to the specified range
-void tgClampElevations( tgMatrix& Pts, double center_m, double max_clamp_m );
@@ -31,6 +31,9 @@ extern int nudge;
 // Each polygon vertex is snapped to a grid with this resolution (~1cm by default)
 extern double gSnap;
 
+// Threads each airport build may use for its per-polygon phases
+extern int gBuildThreads;
+
 extern double slope_max;
 extern double slope_eps;
 
@@ -362,7 +362,7 @@ LinearFeature::~LinearFeature()
     }
 }
 
-int LinearFeature::Finish( bool closed, unsigned int idx )
+int LinearFeature::Finish( void )
 {
     tgPolygon   poly;
     SGGeod      prev_inner, prev_outer;
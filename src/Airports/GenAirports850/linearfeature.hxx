@@ -42,6 +42,8 @@
 struct Marking
 {
 public:
+    AIRPORT_POOLED( MARKING )
+
     unsigned int type;
     unsigned int start_idx;
     unsigned int end_idx;
@@ -51,6 +53,8 @@ typedef std::vector <Marking*> MarkingList;
 struct Lighting
 {
 public:
+    AIRPORT_POOLED( LIGHTING )
+
     unsigned int type;
     unsigned int start_idx;
     unsigned int end_idx;
@@ -76,12 +80,14 @@ public:
             description = "none";
         }
         offset = o;
+        closed = false;
     }
 
     LinearFeature( std::string desc, double o )
     {
         description = desc;
         offset = o;
+        closed = false;
     }
 
     ~LinearFeature();
@@ -93,12 +99,20 @@ public:
         contour.push_back( b );
     }
 
-    int Finish( bool closed, unsigned int idx );
+    // The contour is complete.  The bezier conversion is left to
+    // Finish(), which the airport runs for all features in parallel.
+    void SetClosed( bool c )
+    {
+        closed = c;
+    }
+
+    int Finish( void );
     int BuildBtg( tgpolygon_list& line_polys, tglightcontour_list& lights, tgAccumulator& accum, bool debug );
 
 private:
     double          offset;
     double          width;
+    bool            closed;
 
     MarkingList     marks;
     Marking*        cur_mark;
@@ -38,8 +38,8 @@ static void usage( int argc, char **argv ) {
     TG_LOG(SG_GENERAL, SG_ALERT, "Usage: " << argv[0] << "\n--input=<apt_file>"
     << "\n--work=<work_dir>\n[ --start-id=abcd ] [ --restart-id=abcd ] [ --nudge=n ] "
     << "[--min-lon=<deg>] [--max-lon=<deg>] [--min-lat=<deg>] [--max-lat=<deg>] "
-    << "[ --airport=abcd ] [--max-slope=<decimal>] [--tile=<tile>] [--threads] [--threads=x]"
-    << "[--chunk=<chunk>] [--clear-dem-path] [--dem-path=<path>] [--verbose] [--help]");
+    << "[ --airport=abcd ] [--max-slope=<decimal>] [--tile=<tile>] [--threads] [--threads=x] [--build-threads=x] "
+    << "[--chunk=<chunk>] [--clear-dem-path] [--dem-path=<path>] [--cost-profile=<file>] [--verbose] [--help]");
 }
 
 
@@ -83,6 +83,14 @@ static void help( int argc, char **argv, const string_list& elev_src ) {
     cout << "such as eg. w080n40, e000s27.  \n";
     cout << "\nAn input file containing only a subset of the world's \n";
     cout << "airports may of course be used.\n";
+    cout << "\nThe first run over an input file writes an index of its airports next to it (<input>.idx), \n";
+    cout << "so later runs find airports by code or area without parsing the whole file.  The index \n";
+    cout << "is rebuilt whenever the input file changes.\n";
+    cout << "\nAirports are built largest first.  Build times are kept in <work-dir>/genapts_costs.txt \n";
+    cout << "(or --cost-profile=<file>) and used to order the next run; airports without a recorded time \n";
+    cout << "are estimated from their runway, pavement and feature counts.\n";
+    cout << "\nWith --build-threads=x, the polygon cleanup and tesselation of each airport is spread over x \n";
+    cout << "threads.  By default, threads left over when there are fewer airports than --threads are used.\n";
     cout << "\n\n";
     cout << "It is necessary to generate the elevation data for the area of interest PRIOR TO GENERATING THE AIRPORTS.  \n";
     cout << "Failure to do this will result in airports being generated with an elevation of zero.  \n";
@@ -99,6 +107,7 @@ static void help( int argc, char **argv, const string_list& elev_src ) {
 // TODO: where do these belong
 int nudge = 10;
 double gSnap = 0.00000001;      // approx 1 mm
+int gBuildThreads = 1;
 double slope_max = 0.02;
 double slope_eps = 0.00001;
 
@@ -130,7 +139,9 @@ int main(int argc, char **argv)
     std::string restart_id = "";
     std::string airport_id = "";
     std::string last_apt_file = "./last_apt.txt";
+    std::string cost_profile = "";
     int         num_threads    =  1;
+    int         build_threads  =  0;
 
     int arg_pos;
     for (arg_pos = 1; arg_pos < argc; arg_pos++)
@@ -164,6 +175,10 @@ int main(int argc, char **argv)
         {
             last_apt_file = arg.substr(16);
         }
+        else if ( arg.find("--cost-profile=") == 0 )
+        {
+            cost_profile = arg.substr(15);
+        }
         else if ( arg.find("--min-lon=") == 0 )
         {
             min.setLongitudeDeg(atof( arg.substr(10).c_str() ));
@@ -214,6 +229,10 @@ int main(int argc, char **argv)
         {
     	    slope_max = atof( arg.substr(12).c_str() );
         }
+        else if ( (arg.find("--build-threads=") == 0) )
+        {
+            build_threads = atoi( arg.substr(16).c_str() );
+        }
         else if ( (arg.find("--threads=") == 0) )
         {
             num_threads = atoi( arg.substr(10).c_str() );
@@ -322,6 +341,12 @@ int main(int argc, char **argv)
     // Create the scheduler
     Scheduler* scheduler = new Scheduler(input_file, work_dir, elev_src);
 
+    if ( cost_profile != "" )
+    {
+        scheduler->set_cost_profile( cost_profile );
+    }
+    scheduler->set_build_threads( build_threads );
+
     // Add any debug 
     scheduler->set_debug( debug_dir, debug_runway_defs, debug_pavement_defs, debug_taxiway_defs, debug_feature_defs );
 
@@ -28,79 +28,103 @@
 #include <cstdlib>
 
 #include <simgear/debug/logstream.hxx>
-#include <simgear/bucket/newbucket.hxx>
 #include <simgear/misc/sg_path.hxx>
+#include <simgear/threads/SGThread.hxx>
+#include <simgear/threads/SGGuard.hxx>
 
 #include "output.hxx"
 
 using std::string;
 
-// update index file (list of objects to be included in final scenery build)
-void write_index( const string& base, const SGBucket& b, const string& name )
+// one lock per .ind file, shared by all IndexWriters
+static SGMutex                      file_locks_lock;
+static std::map<string, SGMutex*>   file_locks;
+
+static SGMutex* file_lock( const string& file )
 {
-    string dir = base + "/" + b.gen_base_path();
-    SGPath sgp( dir );
-    sgp.append( "dummy" );
-    sgp.create_dir( 0755 );
-
-    string file = dir + "/" + b.gen_index_str() + ".ind";
-    SG_LOG( SG_GENERAL, SG_DEBUG, "Writing object to " << file );
-
-    FILE *fp;
-    if ( (fp = fopen( file.c_str(), "a" )) == NULL ) {
-        SG_LOG( SG_GENERAL, SG_ALERT, "ERROR: opening " << file << " for writing!" );
-        exit(-1);
+    SGGuard<SGMutex> g( file_locks_lock );
+
+    SGMutex*& lock = file_locks[file];
+    if ( !lock ) {
+        lock = new SGMutex;
     }
 
-    fprintf( fp, "OBJECT %s\n", name.c_str() );
-    fclose( fp );
+    return lock;
 }
 
+IndexWriter::IndexWriter( const string& b ) :
+    base( b )
+{
+}
 
-// update index file (list of shared objects to be included in final
-// scenery build)
-void write_index_shared( const string &base, const SGBucket &b,
-                         const SGGeod &p, const string& name,
-                         const double &heading )
+IndexWriter::~IndexWriter()
 {
-    string dir = base + "/" + b.gen_base_path();
-    SGPath sgp( dir );
-    sgp.append( "dummy" );
-    sgp.create_dir( 0755 );
-
-    string file = dir + "/" + b.gen_index_str() + ".ind";
-    SG_LOG( SG_GENERAL, SG_DEBUG, "Writing shared object to " << file );
-
-    FILE *fp;
-    if ( (fp = fopen( file.c_str(), "a" )) == NULL ) {
-        SG_LOG( SG_GENERAL, SG_ALERT, "ERROR: opening " << file << " for writing!" );
-        exit(-1);
-    }
+    Flush();
+}
+
+void IndexWriter::Add( const SGBucket& b, const char* line )
+{
+    pending[b.gen_index()] += line;
+}
+
+void IndexWriter::AddObject( const SGBucket& b, const string& name )
+{
+    SG_LOG( SG_GENERAL, SG_DEBUG, "Writing object " << name << " to " << b.gen_index_str() << ".ind" );
 
-    fprintf( fp, "OBJECT_SHARED %s %.6f %.6f %.1f %.2f\n", name.c_str(),
-             p.getLongitudeDeg(), p.getLatitudeDeg(), p.getElevationM(), heading );
-    fclose( fp );
+    string line = "OBJECT " + name + "\n";
+    Add( b, line.c_str() );
 }
 
-void write_object_sign( const string &base, const SGBucket &b,
-                        const SGGeod &p, const string& sign,
-                        const double &heading, const int &size)
+void IndexWriter::AddShared( const SGBucket& b, const SGGeod& p,
+                             const string& name, double heading )
 {
-    string dir = base + "/" + b.gen_base_path();
-    SGPath sgp( dir );
-    sgp.append( "dummy" );
-    sgp.create_dir( 0755 );
-
-    string file = dir + "/" + b.gen_index_str() + ".ind";
-    SG_LOG( SG_GENERAL, SG_DEBUG, "Writing sign to " << file );
-
-    FILE *fp;
-    if ( (fp = fopen( file.c_str(), "a" )) == NULL ) {
-        SG_LOG( SG_GENERAL, SG_ALERT, "ERROR: opening " << file << " for writing!" );
-        exit(-1);
+    char line[64];
+
+    SG_LOG( SG_GENERAL, SG_DEBUG, "Writing shared object " << name << " to " << b.gen_index_str() << ".ind" );
+
+    snprintf( line, sizeof(line), " %.6f %.6f %.1f %.2f\n",
+              p.getLongitudeDeg(), p.getLatitudeDeg(), p.getElevationM(), heading );
+    Add( b, ( "OBJECT_SHARED " + name + line ).c_str() );
+}
+
+void IndexWriter::AddSign( const SGBucket& b, const SGGeod& p, const string& sign,
+                           double heading, int size )
+{
+    char line[80];
+
+    SG_LOG( SG_GENERAL, SG_DEBUG, "Writing sign to " << b.gen_index_str() << ".ind" );
+
+    snprintf( line, sizeof(line), " %.6f %.6f %.1f %.2f %u\n",
+              p.getLongitudeDeg(), p.getLatitudeDeg(), p.getElevationM(), heading, size );
+    Add( b, ( "OBJECT_SIGN " + sign + line ).c_str() );
+}
+
+void IndexWriter::Flush( void )
+{
+    std::map<long int, string>::const_iterator it;
+
+    for ( it = pending.begin(); it != pending.end(); ++it ) {
+        SGBucket b( it->first );
+
+        string dir = base + "/" + b.gen_base_path();
+        SGPath sgp( dir );
+        sgp.append( "dummy" );
+        sgp.create_dir( 0755 );
+
+        string file = dir + "/" + b.gen_index_str() + ".ind";
+        SG_LOG( SG_GENERAL, SG_DEBUG, "Appending objects to " << file );
+
+        SGGuard<SGMutex> g( *file_lock( file ) );
+
+        FILE *fp;
+        if ( (fp = fopen( file.c_str(), "a" )) == NULL ) {
+            SG_LOG( SG_GENERAL, SG_ALERT, "ERROR: opening " << file << " for writing!" );
+            exit(-1);
+        }
+
+        fwrite( it->second.data(), 1, it->second.size(), fp );
+        fclose( fp );
     }
 
-    fprintf( fp, "OBJECT_SIGN %s %.6f %.6f %.1f %.2f %u\n", sign.c_str(),
-             p.getLongitudeDeg(), p.getLatitudeDeg(), p.getElevationM(), heading, size );
-    fclose( fp );
+    pending.clear();
 }
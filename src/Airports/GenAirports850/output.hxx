@@ -27,21 +27,42 @@
 #include <config.h>
 #endif
 
+#include <map>
 #include <string>
 
-// update index file (list of objects to be included in final scenery build)
-void write_index( const std::string& base, const SGBucket& b, const std::string& name );
+#include <simgear/bucket/newbucket.hxx>
 
-// update index file (list of shared objects to be included in final
-// scenery build)
-void write_index_shared( const std::string &base, const SGBucket &b,
-                         const SGGeod &p, const std::string& name,
-                         const double &heading );
+// Collects the index file entries (list of objects to be included in the
+// final scenery build) of one airport, and appends them to the .ind files
+// in one write per file on Flush().  Appends to a file are serialised
+// across threads, so airports built in parallel can share a bucket.
+class IndexWriter
+{
+public:
+    IndexWriter( const std::string& base );
+    ~IndexWriter();
 
-// update index file (list of shared objects to be included in final
-// scenery build)
-void write_object_sign( const std::string &base, const SGBucket &b,
-                        const SGGeod &p, const std::string& sign,
-                        const double &heading, const int &size );
+    // airport object
+    void AddObject( const SGBucket& b, const std::string& name );
+
+    // shared object (tower, windsock, beacon, buoy)
+    void AddShared( const SGBucket& b, const SGGeod& p,
+                    const std::string& name, double heading );
+
+    // taxiway sign
+    void AddSign( const SGBucket& b, const SGGeod& p, const std::string& sign,
+                  double heading, int size );
+
+    // append everything collected so far
+    void Flush( void );
+
+private:
+    void Add( const SGBucket& b, const char* line );
+
+    std::string base;
+
+    // bucket index -> pending lines
+    std::map<long int, std::string> pending;
+};
 
 #endif
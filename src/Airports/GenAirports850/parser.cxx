@@ -188,6 +188,9 @@ void Parser::run()
         exit(-1);
     }
 
+    // small airport objects come from this thread's pools
+    pools.Use();
+
     // as long as we have airports to parse, do so
     while (!global_workQueue.empty()) {
         AirportInfo ai = global_workQueue.pop();
@@ -236,10 +239,22 @@ void Parser::run()
                 cur_airport->GetCleanupTime( clean_time );
                 cur_airport->GetTriangulationTime( triangulation_time );
 
+                // report the times back for the cost profile
+                ai.SetParseTime( parse_time );
+                ai.SetBuildTime( build_time );
+                ai.SetCleanTime( clean_time );
+                ai.SetTessTime( triangulation_time );
+                global_doneQueue.push( ai );
+
                 delete cur_airport;
                 cur_airport = NULL;
             }
 
+            // nothing refers to the nodes of this airport any more
+            prev_node = NULL;
+            cur_feat  = NULL;
+            pools.Reset();
+
             log_time = time(0);
             TG_LOG( SG_GENERAL, SG_ALERT, "Finished airport " << icao << 
                 " : parse " << parse_time << " : build " << build_time << 
@@ -248,6 +263,8 @@ void Parser::run()
             TG_LOG( SG_GENERAL, SG_INFO, "Not an airport at pos " << pos << " line is: " << line );  
         }
     }
+
+    pools.Release();
 }
 
 BezNode* Parser::ParseNode( int type, char* line, BezNode* prevNode )
@@ -655,7 +672,7 @@ int Parser::ParseLine(char* line)
                         }
                         if (cur_airport)
                         {
-                            cur_feat->Finish( true, cur_airport->NumFeatures() );
+                            cur_feat->SetClosed( true );
                             cur_airport->AddFeature( cur_feat );
                         }
                         cur_feat = NULL;
@@ -689,7 +706,7 @@ int Parser::ParseLine(char* line)
                             }
                             if (cur_airport)
                             {
-                                cur_feat->Finish( false, cur_airport->NumFeatures()  );
+                                cur_feat->SetClosed( false );
                                 cur_airport->AddFeature( cur_feat );
                             }
                         }
@@ -127,6 +127,9 @@ private:
     Beacon*         cur_beacon;
     Sign*           cur_sign;
 
+    // bezier nodes, markings and lights of the airport being built
+    AirportPools    pools;
+
     // debug
     std::string     debug_path;
     debug_map       debug_runways;
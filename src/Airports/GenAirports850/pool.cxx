@@ -0,0 +1,140 @@
+#include <algorithm>
+#include <new>
+
+#include "debug.hxx"
+#include "pool.hxx"
+
+// room in front of each object for its pool, keeping the object aligned
+#define POOL_HEADER_SIZE    (16)
+
+// the pools of the calling thread, if any
+static TG_THREAD_LOCAL AirportPools* current_pools;
+
+ObjectPool::ObjectPool( size_t size, unsigned int n ) :
+    per_block( n ),
+    cur_block( 0 ),
+    cur_used( 0 ),
+    free_list( NULL )
+{
+    // room for the free list link, and aligned for the next object
+    object_size = ( std::max( size, sizeof(FreeObject) ) + POOL_HEADER_SIZE - 1 ) & ~(size_t)( POOL_HEADER_SIZE - 1 );
+}
+
+ObjectPool::~ObjectPool()
+{
+    for ( unsigned int i = 0; i < blocks.size(); i++ ) {
+        delete[] blocks[i];
+    }
+}
+
+void* ObjectPool::Alloc( void )
+{
+    if ( free_list ) {
+        FreeObject* obj = free_list;
+        free_list = obj->next;
+        return obj;
+    }
+
+    if ( cur_block < blocks.size() && cur_used == per_block ) {
+        cur_block++;
+        cur_used = 0;
+    }
+    if ( cur_block == blocks.size() ) {
+        blocks.push_back( new char[object_size * per_block] );
+        cur_used = 0;
+    }
+
+    return blocks[cur_block] + object_size * cur_used++;
+}
+
+void ObjectPool::Free( void* p )
+{
+    FreeObject* obj = static_cast<FreeObject*>( p );
+    obj->next = free_list;
+    free_list = obj;
+}
+
+void ObjectPool::Reset( void )
+{
+    cur_block = 0;
+    cur_used  = 0;
+    free_list = NULL;
+}
+
+AirportPools::AirportPools()
+{
+    for ( int i = 0; i < NUM_KINDS; i++ ) {
+        pools[i] = NULL;
+    }
+}
+
+AirportPools::~AirportPools()
+{
+    Release();
+
+    for ( int i = 0; i < NUM_KINDS; i++ ) {
+        delete pools[i];
+    }
+}
+
+void AirportPools::Use( void )
+{
+    current_pools = this;
+}
+
+void AirportPools::Release( void )
+{
+    if ( current_pools == this ) {
+        current_pools = NULL;
+    }
+}
+
+void AirportPools::Reset( void )
+{
+    for ( int i = 0; i < NUM_KINDS; i++ ) {
+        if ( pools[i] ) {
+            pools[i]->Reset();
+        }
+    }
+}
+
+void* AirportPools::Alloc( Kind kind, size_t size )
+{
+    AirportPools* cur  = current_pools;
+    ObjectPool*   pool = NULL;
+    char*         mem;
+
+    if ( cur ) {
+        if ( !cur->pools[kind] ) {
+            cur->pools[kind] = new ObjectPool( size + POOL_HEADER_SIZE );
+        }
+        if ( cur->pools[kind]->ObjectSize() >= size + POOL_HEADER_SIZE ) {
+            pool = cur->pools[kind];
+        }
+    }
+
+    if ( pool ) {
+        mem = static_cast<char*>( pool->Alloc() );
+    } else {
+        mem = static_cast<char*>( ::operator new( size + POOL_HEADER_SIZE ) );
+    }
+
+    *reinterpret_cast<ObjectPool**>( mem ) = pool;
+    return mem + POOL_HEADER_SIZE;
+}
+
+void AirportPools::Free( void* p )
+{
+    if ( !p ) {
+        return;
+    }
+
+    char*       mem  = static_cast<char*>( p ) - POOL_HEADER_SIZE;
+    ObjectPool* pool = *reinterpret_cast<ObjectPool**>( mem );
+
+    if ( pool ) {
+        pool->Free( mem );
+    } else {
+        ::operator delete( mem );
+    }
+}
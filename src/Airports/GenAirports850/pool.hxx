@@ -0,0 +1,85 @@
+#ifndef _POOL_HXX_
+#define _POOL_HXX_
+
+#include <cstddef>
+#include <vector>
+
+// Memory for the many small objects of one airport (bezier nodes,
+// markings and lights).
+//
+// Objects are carved out of large blocks, and freed ones are kept on a
+// free list.  Reset() drops all objects at once but keeps the blocks, so
+// the next airport parsed by the same thread allocates nothing until it
+// outgrows the previous ones.  A pool belongs to one thread and is not
+// locked.
+class ObjectPool
+{
+public:
+    ObjectPool( size_t size, unsigned int per_block = 4096 );
+    ~ObjectPool();
+
+    void* Alloc( void );
+    void  Free( void* p );
+
+    size_t ObjectSize( void ) const { return object_size; }
+
+    // forget all objects - only when none of them is used any more
+    void  Reset( void );
+
+private:
+    struct FreeObject {
+        FreeObject* next;
+    };
+
+    size_t              object_size;
+    unsigned int        per_block;
+
+    std::vector<char*>  blocks;
+    unsigned int        cur_block;
+    unsigned int        cur_used;
+    FreeObject*         free_list;
+};
+
+// The pools of one thread's airport build, and the class specific
+// operator new / delete that use them.
+class AirportPools
+{
+public:
+    enum Kind {
+        BEZ_NODE = 0,
+        MARKING,
+        LIGHTING,
+        NUM_KINDS
+    };
+
+    AirportPools();
+    ~AirportPools();
+
+    // make these the pools of the calling thread - until Release()
+    void Use( void );
+    void Release( void );
+
+    // between airports
+    void Reset( void );
+
+    // Objects carry a small header naming their pool - or none, for
+    // objects made on threads without pools, which come from the heap.
+    // So delete always returns an object to where it came from, but
+    // pooled objects must be deleted on their pool's thread.
+    static void* Alloc( Kind kind, size_t size );
+    static void  Free( void* p );
+
+private:
+    ObjectPool* pools[NUM_KINDS];
+};
+
+// class specific new / delete through the calling thread's pools
+#define AIRPORT_POOLED( kind )                                          \
+    static void* operator new( size_t size ) {                          \
+        return AirportPools::Alloc( AirportPools::kind, size );         \
+    }                                                                   \
+    static void operator delete( void* p ) {                            \
+        AirportPools::Free( p );                                        \
+    }
+
+#endif
@@ -3,18 +3,46 @@
 #  define sleep(x) Sleep(x*1000)
 #endif
 
+#include <algorithm>
+#include <cstdio>
 #include <cstring>
 
 #include <simgear/debug/logstream.hxx>
 #include <simgear/misc/sgstream.hxx>
 
 #include "airport.hxx"
+#include "global.hxx"
 #include "parser.hxx"
 #include "scheduler.hxx"
 
-extern double gSnap;
 
 SGLockedQueue<AirportInfo> global_workQueue;
+SGLockedQueue<AirportInfo> global_doneQueue;
+
+// Relative build cost of the parts of an airport, for airports without
+// a recorded build time.  Pavement and feature nodes dominate - each one
+// ends up in the clipping and tesselation.
+#define COST_BASE           (1.0)
+#define COST_PER_RUNWAY     (2.0)
+#define COST_PER_HELIPAD    (0.5)
+#define COST_PER_PAVEMENT   (0.5)
+#define COST_PER_FEATURE    (0.2)
+#define COST_PER_NODE       (0.05)
+
+struct ScheduledAirport
+{
+    AirportInfo info;
+    double      cost;
+    unsigned int order;
+};
+
+static bool costlier( const ScheduledAirport& a, const ScheduledAirport& b )
+{
+    if ( a.cost != b.cost ) {
+        return a.cost > b.cost;
+    }
+    return a.order < b.order;
+}
 
 std::ostream& operator<< (std::ostream &out, const AirportInfo &ai)
 {
@@ -175,108 +203,72 @@ void Scheduler::set_debug( std::string path, std::vector<std::string> runway_def
     }
 }
 
-bool Scheduler::IsAirportDefinition( char* line, std::string icao )
+void Scheduler::AddAirport( std::string icao )
 {
-    char*    tok;
-    int      code;
-    bool     match = false;
+    long pos = index.FindAirport( icao );
 
-    // Get the number code
-    tok = strtok(line, " \t\r\n");
-
-    if (tok)
+    TG_LOG( SG_GENERAL, SG_INFO, "Adding airport " << icao << " to parse list");
+    if ( pos >= 0 )
     {
-        line += strlen(tok)+1;
-        code = atoi(tok);
-
-        switch(code)
-        {
-            case LAND_AIRPORT_CODE:
-            case SEA_AIRPORT_CODE:
-            case HELIPORT_CODE:
-            {
-                Airport ap( code, line );
-                if ( ap.GetIcao() == icao )
-                {
-                    match = true;
-                }
-            }
-                break;
-
-            case LAND_RUNWAY_CODE:
-            case WATER_RUNWAY_CODE:
-            case HELIPAD_CODE:
-            case PAVEMENT_CODE:
-            case LINEAR_FEATURE_CODE:
-            case BOUNDRY_CODE:
-            case NODE_CODE:
-            case BEZIER_NODE_CODE:
-            case CLOSE_NODE_CODE:
-            case CLOSE_BEZIER_NODE_CODE:
-            case TERM_NODE_CODE:
-            case TERM_BEZIER_NODE_CODE:
-            case AIRPORT_VIEWPOINT_CODE:
-            case AIRPLANE_STARTUP_LOCATION_CODE:
-            case LIGHT_BEACON_CODE:
-            case WINDSOCK_CODE:
-            case TAXIWAY_SIGN:
-            case LIGHTING_OBJECT:
-            case COMM_FREQ1_CODE:
-            case COMM_FREQ2_CODE:
-            case COMM_FREQ3_CODE:
-            case COMM_FREQ4_CODE:
-            case COMM_FREQ5_CODE:
-            case COMM_FREQ6_CODE:
-            case COMM_FREQ7_CODE:
-            case END_OF_FILE :
-                break;
-        }
-    }
+        TG_LOG( SG_GENERAL, SG_DEBUG, "Found airport " << icao << " at " << pos );
 
-    return match;
+        AirportInfo ai = AirportInfo( icao, pos, gSnap );
+        global_workQueue.push( ai );
+    }
 }
 
-void Scheduler::AddAirport( std::string icao )
+long Scheduler::FindAirport( std::string icao )
 {
-    char            line[2048];
-    long            cur_pos;
-    bool            found = false;
-    AirportInfo     ai;
+    TG_LOG( SG_GENERAL, SG_DEBUG, "Finding airport " << icao );
 
-    std::ifstream in( filename.c_str() );
-    if ( !in.is_open() )
+    long pos = index.FindAirport( icao );
+    if ( pos >= 0 )
     {
-        TG_LOG( SG_GENERAL, SG_ALERT, "Cannot open file: " << filename );
-        exit(-1);
+        TG_LOG( SG_GENERAL, SG_DEBUG, "Found airport " << icao << " at " << pos );
+        return pos;
     }
-
-    TG_LOG( SG_GENERAL, SG_INFO, "Adding airport " << icao << " to parse list");
-    while ( !in.eof() && !found )
+    else
     {
-        // remember the position of this line
-        cur_pos = in.tellg();
+        return 0;
+    }
+}
 
-        // get a line
-    	in.getline(line, 2048);
+void Scheduler::RetryAirport( AirportInfo* pai )
+{
+    // retryList.push_back( *pai );
+}
+
+bool Scheduler::AddAirports( long start_pos, tgRectangle* boundingBox )
+{
+    std::vector<const AptIndexEntry*> airports;
 
-        // this is and airport definition - remember it
-        if ( IsAirportDefinition( line, icao ) )
-        {
-            TG_LOG( SG_GENERAL, SG_DEBUG, "Found airport " << icao << " at " << cur_pos );
+    // push all airports from the start position on where a runway start
+    // or end, or a helipad lies within the given min/max coordinates
+    index.FindAirports( start_pos, *boundingBox, airports );
 
-            ai = AirportInfo( icao, cur_pos, gSnap );
-            global_workQueue.push( ai );
+    for ( unsigned int i = 0; i < airports.size(); i++ )
+    {
+        // Start off with given snap value
+        AirportInfo ai = AirportInfo( airports[i]->icao, airports[i]->pos, gSnap );
+        global_workQueue.push( ai );
+    }
 
-            found = true;
-        }
+    // did we add airports to the parse list?
+    if ( global_workQueue.size() ) {
+        return true;
+    } else {
+        return false;
     }
 }
 
-long Scheduler::FindAirport( std::string icao )
+Scheduler::Scheduler(std::string& datafile, const std::string& root, const string_list& elev_src) :
+    index( datafile )
 {
-    char line[2048];
-    long cur_pos = 0;
-    bool found = false;
+    filename        = datafile;
+    work_dir        = root;
+    elevation       = elev_src;
+    cost_profile    = root + "/genapts_costs.txt";
+    build_threads   = 0;
 
     std::ifstream in( filename.c_str() );
     if ( !in.is_open() )
@@ -285,206 +277,112 @@ long Scheduler::FindAirport( std::string icao )
         exit(-1);
     }
 
-    TG_LOG( SG_GENERAL, SG_DEBUG, "Finding airport " << icao );
-    while ( !in.eof() && !found )
+    if ( !index.Load() )
     {
-        // remember the position of this line
-        cur_pos = in.tellg();
-
-        // get a line
-    	in.getline(line, 2048);
-
-        // this is and airport definition - remember it
-        if ( IsAirportDefinition( line, icao ) )
-        {
-            TG_LOG( SG_GENERAL, SG_DEBUG, "Found airport " << line << " at " << cur_pos );
-            found = true;
-        }
+        TG_LOG( SG_GENERAL, SG_ALERT, "Cannot index file: " << filename );
+        exit(-1);
     }
-
-	if (found)
-	{
-		return cur_pos;
-	}
-	else
-	{
-		return 0;
-	}
 }
 
-void Scheduler::RetryAirport( AirportInfo* pai )
+double Scheduler::EstimateCost( const AptIndexEntry* entry )
 {
-    // retryList.push_back( *pai );
+    if ( !entry ) {
+        return COST_BASE;
+    }
+
+    return COST_BASE +
+           COST_PER_RUNWAY   * entry->num_runways +
+           COST_PER_HELIPAD  * entry->num_helipads +
+           COST_PER_PAVEMENT * entry->num_pavements +
+           COST_PER_FEATURE  * entry->num_features +
+           COST_PER_NODE     * entry->num_nodes;
 }
 
-bool Scheduler::AddAirports( long start_pos, tgRectangle* boundingBox )
+void Scheduler::ReadCostProfile( void )
 {
-    char 	 line[2048];
-    char*	 def;
-    long 	 cur_pos;
-    long	 cur_apt_pos = 0;
-    std::string  cur_apt_name;
-    char*    tok;
-    int      code;
-    bool 	 match;
-    bool 	 done;
-
-    done  = false;
-    match = false;
-
-    // start from current position, and push all airports where a runway start or end
-    // lies within the given min/max coordinates
+    recorded_costs.clear();
+    if ( cost_profile.empty() ) {
+        return;
+    }
 
-    std::ifstream in( filename.c_str() );
-    if ( !in.is_open() )
-    {
-        TG_LOG( SG_GENERAL, SG_ALERT, "Cannot open file: " << filename );
-        exit(-1);
+    std::ifstream in( cost_profile.c_str() );
+    std::string   icao;
+    double        secs;
+
+    while ( in >> icao >> secs ) {
+        recorded_costs[icao] = secs;
     }
 
-    if (start_pos)
-    {
-        in.seekg(start_pos, std::ios::beg);
+    TG_LOG( SG_GENERAL, SG_INFO, "Read " << recorded_costs.size() << " airport build times from " << cost_profile );
+}
+
+void Scheduler::WriteCostProfile( void )
+{
+    while ( !global_doneQueue.empty() ) {
+        AirportInfo ai = global_doneQueue.pop();
+        recorded_costs[ai.GetIcao()] = ai.GetTotalTime();
     }
 
-    while (!done)
-    {
-        // remember the position of this line
-        cur_pos = in.tellg();
+    if ( cost_profile.empty() ) {
+        return;
+    }
 
-        // get a line
-        in.getline(line, 2048);
-        def = &line[0];
+    std::string   tmp_file = cost_profile + ".tmp";
+    std::ofstream out( tmp_file.c_str(), std::ios_base::out | std::ios_base::trunc );
+    if ( !out.is_open() ) {
+        TG_LOG( SG_GENERAL, SG_ALERT, "Cannot write cost profile " << cost_profile );
+        return;
+    }
 
-        // Get the number code
-        tok = strtok(def, " \t\r\n");
+    std::map<std::string, double>::const_iterator it;
+    for ( it = recorded_costs.begin(); it != recorded_costs.end(); ++it ) {
+        out << it->first << " " << it->second << "\n";
+    }
+    out.close();
 
-        if (tok)
-        {
-            def += strlen(tok)+1;
-            code = atoi(tok);
+    remove( cost_profile.c_str() );
+    rename( tmp_file.c_str(), cost_profile.c_str() );
+}
 
-            switch(code)
-            {
-                case LAND_AIRPORT_CODE:
-                case SEA_AIRPORT_CODE:
-                case HELIPORT_CODE:
-                {
-                    Airport* airport = new Airport( code, def );
-                    if (match)
-                    {
-                        // Start off with given snap value
-                        AirportInfo ai = AirportInfo( cur_apt_name, cur_apt_pos, gSnap );
-                        global_workQueue.push( ai );
-                    }
-                    // remember this new apt pos and name, and clear match
-                    cur_apt_pos  = cur_pos;
-                    cur_apt_name = airport->GetIcao();
-                    delete airport;
-
-                    match = false;
-                }
-                break;
-
-                case END_OF_FILE:
-                    if (match)
-                    {
-                        // Start off with given snap value
-                        AirportInfo ai = AirportInfo( cur_apt_name, cur_apt_pos, gSnap );
-                        global_workQueue.push( ai );
-                    }
-                    done = true;
-                    break;
-
-                case LAND_RUNWAY_CODE:
-                    // if the the runway start / end  coords are within the rect,
-                    // we have a winner
-                    {
-                        Runway* runway = new Runway(def);
-                        if ( boundingBox->isInside(runway->GetStart()) ) {
-                            match = true;
-                        }
-                        else if ( boundingBox->isInside(runway->GetEnd()) ) {
-                            match = true;
-                        }
-                        delete runway;
-                    }
-                    break;
-
-                case WATER_RUNWAY_CODE:
-                    // if the the runway start / end  coords are within the rect,
-                    // we have a winner
-                    {
-                        WaterRunway* runway = new WaterRunway(def);
-                        if ( boundingBox->isInside(runway->GetStart()) ) {
-                            match = true;
-                        }
-                        else if ( boundingBox->isInside(runway->GetEnd()) ) {
-                            match = true;
-                        }
-                        delete runway;
-                    }
-                    break;
-
-                case HELIPAD_CODE:
-                    // if the heliport coords are within the rect, we have
-                    // a winner
-                    {
-                        Helipad* helipad = new Helipad(def);
-                        if ( boundingBox->isInside(helipad->GetLoc()) ) {
-                            match = true;
-                        }
-                        delete helipad;
-                    }
-                    break;
-
-                case TAXIWAY_CODE:
-                case PAVEMENT_CODE:
-                case LINEAR_FEATURE_CODE:
-                case BOUNDRY_CODE:
-                case NODE_CODE:
-                case BEZIER_NODE_CODE:
-                case CLOSE_NODE_CODE:
-                case CLOSE_BEZIER_NODE_CODE:
-                case TERM_NODE_CODE:
-                case TERM_BEZIER_NODE_CODE:
-                case AIRPORT_VIEWPOINT_CODE:
-                case AIRPLANE_STARTUP_LOCATION_CODE:
-                case LIGHT_BEACON_CODE:
-                case WINDSOCK_CODE:
-                case TAXIWAY_SIGN:
-                case LIGHTING_OBJECT:
-                case COMM_FREQ1_CODE:
-                case COMM_FREQ2_CODE:
-                case COMM_FREQ3_CODE:
-                case COMM_FREQ4_CODE:
-                case COMM_FREQ5_CODE:
-                case COMM_FREQ6_CODE:
-                case COMM_FREQ7_CODE:
-                    break;
-            }
+// Reorder the work queue so the most expensive airports go first - a
+// big airport picked up last keeps one thread busy long after all the
+// others are done.  Airports built before use their recorded time, the
+// others the index based estimate, scaled to seconds by the airports
+// that have both.
+void Scheduler::SortWorkQueue( void )
+{
+    std::vector<ScheduledAirport> airports;
+    double recorded = 0.0, estimated = 0.0;
+
+    while ( !global_workQueue.empty() ) {
+        ScheduledAirport sa;
+        sa.info  = global_workQueue.pop();
+        sa.order = airports.size();
+        sa.cost  = EstimateCost( index.GetAirport( sa.info.GetIcao() ) );
+
+        std::map<std::string, double>::const_iterator it = recorded_costs.find( sa.info.GetIcao() );
+        if ( it != recorded_costs.end() ) {
+            recorded  += it->second;
+            estimated += sa.cost;
         }
+        airports.push_back( sa );
     }
 
-    // did we add airports to the parse list?
-    if ( global_workQueue.size() ) {
-        return true;
-    } else {
-        return false;
+    double scale = ( recorded > 0.0 && estimated > 0.0 ) ? recorded / estimated : 1.0;
+    for ( unsigned int i = 0; i < airports.size(); i++ ) {
+        std::map<std::string, double>::const_iterator it = recorded_costs.find( airports[i].info.GetIcao() );
+        if ( it != recorded_costs.end() ) {
+            airports[i].cost = it->second;
+        } else {
+            airports[i].cost *= scale;
+        }
     }
-}
 
-Scheduler::Scheduler(std::string& datafile, const std::string& root, const string_list& elev_src)
-{
-    filename        = datafile;
-    work_dir        = root;
-    elevation       = elev_src;
+    std::sort( airports.begin(), airports.end(), costlier );
 
-    std::ifstream in( filename.c_str() );
-    if ( !in.is_open() )
-    {
-        TG_LOG( SG_GENERAL, SG_ALERT, "Cannot open file: " << filename );
-        exit(-1);
+    for ( unsigned int i = 0; i < airports.size(); i++ ) {
+        TG_LOG( SG_GENERAL, SG_DEBUG, "Schedule " << airports[i].info.GetIcao() << " cost " << airports[i].cost );
+        global_workQueue.push( airports[i].info );
     }
 }
 
@@ -496,6 +394,19 @@ void Scheduler::Schedule( int num_threads, std::string& summaryfile )
 //    csvfile.open( summaryfile.c_str(), std::ios_base::out | std::ios_base::trunc );
 //    csvfile.close();
 
+    ReadCostProfile();
+    SortWorkQueue();
+
+    // with fewer airports than threads, let the spare ones help build
+    // the airports themselves
+    if ( build_threads > 0 ) {
+        gBuildThreads = build_threads;
+    } else {
+        unsigned int airports = global_workQueue.size();
+        gBuildThreads = ( airports && (unsigned int)num_threads > airports ) ? num_threads / airports : 1;
+    }
+    TG_LOG( SG_GENERAL, SG_INFO, "Building each airport with up to " << gBuildThreads << " threads" );
+
     std::vector<Parser *> parsers;
     for (int i=0; i<num_threads; i++) {
         Parser* parser = new Parser( filename, work_dir, elevation );
@@ -513,4 +424,7 @@ void Scheduler::Schedule( int num_threads, std::string& summaryfile )
         parsers[i]->join();
         delete parsers[i];
     }
+
+    // remember the build times for the next run
+    WriteCostProfile();
 }
@@ -4,6 +4,7 @@
 #include <string>
 #include <iostream>
 #include <fstream>
+#include <map>
 
 #include <simgear/compiler.h>
 #include <simgear/math/sg_types.hxx>
@@ -12,6 +13,7 @@
 #include <simgear/threads/SGQueue.hxx>
 #include <terragear/tg_rectangle.hxx>
 #include "airport.hxx"
+#include "apt_index.hxx"
 
 #define P_STATE_INIT        (0)
 #define P_STATE_PARSE       (1)
@@ -72,6 +74,8 @@ public:
 
     void    IncreaseSnap( void )                    { snap *= 2.0f; }
 
+    double  GetTotalTime( void )                    { return (parseTime+buildTime+cleanTime+tessTime).toSecs(); }
+
     friend std::ostream& operator<<(std::ostream& output, const AirportInfo& ai);
 
 private:
@@ -93,6 +97,7 @@ private:
 };
 
 extern SGLockedQueue<AirportInfo> global_workQueue;
+extern SGLockedQueue<AirportInfo> global_doneQueue;
 
 class Scheduler
 {
@@ -106,6 +111,12 @@ public:
 
     void            Schedule( int num_threads, std::string& summaryfile );
 
+    // build times of earlier runs, read before and updated after Schedule
+    void            set_cost_profile( const std::string& file ) { cost_profile = file; }
+
+    // threads per airport build, 0 to use the ones left over
+    void            set_build_threads( int threads ) { build_threads = threads; }
+
     // Debug
     void            set_debug( std::string path, std::vector<std::string> runway_defs,
                                                  std::vector<std::string> pavement_defs,
@@ -113,9 +124,18 @@ public:
                                                  std::vector<std::string> feature_defs );
 
 private:
-    bool            IsAirportDefinition( char* line, std::string icao );
+    double          EstimateCost( const AptIndexEntry* entry );
+    void            SortWorkQueue( void );
+    void            ReadCostProfile( void );
+    void            WriteCostProfile( void );
 
     std::string     filename;
+    AptIndex        index;
+
+    // icao -> seconds
+    std::string     cost_profile;
+    std::map<std::string, double> recorded_costs;
+    int             build_threads;
     string_list     elevation;
     std::string     work_dir;
 
@@ -57,8 +57,16 @@ static void usage( const string name ) {
     SG_LOG(SG_GENERAL, SG_ALERT, "  --priorities=<filename>");
     SG_LOG(SG_GENERAL, SG_ALERT, "  --usgs-map=<filename>");
     SG_LOG(SG_GENERAL, SG_ALERT, "  --ignore-landmass");
+    SG_LOG(SG_GENERAL, SG_ALERT, "  --strips");
+    SG_LOG(SG_GENERAL, SG_ALERT, "  --reorder-nodes");
+    SG_LOG(SG_GENERAL, SG_ALERT, "  --vertex-cache=<size>");
     SG_LOG(SG_GENERAL, SG_ALERT, "  --threads");
     SG_LOG(SG_GENERAL, SG_ALERT, "  --threads=<numthreads>");
+    SG_LOG(SG_GENERAL, SG_ALERT, "  --debug-dir=<directory>");
+    SG_LOG(SG_GENERAL, SG_ALERT, "  --debug-areas=<tile>:<area,...|all>");
+    SG_LOG(SG_GENERAL, SG_ALERT, "  --debug-shapes=<tile>:<id,...|all>");
+    SG_LOG(SG_GENERAL, SG_ALERT, "  --debug-layers=<layer prefix>");
+    SG_LOG(SG_GENERAL, SG_ALERT, "  --debug-sample=<write every nth feature>");
     SG_LOG(SG_GENERAL, SG_ALERT, " ] <load directory...>");
     exit(-1);
 }
@@ -76,11 +84,16 @@ int main(int argc, char **argv) {
 
     vector<string> load_dirs;
     bool ignoreLandmass = false;
+    bool use_strips = false;
+    bool reorder_nodes = false;
+    unsigned int vcache_size = 16;
     double nudge=0.0;
 
     string debug_dir = ".";
     vector<string> debug_shape_defs;
     vector<string> debug_area_defs;
+    vector<string> debug_layers;
+    unsigned int debug_sample = 1;
 
     sglog().setLogLevels( SG_ALL, SG_INFO );
 
@@ -117,6 +130,12 @@ int main(int argc, char **argv) {
             usgs_map_file = arg.substr(11);
         } else if (arg.find("--ignore-landmass") == 0) {
             ignoreLandmass = true;
+        } else if (arg.find("--strips") == 0) {
+            use_strips = true;
+        } else if (arg.find("--reorder-nodes") == 0) {
+            reorder_nodes = true;
+        } else if (arg.find("--vertex-cache=") == 0) {
+            vcache_size = atoi( arg.substr(15).c_str() );
         } else if (arg.find("--threads=") == 0) {
             num_threads = atoi( arg.substr(10).c_str() );
         } else if (arg.find("--threads") == 0) {
@@ -127,6 +146,10 @@ int main(int argc, char **argv) {
             debug_area_defs.push_back( arg.substr(14) );
         } else if (arg.find("--debug-shapes=") == 0) {
             debug_shape_defs.push_back( arg.substr(15) );
+        } else if (arg.find("--debug-layers=") == 0) {
+            debug_layers.push_back( arg.substr(15) );
+        } else if (arg.find("--debug-sample=") == 0) {
+            debug_sample = atoi( arg.substr(15).c_str() );
         } else if (arg.find("--") == 0) {
             usage(argv[0]);
         } else {
@@ -166,6 +189,20 @@ int main(int argc, char **argv) {
         exit( -1 );
     }
 
+    // land cover raster, mapped once and shared by all threads
+    LandCover* landcover = NULL;
+    if ( cover.size() > 0 ) {
+        try {
+            landcover = new LandCover( cover );
+        } catch ( std::string e ) {
+            SG_LOG(SG_GENERAL, SG_ALERT, "Unable to open land cover " << cover << ": " << e);
+            exit( -1 );
+        }
+        if ( load_usgs_map( usgs_map_file, areas ) ) {
+            exit( -1 );
+        }
+    }
+
     // tile work queue
     std::vector<SGBucket> bucketList;
     SGLockedQueue<SGBucket> wq;
@@ -195,15 +232,24 @@ int main(int argc, char **argv) {
 	    wq.push( bucketList[i] );
 	}
 
+    // when there are fewer tiles than threads, the spare threads work within a tile
+    unsigned int tile_threads = 1;
+    if ( bucketList.size() && bucketList.size() < (unsigned int)num_threads ) {
+        tile_threads = num_threads / bucketList.size();
+    }
+
     // now create the worker threads for stage 1
     std::vector<TGConstruct *> constructs;
 
     for (int i=0; i<num_threads; i++) {
         TGConstruct* construct = new TGConstruct( areas, 1, wq );
-        //construct->set_cover( cover );
+        construct->set_cover( landcover );
         construct->set_paths( work_dir, share_dir, output_dir, load_dirs );
         construct->set_options( ignoreLandmass, nudge );
+        construct->set_output_options( use_strips, reorder_nodes, vcache_size );
+        construct->set_tile_threads( tile_threads );
         construct->set_debug( debug_dir, debug_area_defs, debug_shape_defs );
+        construct->set_debug_filter( debug_sample, debug_layers );
         constructs.push_back( construct );
     }
 
@@ -233,10 +279,13 @@ int main(int argc, char **argv) {
 
     for (int i=0; i<num_threads; i++) {
         TGConstruct* construct = new TGConstruct( areas, 2, wq );
-        //construct->set_cover( cover );
+        construct->set_cover( landcover );
         construct->set_paths( work_dir, share_dir, output_dir, load_dirs );
         construct->set_options( ignoreLandmass, nudge );
+        construct->set_output_options( use_strips, reorder_nodes, vcache_size );
+        construct->set_tile_threads( tile_threads );
         construct->set_debug( debug_dir, debug_area_defs, debug_shape_defs );
+        construct->set_debug_filter( debug_sample, debug_layers );
         constructs.push_back( construct );
     }
 
@@ -265,10 +314,13 @@ int main(int argc, char **argv) {
 
     for (int i=0; i<num_threads; i++) {
         TGConstruct* construct = new TGConstruct( areas, 3, wq );
-        //construct->set_cover( cover );
+        construct->set_cover( landcover );
         construct->set_paths( work_dir, share_dir, output_dir, load_dirs );
         construct->set_options( ignoreLandmass, nudge );
+        construct->set_output_options( use_strips, reorder_nodes, vcache_size );
+        construct->set_tile_threads( tile_threads );
         construct->set_debug( debug_dir, debug_area_defs, debug_shape_defs );
+        construct->set_debug_filter( debug_sample, debug_layers );
         constructs.push_back( construct );
     }
 
@@ -290,6 +342,8 @@ int main(int argc, char **argv) {
     }
     constructs.clear();
 
+    delete landcover;
+
     SG_LOG(SG_GENERAL, SG_ALERT, "[Finished successfully]");
     return 0;
 }
@@ -155,6 +155,17 @@ public:
         return 0;
     }
 
+    // as above, but returns -1 for unknown areas (such as Default)
+    int find_area_priority( const std::string& name ) const {
+        for (unsigned int i=0; i < area_defs.size(); i++) {
+            if ( area_defs[i].GetName() == name ) {
+                return i;
+            }
+        }
+
+        return -1;
+    }
+
 
     std::string const& get_sliver_area_name( void ) const {
         return sliver_area_name;
@@ -28,6 +28,10 @@
 #include <iomanip>
 
 #include <simgear/debug/logstream.hxx>
+#include <simgear/structure/exception.hxx>
+
+#include <terragear/tg_shapefile.hxx>
+
 #include "tgconstruct.hxx"
 
 const double TGConstruct::gSnap = 0.00000001;      // approx 1 mm
@@ -37,9 +41,16 @@ TGConstruct::TGConstruct( const TGAreaDefinitions& areas, unsigned int s, SGLock
         area_defs(areas),
         workQueue(q),
         stage(s),
+        cover(NULL),
         ignoreLandmass(false),
+        use_strips(false),
+        reorder_nodes(false),
+        vcache_size(16),
         debug_all(false),
+        debug_sample(1),
         ds_id((void*)-1),
+        array_loaded(false),
+        keep_array(false),
         isOcean(false)
 {
     total_tiles = q.size();
@@ -70,6 +81,12 @@ void TGConstruct::set_options( bool ignore_lm, double n ) {
     nudge          = n;
 }
 
+void TGConstruct::set_output_options( bool strips, bool reorder, unsigned int cache ) {
+    use_strips    = strips;
+    reorder_nodes = reorder;
+    vcache_size   = cache;
+}
+
 void TGConstruct::run()
 {
     unsigned int tiles_complete;
@@ -79,172 +96,220 @@ void TGConstruct::run()
         bucket = workQueue.pop();
         tiles_complete = total_tiles - workQueue.size();
 
-        // assume non ocean tile until proven otherwise
-        isOcean = false;
-
-        // Initialize the landclass lists with the number of area definitions
-        polys_in.init( num_areas );
-        polys_clipped.init( num_areas );
-
         SG_LOG(SG_GENERAL, SG_ALERT, bucket.gen_index_str() << " - Construct in " << bucket.gen_base_path() << " tile " << tiles_complete << " of " << total_tiles << " using thread " << current() );
 
-        // Init debug shapes and area for this bucket
-        get_debug();
-        if ( debug_shapes.size() || debug_all ) {
-            sprintf(ds_name, "%s/constructdbg_%s", debug_path.c_str(), bucket.gen_index_str().c_str() );
-        } else {
-            strcpy( ds_name, "" );
+        try {
+            ConstructBucket();
+        } catch ( sg_exception& e ) {
+            SG_LOG(SG_GENERAL, SG_ALERT, bucket.gen_index_str() << " - Construct failed: " << e.getFormattedMessage() );
+            exit( -1 );
         }
+    }
+}
 
-        if ( stage > 1 ) {
-            LoadFromIntermediateFiles( stage-1 );
-            LoadSharedEdgeData( stage-1 );
-        }
+void TGConstruct::ConstructBucket( const SGBucket& b, unsigned int s )
+{
+    bucket = b;
+    stage  = s;
 
-        switch( stage ) {
-            case 1:
-                // STEP 1)
-                // Load grid of elevation data (Array), and add the nodes
-                LoadElevationArray( true );
-
-                // STEP 2)
-                // Clip 2D polygons against one another
-                SG_LOG(SG_GENERAL, SG_ALERT, bucket.gen_index_str() << " - Loading landclass polys" );
-                if ( LoadLandclassPolys() == 0 ) {
-                    // don't build the tile if there is no 2d data ... it *must*
-                    // be ocean and the sim can build the tile on the fly.
-                    isOcean = true;
-                    break;
-                }
+    SG_LOG(SG_GENERAL, SG_ALERT, bucket.gen_index_str() << " - Construct stage " << stage << " in " << bucket.gen_base_path() );
 
-#if 0
-                // STEP 3)
-                // Load the land use polygons if the --cover option was specified
-                if ( get_cover().size() > 0 ) {
-                    SG_LOG(SG_GENERAL, SG_ALERT, bucket.gen_index_str() << " - Loading landclass raster" );
-                    load_landcover();
-                }
-#endif
+    ConstructBucket();
+}
 
-                // STEP 4)
-                // Clip the Landclass polygons
-                SG_LOG(SG_GENERAL, SG_ALERT, bucket.gen_index_str() << " - Clipping landclass polys" );
-                ClipLandclassPolys();
+// run the current stage on the current bucket - a stage that fails must
+// not leave its data to the next bucket of this construct
+void TGConstruct::ConstructBucket( void )
+{
+    Reset();
 
-                // STEP 5)
-                // Clean the polys - after this, we shouldn't change their shape (other than slightly for
-                // fix T-Junctions - as This is the end of the first pass for multicore design
-                SG_LOG(SG_GENERAL, SG_ALERT, bucket.gen_index_str() << " - Cleaning landclass polys" );
-                nodes.init_spacial_query();
-                CleanClippedPolys();
-                break;
+    try {
+        RunStage();
+    } catch ( ... ) {
+        Reset();
+        array.unload();
+        array_loaded = false;
+        throw;
+    }
 
-            case 2:
-                if ( !IsOceanTile() ) {
-                    // STEP 6)
-                    // Need the array of elevation data for stage 2, but don't add the nodes - we already have them
-                    LoadElevationArray( false );
-
-                    // STEP 7)
-                    // Fix T-Junctions by finding nodes that lie close to polygon edges, and
-                    // inserting them into the edge
-                    SG_LOG(SG_GENERAL, SG_ALERT, bucket.gen_index_str() << " - Fix T-Junctions" );
-                    nodes.init_spacial_query();
-                    FixTJunctions();
-
-                    // STEP 8)
-                    // Generate triangles - we can't generate the node-face lookup table
-                    // until all polys are tesselated, as extra nodes can still be generated
-                    SG_LOG(SG_GENERAL, SG_ALERT, bucket.gen_index_str() << " - Tesselate" );
-                    TesselatePolys();
-
-                    // STEP 9)
-                    // Generate triangle vertex coordinates to node index lists
-                    // NOTE: After this point, no new nodes can be added
-                    SG_LOG(SG_GENERAL, SG_ALERT, bucket.gen_index_str() << " - Lookup Nodes Per Vertex");
-                    LookupNodesPerVertex();
-
-                    // STEP 10)
-                    // Interpolate elevations, and flatten stuff
-                    SG_LOG(SG_GENERAL, SG_ALERT, bucket.gen_index_str() << " - Calculate Elevation Per Node");
-                    CalcElevations();
-
-                    // ONLY do this when saving edge nodes...
-                    // STEP 11)
-                    // Generate face-connected list - needed for saving the edge data
-                    SG_LOG(SG_GENERAL, SG_ALERT, bucket.gen_index_str() << " - Lookup Faces Per Node");
-                    LookupFacesPerNode();
-                }
+    Reset();
+}
+
+// clean up for next work queue item
+void TGConstruct::Reset( void )
+{
+    tgShapefile::EndSink();
+    if ( !keep_array ) {
+        array.unload();
+        array_loaded = false;
+    }
+    polys_in.clear();
+    polys_clipped.clear();
+    nodes.clear();
+    neighbor_faces.clear();
+    debug_shapes.clear();
+    debug_areas.clear();
+}
+
+void TGConstruct::RunStage( void )
+{
+    // assume non ocean tile until proven otherwise
+    isOcean = false;
+
+    // Initialize the landclass lists with the number of area definitions
+    polys_in.init( num_areas );
+    polys_clipped.init( num_areas );
+
+    // Init debug shapes and area for this bucket
+    get_debug();
+    if ( debug_shapes.size() || debug_all ) {
+        sprintf(ds_name, "%s/constructdbg_%s", debug_path.c_str(), bucket.gen_index_str().c_str() );
+    } else {
+        strcpy( ds_name, "" );
+    }
+
+    // keep the debug shapefiles open until the tile is done
+    if ( debug_all || debug_shapes.size() || debug_areas.size() ) {
+        tgShapefile::BeginSink( debug_sample, debug_layers );
+    }
+
+    if ( stage > 1 ) {
+        LoadFromIntermediateFiles( stage-1 );
+        LoadSharedEdgeData( stage-1 );
+    }
+
+    switch( stage ) {
+        case 1:
+            // STEP 1)
+            // Load grid of elevation data (Array), and add the nodes
+            LoadElevationArray( true );
+
+            // STEP 2)
+            // Clip 2D polygons against one another
+            SG_LOG(SG_GENERAL, SG_ALERT, bucket.gen_index_str() << " - Loading landclass polys" );
+            if ( LoadLandclassPolys() == 0 ) {
+                // don't build the tile if there is no 2d data ... it *must*
+                // be ocean and the sim can build the tile on the fly.
+                isOcean = true;
                 break;
+            }
 
-            case 3:
-                if ( !IsOceanTile() ) {
-                    // STEP 12
-                    // Generate face-connectd list (again) - it was needed to save faces of the
-                    // edge nodes, but saving the entire tile is i/o intensive - it's faster
-                    // too just recompute the list
-                    SG_LOG(SG_GENERAL, SG_ALERT, bucket.gen_index_str() << " - Lookup Faces Per Node (again)");
-                    LookupFacesPerNode();
-
-                    // STEP 13)
-                    // Average out the elevation for nodes on tile boundaries
-                    SG_LOG(SG_GENERAL, SG_ALERT, bucket.gen_index_str() << " - Average Edge Node Elevations");
-                    AverageEdgeElevations();
-
-                    // STEP 14)
-                    // Calculate Face Normals
-                    SG_LOG(SG_GENERAL, SG_ALERT, bucket.gen_index_str() << " - Calculate Face Normals");
-                    CalcFaceNormals();
-
-                    // STEP 15)
-                    // Calculate Point Normals
-                    SG_LOG(SG_GENERAL, SG_ALERT, bucket.gen_index_str() << " - Calculate Point Normals");
-                    CalcPointNormals();
+            // STEP 3)
+            // Load the land use polygons if the --cover option was specified
+            if ( cover ) {
+                SG_LOG(SG_GENERAL, SG_ALERT, bucket.gen_index_str() << " - Loading landclass raster" );
+                LoadLandcoverRaster();
+            }
+
+            // STEP 4)
+            // Clip the Landclass polygons
+            SG_LOG(SG_GENERAL, SG_ALERT, bucket.gen_index_str() << " - Clipping landclass polys" );
+            ClipLandclassPolys();
+
+            // STEP 5)
+            // Clean the polys - after this, we shouldn't change their shape (other than slightly for
+            // fix T-Junctions - as This is the end of the first pass for multicore design
+            SG_LOG(SG_GENERAL, SG_ALERT, bucket.gen_index_str() << " - Cleaning landclass polys" );
+            nodes.init_spacial_query();
+            CleanClippedPolys();
+            break;
+
+        case 2:
+            if ( !IsOceanTile() ) {
+                // STEP 6)
+                // Need the array of elevation data for stage 2, but don't add the nodes - we already have them
+                LoadElevationArray( false );
+
+                // STEP 7)
+                // Fix T-Junctions by finding nodes that lie close to polygon edges, and
+                // inserting them into the edge
+                SG_LOG(SG_GENERAL, SG_ALERT, bucket.gen_index_str() << " - Fix T-Junctions" );
+                nodes.init_spacial_query();
+                FixTJunctions();
+
+                // STEP 8)
+                // Generate triangles - we can't generate the node-face lookup table
+                // until all polys are tesselated, as extra nodes can still be generated
+                SG_LOG(SG_GENERAL, SG_ALERT, bucket.gen_index_str() << " - Tesselate" );
+                TesselatePolys();
+
+                // STEP 9)
+                // Generate triangle vertex coordinates to node index lists
+                // NOTE: After this point, no new nodes can be added
+                SG_LOG(SG_GENERAL, SG_ALERT, bucket.gen_index_str() << " - Lookup Nodes Per Vertex");
+                LookupNodesPerVertex();
+
+                // STEP 10)
+                // Interpolate elevations, and flatten stuff
+                SG_LOG(SG_GENERAL, SG_ALERT, bucket.gen_index_str() << " - Calculate Elevation Per Node");
+                CalcElevations();
+
+                // ONLY do this when saving edge nodes...
+                // STEP 11)
+                // Generate face-connected list - needed for saving the edge data
+                SG_LOG(SG_GENERAL, SG_ALERT, bucket.gen_index_str() << " - Lookup Faces Per Node");
+                LookupFacesPerNode();
+            }
+            break;
+
+        case 3:
+            if ( !IsOceanTile() ) {
+                // STEP 12
+                // Generate face-connectd list (again) - it was needed to save faces of the
+                // edge nodes, but saving the entire tile is i/o intensive - it's faster
+                // too just recompute the list
+                SG_LOG(SG_GENERAL, SG_ALERT, bucket.gen_index_str() << " - Lookup Faces Per Node (again)");
+                LookupFacesPerNode();
+
+                // STEP 13)
+                // Average out the elevation for nodes on tile boundaries
+                SG_LOG(SG_GENERAL, SG_ALERT, bucket.gen_index_str() << " - Average Edge Node Elevations");
+                AverageEdgeElevations();
+
+                // STEP 14)
+                // Calculate Face Normals
+                SG_LOG(SG_GENERAL, SG_ALERT, bucket.gen_index_str() << " - Calculate Face Normals");
+                CalcFaceNormals();
+
+                // STEP 15)
+                // Calculate Point Normals
+                SG_LOG(SG_GENERAL, SG_ALERT, bucket.gen_index_str() << " - Calculate Point Normals");
+                CalcPointNormals();
 
 #if 0
-                    // STEP 16)
-                    if ( c.get_cover().size() > 0 ) {
-                        // Now for all the remaining "default" land cover polygons, assign
-                        // each one it's proper type from the land use/land cover
-                        // database.
-                        fix_land_cover_assignments( c );
-                    }
+                // STEP 16)
+                if ( c.get_cover().size() > 0 ) {
+                    // Now for all the remaining "default" land cover polygons, assign
+                    // each one it's proper type from the land use/land cover
+                    // database.
+                    fix_land_cover_assignments( c );
+                }
 #endif
 
-                    // STEP 17)
-                    // Calculate Texture Coordinates
-                    SG_LOG(SG_GENERAL, SG_ALERT, bucket.gen_index_str() << " - Calculate Texture Coordinates");
-                    CalcTextureCoordinates();
+                // STEP 17)
+                // Calculate Texture Coordinates
+                SG_LOG(SG_GENERAL, SG_ALERT, bucket.gen_index_str() << " - Calculate Texture Coordinates");
+                CalcTextureCoordinates();
 
-                    // STEP 18)
-                    // Generate the btg file
-                    SG_LOG(SG_GENERAL, SG_ALERT, bucket.gen_index_str() << " - Generate BTG File");
-                    WriteBtgFile();
+                // STEP 18)
+                // Generate the btg file
+                SG_LOG(SG_GENERAL, SG_ALERT, bucket.gen_index_str() << " - Generate BTG File");
+                WriteBtgFile();
 
-                    // STEP 19)
-                    // Write Custom objects to .stg file
-                    SG_LOG(SG_GENERAL, SG_ALERT, bucket.gen_index_str() << " - Generate Custome Objects");
-                    AddCustomObjects();
-                }
-                break;
-        }
-
-        if ( ( stage < 3 ) && ( !IsOceanTile() ) ) {
-            // Save data for next stage
-            if ( stage == 2 ) {
-                nodes.init_spacial_query(); // for stage 2 only...
+                // STEP 19)
+                // Write Custom objects to .stg file
+                SG_LOG(SG_GENERAL, SG_ALERT, bucket.gen_index_str() << " - Generate Custome Objects");
+                AddCustomObjects();
             }
-            SaveSharedEdgeData( stage );
-            SaveToIntermediateFiles( stage );
-        }
+            break;
+    }
 
-        // Clean up for next work queue item
-        array.unload();
-        polys_in.clear();
-        polys_clipped.clear();
-        nodes.clear();
-        neighbor_faces.clear();
-        debug_shapes.clear();
-        debug_areas.clear();
+    if ( ( stage < 3 ) && ( !IsOceanTile() ) ) {
+        // Save data for next stage
+        if ( stage == 2 ) {
+            nodes.init_spacial_query(); // for stage 2 only...
+        }
+        SaveSharedEdgeData( stage );
+        SaveToIntermediateFiles( stage );
     }
 }
\ No newline at end of file
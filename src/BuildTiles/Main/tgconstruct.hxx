@@ -35,6 +35,7 @@
 
 #include <Array/array.hxx>
 #include <terragear//tg_nodes.hxx>
+#include <terragear/tg_normals.hxx>
 #include <landcover/landcover.hxx>
 
 #include "tglandclass.hxx"
@@ -69,22 +70,22 @@ public:
     void SaveToIntermediateFiles( int stage );
     void LoadFromIntermediateFiles( int stage );
 
-#if 0
-    int      load_landcover ();
-    double   measure_roughness( tgContour &contour );
-    AreaType get_landcover_type (const LandCover &cover, double xpos, double ypos, double dx, double dy);
-    void make_area( const LandCover &cover, tgpolygon_list& polys,
-                    double x1, double y1, double x2, double y2,
-                    double half_dx, double half_dy );
-
-    // land cover file
-    inline std::string get_cover () const { return cover; }
-    inline void set_cover (const std::string &s) { cover = s; }
-#endif
+    // land cover raster (shared by all construct threads)
+    inline void set_cover( const LandCover* c ) { cover = c; }
 
     // paths
     void set_paths( const std::string work, const std::string share, const std::string output, const std::vector<std::string> load_dirs );
     void set_options( bool ignore_lm, double n );
+    void set_output_options( bool strips, bool reorder, unsigned int cache );
+    void set_tile_threads( unsigned int n ) { tile_normals.SetThreads( n ); }
+
+    // keep the elevation array of the last bucket loaded - for callers that
+    // run all stages of one bucket back to back
+    void set_keep_array( bool keep ) { keep_array = keep; }
+
+    // run one stage on one bucket in the calling thread, without the work
+    // queue
+    void ConstructBucket( const SGBucket& b, unsigned int s );
 
     // TODO : REMOVE
     inline TGNodes* get_nodes() { return &nodes; }
@@ -97,16 +98,24 @@ public:
 
     // Debug
     void set_debug( std::string path, std::vector<std::string> area_defs, std::vector<std::string> shape_defs );
+    void set_debug_filter( unsigned int sample, std::vector<std::string> layers );
 
 private:
     virtual void run();
 
+    // run the current stage on the current bucket
+    void ConstructBucket( void );
+    void RunStage( void );
+    void Reset( void );
+
     // Ocean tile or not
     bool IsOceanTile()  { return isOcean; }
 
     // Load Data
     void LoadElevationArray( bool add_nodes );
     int  LoadLandclassPolys( void );
+    int  LoadLandcoverRaster( void );
+    void AddLandclassPoly( unsigned int area, tgPolygon& poly );
 
     // Clip Data
     bool ClipLandclassPolys( void );
@@ -149,9 +158,6 @@ private:
     void WriteBtgFile( void );
     void AddCustomObjects( void );
 
-    // Misc
-    void calc_normals( std::vector<SGGeod>& geod_nodes, std::vector<SGVec3d>& wgs84_nodes, tgPolygon& sp );
-
     // debug
     void get_debug( void );
     bool IsDebugShape( unsigned int id );
@@ -165,8 +171,8 @@ private:
     unsigned int total_tiles;
     unsigned int stage;
 
-    // path to land-cover file (if any)
-    std::string cover;
+    // land-cover raster (if any)
+    const LandCover* cover;
 
     // paths
     std::string work_base;
@@ -183,6 +189,12 @@ private:
     // I think we should remove this
     double nudge;
 
+    // btg output : triangle strips, node / triangle reordering, and the
+    // vertex cache size they are built for
+    bool use_strips;
+    bool reorder_nodes;
+    unsigned int vcache_size;
+
     // path to the debug shapes
     std::string debug_path;
 
@@ -192,6 +204,10 @@ private:
     std::vector<std::string> debug_area_defs;
     std::vector<std::string> debug_shape_defs;
 
+    // debug shapefile sampling, and layer name prefixes to write
+    unsigned int debug_sample;
+    std::vector<std::string> debug_layers;
+
     // list of shapes to dump during debug (for a single tile)
     std::vector<unsigned int> debug_areas;
     std::vector<unsigned int> debug_shapes;
@@ -206,8 +222,11 @@ private:
     // this bucket
     SGBucket bucket;
 
-    // Elevation data
+    // Elevation data, and the bucket it was loaded for
     TGArray array;
+    SGBucket array_bucket;
+    bool array_loaded;
+    bool keep_array;
 
     // land class polygons
     TGLandclass polys_in;
@@ -216,6 +235,9 @@ private:
     // All Nodes
     TGNodes nodes;
 
+    // Face and point normals of the whole tile
+    tgNormals tile_normals;
+
     // ocean tile?
     bool isOcean;
 
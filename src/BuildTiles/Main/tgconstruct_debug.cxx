@@ -40,6 +40,12 @@ void TGConstruct::set_debug( std::string path, std::vector<string> a_defs, std::
     debug_shape_defs = s_defs;
 }
 
+void TGConstruct::set_debug_filter( unsigned int sample, std::vector<string> layers )
+{
+    debug_sample = sample;
+    debug_layers = layers;
+}
+
 void TGConstruct::get_debug( void )
 {
     // clear out any previous entries
@@ -31,23 +31,32 @@
 using std::string;
 
 // Load elevation data from an Array file (a regular grid of elevation data)
-// and return list of fitted nodes.
+// and return list of fitted nodes.  With keep_array set, the array of the
+// last bucket stays loaded, so the next stage of the same bucket reuses it.
 void TGConstruct::LoadElevationArray( bool add_nodes ) {
-    string base = bucket.gen_base_path();
-    int i;
+    if ( !array_loaded || !(array_bucket == bucket) ) {
+        string base = bucket.gen_base_path();
+        int i;
 
-    for ( i = 0; i < (int)load_dirs.size(); ++i ) {
-        string array_path = work_base + "/" + load_dirs[i] + "/" + base + "/" + bucket.gen_index_str();
+        array.unload();
 
-        if ( array.open(array_path) ) {
-            break;
-        } else {
-            SG_LOG(SG_GENERAL, SG_DEBUG, "Failed to open Array file " << array_path);
+        for ( i = 0; i < (int)load_dirs.size(); ++i ) {
+            string array_path = work_base + "/" + load_dirs[i] + "/" + base + "/" + bucket.gen_index_str();
+
+            if ( array.open(array_path) ) {
+                break;
+            } else {
+                SG_LOG(SG_GENERAL, SG_DEBUG, "Failed to open Array file " << array_path);
+            }
         }
+
+        array.parse( bucket );
+        array.remove_voids( );
+
+        array_bucket = bucket;
+        array_loaded = true;
     }
 
-    array.parse( bucket );
-    array.remove_voids( );
     if ( add_nodes ) {
         std::vector<SGGeod> const& corner_list = array.get_corner_list();
         for (unsigned int i=0; i<corner_list.size(); i++) {
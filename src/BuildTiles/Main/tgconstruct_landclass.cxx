@@ -21,8 +21,6 @@
 //
 // $Id: construct.cxx,v 1.4 2004-11-19 22:25:49 curt Exp $
 
-#if 0
-
 #ifdef HAVE_CONFIG_H
 #  include <config.h>
 #endif
@@ -33,8 +31,6 @@
 #include "tgconstruct.hxx"
 #include "usgs.hxx"
 
-using std::string;
-
 // If we don't offset land use squares by some amount, then we can get
 // land use square boundaries coinciding with tile boundaries.
 //
@@ -47,239 +43,170 @@ static const double cover_size          = 1.0 / 120.0;
 static const double half_cover_size     = cover_size * 0.5;
 static const double quarter_cover_size  = cover_size * 0.25;
 
-// make the area specified area, look up the land cover type, and add
-// it to polys
-void TGConstruct::make_area( const LandCover &cover, tgpolygon_list& polys,
-                             double x1, double y1, double x2, double y2,
-                             double half_dx, double half_dy )
+// A horizontal run of cells with the same area, merged with the
+// identical runs of the rows below it
+struct CoverRun {
+    int start;
+    int end;
+    int area;
+    int first_row;
+};
+typedef std::vector<CoverRun> cover_run_list;
+
+// Generate polygons from land-cover raster.  The cells under the tile
+// are read in one block, and runs of cells with the same area type are
+// merged into rectangles, so each area needs a single union.
+int TGConstruct::LoadLandcoverRaster( void )
 {
     const double fudge = 0.0001;  // (0.0001 degrees =~ 10 meters)
+    int count = 0;
 
-    AreaType area = get_landcover_type( cover,
-                                        x1 + half_dx, y1 + half_dy,
-                                        x2 - x1, y2 - y1 );
+    // Get the lower left (SW) corner of the tile
+    double base_lon = bucket.get_center_lon() - 0.5 * bucket.get_width()  - quarter_cover_size;
+    double base_lat = bucket.get_center_lat() - 0.5 * bucket.get_height() - quarter_cover_size;
+    double max_lon  = bucket.get_center_lon() + 0.5 * bucket.get_width();
+    double max_lat  = bucket.get_center_lat() + 0.5 * bucket.get_height();
 
-    if ( area != get_default_area_type() ) {
-        // Create a square polygon and merge it into the list.
-        tgContour contour;
+    int nx = (int)ceil( (max_lon - base_lon) / cover_size );
+    int ny = (int)ceil( (max_lat - base_lat) / cover_size );
 
-        contour.Erase();
-        contour.AddNode( SGGeod::fromDeg(x1 - fudge, y1 - fudge) );
-        contour.AddNode( SGGeod::fromDeg(x1 - fudge, y2 + fudge) );
-        contour.AddNode( SGGeod::fromDeg(x2 + fudge, y2 + fudge) );
-        contour.AddNode( SGGeod::fromDeg(x2 + fudge, y1 - fudge) );
-        contour.SetHole( false );
+    SG_LOG(SG_GENERAL, SG_ALERT, "raster land cover: tile at " << base_lon << ',' << base_lat << " " << nx << " x " << ny << " cells" );
 
-        if ( measure_roughness( contour ) < 1.0 ) {
-            // Add this contour to the area accumulator
-            if ( polys[area].Contours() > 0 ) {
-                polys[area] = tgContour::Union( contour, polys[area] );
-            } else {
-                tgPolygon poly;
-                poly.AddContour( contour );
-                polys[area] = poly;
-            }
-        }
+    // image coordinates of every cell center, with one cell of margin
+    // for borrowing from neighbours
+    std::vector<long> xs( nx + 2 ), ys( ny + 2 );
+    for ( int i = -1; i <= nx; i++ ) {
+        xs[i+1] = cover->getX( base_lon + (i * cover_size) + half_cover_size );
+    }
+    for ( int j = -1; j <= ny; j++ ) {
+        ys[j+1] = cover->getY( base_lat + (j * cover_size) + half_cover_size );
     }
-}
 
-// Come up with a "rough" metric for the roughness of the terrain
-// coverted by a polygon
-double TGConstruct::measure_roughness( tgContour &contour ) {
-    // find the elevation range
-    double max_z = -9999.0;
-    double min_z =  9999.0;
+    long x0 = std::min( xs.front(), xs.back() ), x1 = std::max( xs.front(), xs.back() );
+    long y0 = std::min( ys.front(), ys.back() ), y1 = std::max( ys.front(), ys.back() );
+    long w  = x1 - x0 + 1;
+    long h  = y1 - y0 + 1;
 
-    for ( unsigned int i = 0; i < contour.GetSize(); i++ ) {
-        double z;
-        z = array.altitude_from_grid( contour[i].getLongitudeDeg() * 3600.0,
-                                      contour[i].getLatitudeDeg()  * 3600.0 );
-        if ( z < -9000 ) {
-            z = array.closest_nonvoid_elev( contour[i].getLongitudeDeg() * 3600.0,
-                                            contour[i].getLatitudeDeg()  * 3600.0 );
-        }
+    std::vector<unsigned char> block( w * h );
+    cover->getBlock( x0, y0, w, h, &block[0] );
 
-        if ( z < min_z ) {
-            min_z = z;
-        }
-        if ( z > max_z ) {
-            max_z = z;
+    // translate to area types
+    std::vector<int> raw( (nx + 2) * (ny + 2) );
+    for ( int j = 0; j < ny + 2; j++ ) {
+        for ( int i = 0; i < nx + 2; i++ ) {
+            raw[j * (nx + 2) + i] = translateUSGSCover( block[(ys[j] - y0) * w + (xs[i] - x0)] );
         }
     }
 
-    double diff = max_z - min_z;
-
-    // 50m difference in polygon elevation range yields a roughness
-    // metric of 1.0.  Less than 1.0 is relatively flat.  More than
-    // 1.0 is relatively rough.
-
-    SG_LOG(SG_GENERAL, SG_ALERT, "roughness = " << diff / 50.0 );
-
-    return diff / 50.0;
-}
-
-AreaType TGConstruct::get_landcover_type (const LandCover &cover, double xpos, double ypos, double dx, double dy)
-{
-    // Look up the land cover for the square
-    int cover_value = cover.getValue(xpos, ypos);
-    AreaType area = translateUSGSCover(cover_value);
-
-    if ( area != get_default_area_type() ) {
-        // Non-default area is fine.
-        return area;
-    } else {
-        // If we're stuck with the default area, try to borrow from a
-        // neighbour.
-        for (double x = xpos - dx; x <= xpos + dx; x += dx) {
-            for (double y = ypos - dy; y < ypos + dx; y += dy) {
-                if (x != xpos || y != ypos) {
-                    cover_value = cover.getValue(x, y);
-                    area = translateUSGSCover(cover_value);
-                    if (area != get_default_area_type() ) {
-                        return area;
-                    }
-                }
+    // elevation at each cell corner, for the roughness check
+    std::vector<double> corner_z( (nx + 1) * (ny + 1) );
+    for ( int j = 0; j <= ny; j++ ) {
+        for ( int i = 0; i <= nx; i++ ) {
+            double lon = ( base_lon + i * cover_size ) * 3600.0;
+            double lat = ( base_lat + j * cover_size ) * 3600.0;
+            double z   = array.altitude_from_grid( lon, lat );
+            if ( z < -9000 ) {
+                z = array.closest_nonvoid_elev( lon, lat );
             }
+            corner_z[j * (nx + 1) + i] = z;
         }
     }
 
-    // OK, give up and return default
-    return get_default_area_type();
-}
-
-#if 0
-// For each triangle assigned to the "default" area type, see if we
-// can lookup a better land cover type from the 1km data structure.
-static void fix_land_cover_assignments( TGConstruct& c ) {
-    SG_LOG(SG_GENERAL, SG_ALERT, "Fixing up default land cover types");
-    // the list of node locations
-    TGTriNodes trinodes = c.get_tri_nodes();
-    point_list geod_nodes = trinodes.get_node_list();
+    std::vector<int> cells( nx * ny );
+    for ( int j = 0; j < ny; j++ ) {
+        for ( int i = 0; i < nx; i++ ) {
+            int area = raw[(j + 1) * (nx + 2) + (i + 1)];
 
-    // the list of triangles (with area type attribute)
-    triele_list tri_elements = c.get_tri_elements();
-
-    // traverse the triangle element groups
-    SG_LOG(SG_GENERAL, SG_ALERT, "  Total Nodes = " << geod_nodes.size());
-    SG_LOG(SG_GENERAL, SG_ALERT, "  Total triangles = " << tri_elements.size());
-    for ( unsigned int i = 0; i < tri_elements.size(); ++i ) {
-        TGTriEle t = tri_elements[i];
-        if ( t.get_attribute() == get_default_area_type() ) {
-            Point3D p1 = geod_nodes[t.get_n1()];
-            Point3D p2 = geod_nodes[t.get_n2()];
-            Point3D p3 = geod_nodes[t.get_n3()];
-
-            // offset by -quarter_cover_size because that is what we
-            // do for the coverage squares
-            AreaType a1 = get_area_type( c.get_cover(),
-                                         p1.x() - quarter_cover_size,
-                                         p1.y() - quarter_cover_size,
-                                         cover_size, cover_size );
-            AreaType a2 = get_area_type( c.get_cover(),
-                                         p2.x() - quarter_cover_size,
-                                         p2.y() - quarter_cover_size,
-                                         cover_size, cover_size );
-            AreaType a3 = get_area_type( c.get_cover(),
-                                         p3.x() - quarter_cover_size,
-                                         p3.y() - quarter_cover_size,
-                                         cover_size, cover_size );
-
-            // update the original triangle element attribute
-            AreaType new_area;
+            // If we're stuck with the default area, try to borrow from a
+            // neighbour.
+            for ( int dx = -1; dx <= 1 && area < 0; dx++ ) {
+                for ( int dy = -1; dy <= 1 && area < 0; dy++ ) {
+                    area = raw[(j + 1 + dy) * (nx + 2) + (i + 1 + dx)];
+                }
+            }
 
-            // majority rules
-            if ( a1 == a2 ) {
-                new_area = a1;
-            } else if ( a1 == a3 ) {
-                new_area = a1;
-            } else if ( a2 == a3 ) {
-                new_area = a2;
-            } else {
-                // a different coverage for each vertex, just pick
-                // from the middle/average
-                Point3D average = ( p1 + p2 + p3 ) / 3.0;
-                //cout << "    average triangle center = " << average;
-                new_area = get_area_type( c.get_cover(),
-                                          average.x() - quarter_cover_size,
-                                          average.y() - quarter_cover_size,
-                                          cover_size, cover_size );
+            if ( area >= 0 ) {
+                // 50m difference in cell elevation range yields a roughness
+                // metric of 1.0.  Leave rough cells to the default area
+                double min_z = corner_z[j * (nx + 1) + i], max_z = min_z;
+                for ( int k = 1; k < 4; k++ ) {
+                    double z = corner_z[(j + k / 2) * (nx + 1) + (i + k % 2)];
+                    min_z = std::min( min_z, z );
+                    max_z = std::max( max_z, z );
+                }
+                if ( (max_z - min_z) / 50.0 >= 1.0 ) {
+                    area = -1;
+                }
             }
 
-            //cout << "  new attrib = " << get_area_name( new_area ) << endl;
-            c.set_tri_attribute( i, new_area );
+            cells[j * nx + i] = area;
         }
     }
-}
-#endif
-
-
-// Generate polygons from land-cover raster.  Horizontally- or
-// vertically-adjacent polygons will be merged automatically.
-int TGConstruct::load_landcover()
-{
-    int count = 0;
-#if 0
-
-    try {
-
-        LandCover cover(get_cover());
-        tgPolygon polys[TG_MAX_AREA_TYPES];
-        tgPolygon poly;     // working polygon
-
-        // Get the lower left (SW) corner of the tile
-        double base_lon = bucket.get_center_lon()
-            - 0.5 * bucket.get_width()
-            - quarter_cover_size;
-        double base_lat = bucket.get_center_lat()
-            - 0.5 * bucket.get_height()
-            - quarter_cover_size;
-
-        SG_LOG(SG_GENERAL, SG_ALERT, "raster land cover: tile at " << base_lon << ',' << base_lat);
-
-        double max_lon = bucket.get_center_lon()
-            + 0.5 * bucket.get_width();
-        double max_lat = bucket.get_center_lat()
-            + 0.5 * bucket.get_height();
 
-        SG_LOG(SG_GENERAL, SG_ALERT, "raster land cover: extends to " << max_lon << ',' << max_lat);
-
-        double x1 = base_lon;
-        double y1 = base_lat;
-        double x2 = x1 + cover_size;
-        double y2 = y1 + cover_size;
-
-        while ( x1 < max_lon ) {
-            while ( y1 < max_lat ) {
-                make_area( cover, polys, x1, y1, x2, y2, half_cover_size, half_cover_size );
-
-                y1 = y2;
-                y2 += cover_size;
+    // merge runs row by row - a run identical to one on the row below
+    // extends that rectangle, anything else closes it
+    std::vector<tgpolygon_list> rects( area_defs.size() );
+    cover_run_list open_runs, row_runs;
+
+    for ( int j = 0; j <= ny; j++ ) {
+        row_runs.clear();
+        for ( int i = 0; j < ny && i < nx; ) {
+            int area  = cells[j * nx + i];
+            int start = i;
+            while ( i < nx && cells[j * nx + i] == area ) {
+                i++;
             }
+            if ( area >= 0 ) {
+                CoverRun run = { start, i, area, j };
+                row_runs.push_back( run );
+            }
+        }
 
-            x1 = x2;
-            x2 += cover_size;
-            y1 = base_lat;
-            y2 = y1 + cover_size;
+        unsigned int k = 0;
+        for ( unsigned int r = 0; r < open_runs.size(); r++ ) {
+            CoverRun const& run = open_runs[r];
+            while ( k < row_runs.size() && row_runs[k].start < run.start ) {
+                k++;
+            }
+            if ( k < row_runs.size() && row_runs[k].start == run.start &&
+                 row_runs[k].end == run.end && row_runs[k].area == run.area ) {
+                row_runs[k].first_row = run.first_row;
+            } else {
+                double x1 = base_lon + run.start * cover_size;
+                double x2 = base_lon + run.end * cover_size;
+                double y1 = base_lat + run.first_row * cover_size;
+                double y2 = base_lat + j * cover_size;
+
+                tgContour contour;
+                contour.AddNode( SGGeod::fromDeg(x1 - fudge, y1 - fudge) );
+                contour.AddNode( SGGeod::fromDeg(x1 - fudge, y2 + fudge) );
+                contour.AddNode( SGGeod::fromDeg(x2 + fudge, y2 + fudge) );
+                contour.AddNode( SGGeod::fromDeg(x2 + fudge, y1 - fudge) );
+                contour.SetHole( false );
+
+                tgPolygon rect;
+                rect.AddContour( contour );
+                rects[run.area].push_back( rect );
+            }
         }
+        open_runs.swap( row_runs );
+    }
 
-        // Now that we're finished looking up land cover, we have a list
-        // of lists of polygons, one (possibly-empty) list for each area
-        // type.  Add the remaining polygons to the clipper.
-        for ( int i = 0; i < TG_MAX_AREA_TYPES; i++ ) {
-            if ( polys[i].contours() ) {
-                // TODO : REMOVE add_poly
-                add_poly( i, polys[i], get_area_name((AreaType)i ));
+    // Now that we're finished looking up land cover, we have a list of
+    // rectangles for each area type.  Merge them, and add the result
+    // to the landclass polys
+    for ( unsigned int area = 0; area < rects.size(); area++ ) {
+        if ( rects[area].size() ) {
+            tgPolygon poly = tgPolygon::Union( rects[area] );
+
+            if ( poly.Contours() ) {
+                poly.SetTexMethod( TG_TEX_BY_GEODE, bucket.get_center_lat() );
+                AddLandclassPoly( area, poly );
                 count++;
             }
         }
-    } catch ( string e ) {
-        SG_LOG(SG_GENERAL, SG_ALERT, "Died with exception: " << e);
-        exit(-1);
     }
 
-#endif
-    // Return the number of polygons actually read.
+    // Return the number of polygons actually generated.
     return count;
 }
-
-#endif
\ No newline at end of file
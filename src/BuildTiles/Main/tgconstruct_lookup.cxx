@@ -26,6 +26,7 @@
 #endif
 
 #include <simgear/debug/logstream.hxx>
+#include <simgear/structure/exception.hxx>
 
 #include "tgconstruct.hxx"
 
@@ -46,7 +47,7 @@ void TGConstruct::LookupNodesPerVertex( void )
                         poly.SetTriIdx( tri, vertex, idx );
                     } else {
                         SG_LOG(SG_GENERAL, SG_ALERT, "didn't find vertex! " << poly.GetTriNode( tri, vertex ) );
-                        exit(0);
+                        throw sg_exception( "didn't find vertex" );
                     }
                 }
             }
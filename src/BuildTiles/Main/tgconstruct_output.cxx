@@ -24,6 +24,11 @@
 #  include <config.h>
 #endif
 
+#include <sys/stat.h>
+#include <algorithm>
+
+#include <boost/unordered_map.hpp>
+
 #include <simgear/math/SGGeometry.hxx>
 #include <simgear/misc/sg_dir.hxx>
 #include <simgear/io/sg_binobj.hxx>
@@ -32,6 +37,7 @@
 
 #include <terragear/tg_unique_vec3f.hxx>
 #include <terragear/tg_unique_vec2f.hxx>
+#include <terragear/tg_tristrip.hxx>
 
 #include "tgconstruct.hxx"
 
@@ -51,7 +57,7 @@ void TGConstruct::AddCustomObjects( void ) {
     FILE *fp;
     if ( (fp = fopen( dest_ind.c_str(), "w" )) == NULL ) {
         SG_LOG( SG_GENERAL, SG_ALERT, "ERROR: opening " << dest_ind << " for writing!" );
-        exit(-1);
+        throw sg_exception( "error opening " + dest_ind + " for writing" );
     }
 
     // Start with the default custom object which is the base terrain
@@ -135,7 +141,103 @@ void TGConstruct::WriteBtgFile( void )
     int_list pt_n, tri_n, strip_n;
     int_list tri_tc, strip_tc;
 
-    for (unsigned int area = 0; area < area_defs.size(); area++) {
+    // strip or reordered output : gather per material triangle lists of output vertices
+    bool                        optimize = use_strips || reorder_nodes;
+    string_list                 vtx_materials;
+    tgIndexGroupList            vtx_tris;
+    int_list                    out_v, out_n, out_tc;
+    boost::unordered_map<unsigned long long, int> out_lookup;
+
+    for (unsigned int area = 0; optimize && area < area_defs.size(); area++) {
+        if ( !area_defs.is_hole_area(area) ) {
+            for (unsigned int p = 0; p < polys_clipped.area_size(area); p++ ) {
+                tgPolygon   poly      = polys_clipped.get_poly(area, p);
+                string      material  = poly.GetMaterial();
+
+                unsigned int m = std::find( vtx_materials.begin(), vtx_materials.end(), material ) - vtx_materials.begin();
+                if ( m == vtx_materials.size() ) {
+                    vtx_materials.push_back( material );
+                    vtx_tris.push_back( tgIndexList() );
+                }
+
+                for (unsigned int k = 0; k < poly.Triangles(); ++k) {
+                    for (int l = 0; l < 3; ++l) {
+                        // an output vertex is a unique node / texcoord pair - the normal comes with the node
+                        int v  = poly.GetTriIdx( k, l );
+                        int tc = texcoords.add( poly.GetTriTexCoord( k, l ) );
+                        unsigned long long key = ((unsigned long long)v << 32) | (unsigned int)tc;
+
+                        boost::unordered_map<unsigned long long, int>::iterator it = out_lookup.find( key );
+                        if ( it == out_lookup.end() ) {
+                            it = out_lookup.insert( std::make_pair( key, (int)out_v.size() ) ).first;
+                            out_v.push_back( v );
+                            out_n.push_back( normals.add( nodes.GetNormal( v ) ) );
+                            out_tc.push_back( tc );
+                        }
+                        vtx_tris[m].push_back( it->second );
+                    }
+                }
+            }
+        }
+    }
+
+    unsigned int num_tris = 0, num_strip_tris = 0;
+    unsigned int indices_before = 0, indices_after = 0;
+    unsigned int misses_before = 0, misses_after = 0;
+    tgTriStripper stripper( vcache_size );
+
+    for (unsigned int m = 0; m < vtx_materials.size(); m++) {
+        tgIndexGroupList strips;
+        tgIndexList      leftover;
+
+        if ( use_strips ) {
+            stripper.Stripify( vtx_tris[m], strips, leftover );
+        } else {
+            leftover = vtx_tris[m];
+            tgTriStripper::OptimizeVertexCache( leftover, vcache_size );
+        }
+
+        num_tris       += vtx_tris[m].size() / 3;
+        indices_before += vtx_tris[m].size();
+        misses_before  += tgTriStripper::CountCacheMisses( tgIndexGroupList(), vtx_tris[m], vcache_size );
+        misses_after   += tgTriStripper::CountCacheMisses( strips, leftover, vcache_size );
+        indices_after  += leftover.size();
+
+        for (unsigned int s = 0; s < strips.size(); s++) {
+            strip_v.clear();
+            strip_n.clear();
+            strip_tc.clear();
+            for (unsigned int i = 0; i < strips[s].size(); i++) {
+                strip_v.push_back( out_v[strips[s][i]] );
+                strip_n.push_back( out_n[strips[s][i]] );
+                strip_tc.push_back( out_tc[strips[s][i]] );
+            }
+            strips_v.push_back( strip_v );
+            strips_n.push_back( strip_n );
+            strips_tc.push_back( strip_tc );
+            strip_materials.push_back( vtx_materials[m] );
+
+            num_strip_tris += strips[s].size() - 2;
+            indices_after  += strips[s].size();
+        }
+
+        for (unsigned int i = 0; i < leftover.size(); i += 3) {
+            tri_v.clear();
+            tri_n.clear();
+            tri_tc.clear();
+            for (int l = 0; l < 3; ++l) {
+                tri_v.push_back( out_v[leftover[i+l]] );
+                tri_n.push_back( out_n[leftover[i+l]] );
+                tri_tc.push_back( out_tc[leftover[i+l]] );
+            }
+            tris_v.push_back( tri_v );
+            tris_n.push_back( tri_n );
+            tris_tc.push_back( tri_tc );
+            tri_materials.push_back( vtx_materials[m] );
+        }
+    }
+
+    for (unsigned int area = 0; !optimize && area < area_defs.size(); area++) {
         // only tesselate non holes
         if ( !area_defs.is_hole_area(area) ) {
             for (unsigned int p = 0; p < polys_clipped.area_size(area); p++ ) {
@@ -182,6 +284,30 @@ void TGConstruct::WriteBtgFile( void )
     }
     double gbs_radius = sqrt(radius_squared);
 
+    std::vector< SGVec3f > normal_list   = normals.get_list();
+    std::vector< SGVec2f > texcoord_list = texcoords.get_list();
+
+    if ( reorder_nodes ) {
+        // renumber nodes, normals and texcoords in the order the (cache
+        // optimized) triangles use them, so indices grow along the draw order
+        tgIndexList remap;
+
+        tgTriStripper::FirstUseOrder( strips_v, tris_v, wgs84_nodes.size(), remap );
+        tgTriStripper::Remap( strips_v, remap );
+        tgTriStripper::Remap( tris_v, remap );
+        tgTriStripper::Permute( wgs84_nodes, remap );
+
+        tgTriStripper::FirstUseOrder( strips_n, tris_n, normal_list.size(), remap );
+        tgTriStripper::Remap( strips_n, remap );
+        tgTriStripper::Remap( tris_n, remap );
+        tgTriStripper::Permute( normal_list, remap );
+
+        tgTriStripper::FirstUseOrder( strips_tc, tris_tc, texcoord_list.size(), remap );
+        tgTriStripper::Remap( strips_tc, remap );
+        tgTriStripper::Remap( tris_tc, remap );
+        tgTriStripper::Permute( texcoord_list, remap );
+    }
+
     SG_LOG(SG_GENERAL, SG_DEBUG, "gbs center = " << gbs_center);
     SG_LOG(SG_GENERAL, SG_DEBUG, "Done with wgs84 node mapping");
     SG_LOG(SG_GENERAL, SG_DEBUG, "  center = " << gbs_center << " radius = " << gbs_radius );
@@ -203,8 +329,8 @@ void TGConstruct::WriteBtgFile( void )
     obj.set_gbs_center( gbs_center );
     obj.set_gbs_radius( gbs_radius );
     obj.set_wgs84_nodes( wgs84_nodes );
-    obj.set_normals( normals.get_list() );
-    obj.set_texcoords( texcoords.get_list() );
+    obj.set_normals( normal_list );
+    obj.set_texcoords( texcoord_list );
     obj.set_pts_v( pts_v );
     obj.set_pts_n( pts_n );
     obj.set_pt_materials( pt_materials );
@@ -235,4 +361,22 @@ void TGConstruct::WriteBtgFile( void )
             throw sg_exception("error writing file. :-(");
         }
     }
+
+    if ( optimize && num_tris ) {
+        SGPath btg_path( base );
+        btg_path.append( bucket.gen_base_path() );
+        btg_path.append( binname );
+        btg_path.concat( ".gz" );
+
+        struct stat buf;
+        long btg_size = 0;
+        if ( stat( btg_path.c_str(), &buf ) == 0 ) {
+            btg_size = buf.st_size;
+        }
+
+        SG_LOG(SG_GENERAL, SG_ALERT, bucket.gen_index_str() << " - " << num_tris << " triangles : " << strips_v.size() << " strips holding " << num_strip_tris <<
+                                     ", " << tris_v.size() << " left over. indices " << indices_before << " -> " << indices_after <<
+                                     ", ACMR " << (double)misses_before / num_tris << " -> " << (double)misses_after / num_tris <<
+                                     ", btg size " << btg_size );
+    }
 }
@@ -37,6 +37,37 @@ using std::string;
 
 static unsigned int cur_poly_id = 0;
 
+// add a landclass polygon and its nodes to the tile
+void TGConstruct::AddLandclassPoly( unsigned int area, tgPolygon& poly )
+{
+    std::string material = area_defs.get_area_name( area );
+
+    poly.SetMaterial( material );
+    poly.SetId( cur_poly_id++ );
+
+    polys_in.add_poly( area, poly );
+
+    // add the nodes
+    for (unsigned int j=0; j<poly.Contours(); j++) {
+        for (unsigned int k=0; k<poly.ContourSize(j); k++) {
+            SGGeod const& node  = poly.GetNode( j, k );
+
+            if ( poly.GetPreserve3D() ) {
+                nodes.unique_add_fixed_elevation( node );
+            } else {
+                nodes.unique_add( node );
+            }
+        }
+    }
+
+    if (IsDebugShape( poly.GetId() )) {
+        char layer[32];
+        sprintf(layer, "loaded_%d", poly.GetId() );
+
+        tgShapefile::FromPolygon( poly, ds_name, layer, material.c_str() );
+    }
+}
+
 // load all 2d polygons from the specified load disk directories and
 // clip against each other to resolve any overlaps
 int TGConstruct::LoadLandclassPolys( void ) {
@@ -74,7 +105,6 @@ int TGConstruct::LoadLandclassPolys( void ) {
                 // skipped!
             } else {
                 int area;
-                std::string material;
                 gzFile fp = gzopen( p.c_str(), "rb" );
                 unsigned int count;
 
@@ -84,35 +114,13 @@ int TGConstruct::LoadLandclassPolys( void ) {
                 for ( unsigned int i=0; i<count; i++ ) {
                     tgPolygon poly;
                     poly.LoadFromGzFile( fp );
-                    area     = area_defs.get_area_priority( poly.GetFlag() );
-                    material = area_defs.get_area_name( area );
-
-                    poly.SetMaterial( material );
-                    poly.SetId( cur_poly_id++ );
+                    area = area_defs.get_area_priority( poly.GetFlag() );
 
                     if ( poly.Contours() ) {
-                        polys_in.add_poly( area, poly );
+                        AddLandclassPoly( area, poly );
                         total_polys_read++;
-
-                        // add the nodes
-                        for (unsigned int j=0; j<poly.Contours(); j++) {
-                            for (unsigned int k=0; k<poly.ContourSize(j); k++) {
-                                SGGeod const& node  = poly.GetNode( j, k );
-
-                                if ( poly.GetPreserve3D() ) {
-                                    nodes.unique_add_fixed_elevation( node );
-                                } else {
-                                    nodes.unique_add( node );
-                                }
-                            }
-                        }
-
-                        if (IsDebugShape( poly.GetId() )) {
-                            char layer[32];
-                            sprintf(layer, "loaded_%d", poly.GetId() );
-
-                            tgShapefile::FromPolygon( poly, ds_name, layer, material.c_str() );
-                        }
+                    } else {
+                        cur_poly_id++;
                     }
                 }
 
@@ -32,10 +32,10 @@ using std::ifstream;
 using std::string;
 using std::vector;
 
-static vector<unsigned int> usgs_map;
+// USGS value - 1 -> area priority, or -1 for the default area
+static vector<int> usgs_map;
 
-#if 0 // need area_defs
-int load_usgs_map( const std::string& filename ) {
+int load_usgs_map( const std::string& filename, const TGAreaDefinitions& areas ) {
     ifstream in ( filename.c_str() );
 
     if ( ! in ) {
@@ -44,11 +44,13 @@ int load_usgs_map( const std::string& filename ) {
     }
     SG_LOG(SG_GENERAL, SG_ALERT, "USGS Map file is " << filename);
 
+    usgs_map.clear();
+
     in >> skipcomment;
     while ( !in.eof() ) {
     	string name;
     	in >> name;
-    	usgs_map.push_back( get_area_type( name ) );
+    	usgs_map.push_back( areas.find_area_priority( name ) );
         in >> skipcomment;
     }
 
@@ -58,12 +60,11 @@ int load_usgs_map( const std::string& filename ) {
 }
 
 // Translate USGS land cover values into TerraGear area types.
-unsigned int translateUSGSCover (unsigned int usgs_value)
+int translateUSGSCover( int usgs_value )
 {
-    if ( 0<usgs_value && usgs_value<usgs_map.size() ) {
+    if ( 0<usgs_value && usgs_value<=(int)usgs_map.size() ) {
         return usgs_map[usgs_value-1];
     } else {
-        return get_default_area_type();
+        return -1;
     }
 }
-#endif
\ No newline at end of file
@@ -28,7 +28,12 @@
 
 #include "priorities.hxx"
 
-int load_usgs_map( const std::string& filename );
-unsigned int translateUSGSCover( unsigned int usgs_value );
+// load the USGS value -> area name mapping.  Must be done before any
+// construct threads start translating
+int load_usgs_map( const std::string& filename, const TGAreaDefinitions& areas );
+
+// returns the area priority for a USGS land cover value, or -1 if the
+// value maps to the default area (no landclass polygon)
+int translateUSGSCover( int usgs_value );
 
 #endif // _USGS_HXX
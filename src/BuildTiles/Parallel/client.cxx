@@ -37,16 +37,29 @@
 
 #include <simgear/compiler.h>
 
+#include <algorithm>
+#include <deque>
 #include <iostream>
+#include <sstream>
 #include <string>
 #include <vector>
 
 #include <boost/foreach.hpp>
+#include <boost/thread.hpp>
 
 #include <simgear/bucket/newbucket.hxx>
+#include <simgear/debug/logstream.hxx>
+#include <simgear/structure/exception.hxx>
 #include <simgear/misc/sg_path.hxx>
 #include <simgear/misc/sg_dir.hxx>
 #include <simgear/misc/strutils.hxx>
+#include <simgear/threads/SGThread.hxx>
+#include <simgear/threads/SGGuard.hxx>
+#include <simgear/timing/timestamp.hxx>
+
+#include <Main/tgconstruct.hxx>
+#include <Main/priorities.hxx>
+#include <Main/usgs.hxx>
 
 using std::cout;
 using std::cerr;
@@ -59,6 +72,7 @@ using std::string;
 using std::vector;
 
 string work_base = ".";
+string share_base = "";
 string output_base = ".";
 vector<string> load_dirs;
 bool do_overwrite = true;
@@ -140,57 +154,172 @@ int make_socket (char *host, unsigned short int port) {
 }
 
 
-// connect to the server and get the next task
-long int get_next_task( const string& host, int port, long int last_tile ) {
-    long int tile;
-    int sock, len;
-    fd_set ready;
-    char message[MAXBUF];
+// Connection to the server.  It stays open for the whole run; the
+// builder and the heartbeat thread share it, one request and its reply
+// at a time.
+//
+// Each lost connection ends a generation.  The server takes all leases
+// back when a connection drops, so tiles leased in an earlier generation
+// are no longer ours.
+class ServerConnection {
+public:
+    ServerConnection( const string& h, int p ) :
+	host(h), port(p), sock(-1), generation(0), lease_time(600), max_batch(1) {}
+
+    // (re)connect and introduce ourselves, retrying until the server
+    // answers
+    void open( const string& name );
+
+    // send one request line and return the reply line - empty if the
+    // connection was lost
+    string request( const string& line );
+
+    // the same, but only while the connection is still of generation gen
+    string request( const string& line, unsigned int gen );
+
+    unsigned int get_generation() {
+	SGGuard<SGMutex> g( lock );
+	return generation;
+    }
 
-    // loop till we get a socket connection
-    while ( (sock = make_socket( (char *)host.c_str(), port )) < 0 ) {
-	// check if the master switch is on
-	check_master_switch();
+    int get_lease_time() const { return lease_time; }
+    int get_max_batch() const { return max_batch; }
+
+private:
+    string send_request( const string& line );
+    void drop();
+
+    string host;
+    int    port;
+    int    sock;
+    string input;
+    SGMutex lock;
+    unsigned int generation;
+
+    int    lease_time;
+    int    max_batch;
+};
+
+
+void ServerConnection::open( const string& name ) {
+    for ( ;; ) {
+	{
+	    SGGuard<SGMutex> g( lock );
+	    drop();
+
+	    // loop till we get a socket connection
+	    while ( (sock = make_socket( (char *)host.c_str(), port )) < 0 ) {
+		// check if the master switch is on
+		check_master_switch();
+
+		sleep(1);
+	    }
+	}
+
+	string reply = request( "HELLO " + name );
+	if ( sscanf( reply.c_str(), "OK %d %d", &lease_time, &max_batch ) == 2 ) {
+	    cout << "connected to server, leases last " << lease_time
+		 << " seconds" << endl;
+	    return;
+	}
 
 	sleep(1);
     }
+}
+
 
-    // build a command string from the argv[]'s
-    sprintf(message, "%ld", last_tile);
+string ServerConnection::request( const string& line ) {
+    SGGuard<SGMutex> g( lock );
+
+    return send_request( line );
+}
 
-    // send command and arguments to remote server
-    if ( write(sock, message, sizeof(message)) < 0 ) {
-        perror("Cannot write to stream socket");
+
+string ServerConnection::request( const string& line, unsigned int gen ) {
+    SGGuard<SGMutex> g( lock );
+
+    if ( gen != generation ) {
+	return "";
     }
 
-    // loop until remote program finishes
-    cout << "querying server for next task ..." << endl;
+    return send_request( line );
+}
 
-    FD_ZERO(&ready);
-    FD_SET(sock, &ready);
 
-    // block until input from sock
-    select(sock+1, &ready, 0, 0, NULL);
-    cout << " received reply" << endl;
+string ServerConnection::send_request( const string& line ) {
+    if ( sock < 0 ) {
+	return "";
+    }
 
-    if ( FD_ISSET(sock, &ready) ) {
-	/* input coming from socket */
-	if ( (len = read(sock, message, MAXBUF)) > 0 ) {
-	    message[len] = '\0';
-	    tile = atoi(message);
-	    cout << "  tile to construct = " << tile << endl;
-	    close(sock);
-	    return tile;
-	} else {
-	    close(sock);
-	    return -1;
+    string message = line + "\n";
+    if ( write(sock, message.c_str(), message.length()) < 0 ) {
+	perror("Cannot write to stream socket");
+	drop();
+	return "";
+    }
+
+    // wait for the whole reply line
+    string::size_type eol;
+    while ( (eol = input.find( '\n' )) == string::npos ) {
+	char buf[MAXBUF];
+	int len = read(sock, buf, MAXBUF);
+	if ( len <= 0 ) {
+	    cout << "lost connection to server" << endl;
+	    drop();
+	    return "";
 	}
+	input.append( buf, len );
     }
 
-    close(sock);
-    return -1;
+    string reply = input.substr( 0, eol );
+    input.erase( 0, eol + 1 );
+
+    return reply;
 }
 
+
+void ServerConnection::drop() {
+    if ( sock >= 0 ) {
+	close(sock);
+	sock = -1;
+	generation++;
+    }
+    input.clear();
+}
+
+
+// Keeps the leases of this client alive while tiles are being built.
+class HeartbeatThread : public SGThread {
+public:
+    HeartbeatThread( ServerConnection& c ) : conn(c), running(true) {}
+
+    void stop() {
+	SGGuard<SGMutex> g( lock );
+	running = false;
+	wake.signal();
+    }
+
+    virtual void run() {
+	SGGuard<SGMutex> g( lock );
+
+	while ( running ) {
+	    // several heartbeats per lease, so one lost beat does no harm
+	    unsigned int interval = std::max( 1, conn.get_lease_time() / 3 );
+	    wake.wait( lock, interval * 1000 );
+
+	    if ( running ) {
+		conn.request( "HEARTBEAT" );
+	    }
+	}
+    }
+
+private:
+    ServerConnection& conn;
+    bool              running;
+    SGMutex           lock;
+    SGWaitCondition   wake;
+};
+
 // check if the tile really has to be generated
 static bool must_generate( const SGBucket& b ) {
     if (do_overwrite)
@@ -258,83 +387,221 @@ static bool must_generate( const SGBucket& b ) {
 }
 
 
-// build the specified tile, return true if contruction completed
-// successfully
-bool construct_tile( const SGBucket& b,
-		     const string& result_file,
-		     const string &cover ) {
+// bytes of output written for a tile
+static long output_size( const SGBucket& b ) {
+    const char* extensions[] = { ".btg.gz", ".stg" };
+    string base = output_base + "/" + b.gen_base_path()
+	+ "/" + b.gen_index_str();
+    long size = 0;
 
-    string command = "tg-construct ";
-    command = command + " --work-dir=" + work_base;
-    command = command + " --output-dir=" + output_base;
-    command = command + " --tile-id=" + b.gen_index_str();
-    if ( cover.size() > 0 ) {
-        command = command + " --cover=" + cover;
+    for ( unsigned int i = 0; i < 2; i++ ) {
+	struct stat buf;
+	if ( stat( (base + extensions[i]).c_str(), &buf ) == 0 ) {
+	    size += buf.st_size;
+	}
     }
-    for (int i = 0; i < (int)load_dirs.size(); i++) {
-        command = command + " " + load_dirs[i];
-    }
-    command = command + " > " + result_file + " 2>&1";
-    cout << command << endl;
-	
-    system( command.c_str() );
-	
-    FILE *fp = fopen( result_file.c_str(), "r" );
-    if ( fp == NULL) {
-	cout << "Missing results file " << result_file << endl;
-	return false;
-    }
-    char line[256];
-    while ( fgets( line, 256, fp ) != NULL ) {
-        string line_str = line;
-        line_str = line_str.substr(0, line_str.length() - 1);
-        // cout << line_str << endl;
-        if ( line_str == "[Finished successfully]" ) {
-            cout << "Tile " << b.gen_index_str() << " finished successfully" << endl;
-            fclose(fp);
-            return true;
-        }
 
-    }
-    fclose(fp);
-    
-    // Save the log file of the failed tile
-    cout << "Tile " << b.gen_index_str() << " failed" << endl;
-    string savelog=work_base+"/Status/failed-"+b.gen_index_str()+".log";
-    
-    command="mv "+result_file+" " +savelog;
-    cout << command << endl;
-    
-    system(command.c_str());
-    
-    return false;
+    return size;
 }
 
 
+// Tiles leased from the server and not yet reported back.  The main
+// thread leases while fewer tiles than workers are in flight.  Tiles are
+// tagged with the connection generation they were leased in; abandon()
+// forgets the tiles of earlier generations after a reconnect.
+class TileQueue {
+public:
+    TileQueue( unsigned int gen ) : in_flight(0), generation(gen) {}
+
+    // a tile leased in generation gen, or -1 to stop a worker
+    void push( long tile, unsigned int gen ) {
+	SGGuard<SGMutex> g( lock );
+	if ( tile >= 0 ) {
+	    in_flight++;
+	}
+	tiles.push_back( std::make_pair( tile, gen ) );
+	changed.broadcast();
+    }
+
+    // the next tile and its generation - false to stop
+    bool pop( long& tile, unsigned int& gen ) {
+	SGGuard<SGMutex> g( lock );
+	while ( tiles.empty() ) {
+	    changed.wait( lock );
+	}
+	tile = tiles.front().first;
+	gen  = tiles.front().second;
+	tiles.pop_front();
+	return tile >= 0;
+    }
+
+    // a tile was reported, or abandoned
+    void finished( unsigned int gen ) {
+	SGGuard<SGMutex> g( lock );
+	if ( gen == generation ) {
+	    in_flight--;
+	}
+	changed.broadcast();
+    }
+
+    // the leases of older generations are gone: drop the tiles not yet
+    // started, and stop counting the ones being built
+    void abandon( unsigned int gen ) {
+	SGGuard<SGMutex> g( lock );
+	std::deque< std::pair<long, unsigned int> > keep;
+	for ( unsigned int i = 0; i < tiles.size(); i++ ) {
+	    if ( tiles[i].first < 0 ) {
+		keep.push_back( tiles[i] );
+	    }
+	}
+	tiles.swap( keep );
+	in_flight = 0;
+	generation = gen;
+	changed.broadcast();
+    }
+
+    // wait until fewer than n tiles are in flight - at most msec, if
+    // given - and return how many are
+    unsigned int wait_below( unsigned int n, unsigned int msec = 0 ) {
+	SGGuard<SGMutex> g( lock );
+	while ( in_flight >= n ) {
+	    if ( msec ) {
+		if ( !changed.wait( lock, msec ) ) {
+		    break;
+		}
+	    } else {
+		changed.wait( lock );
+	    }
+	}
+	return in_flight;
+    }
+
+private:
+    SGMutex           lock;
+    SGWaitCondition   changed;
+    std::deque< std::pair<long, unsigned int> > tiles;
+    unsigned int      in_flight;
+    unsigned int      generation;
+};
+
+
+// Builds leased tiles in this process, all three stages back to back.
+// The area definitions, usgs map and land cover are loaded once per
+// client and shared; each worker keeps its TGConstruct, and with it the
+// elevation array of a tile from stage 1 to stage 2.
+class TileWorker : public SGThread {
+public:
+    TileWorker( TileQueue& q, ServerConnection& c,
+		const TGAreaDefinitions& areas, const LandCover* cover ) :
+	queue(q), conn(c), construct(areas, 1, unused)
+    {
+	construct.set_cover( cover );
+	construct.set_paths( work_base, share_base, output_base, load_dirs );
+	construct.set_options( false, 0.0 );
+	construct.set_tile_threads( 1 );
+	construct.set_keep_array( true );
+    }
+
+    virtual void run() {
+	long tile;
+	unsigned int gen;
+
+	while ( queue.pop( tile, gen ) ) {
+	    SGBucket bucket(tile);
+	    SGTimeStamp start = SGTimeStamp::now();
+	    const char* status;
+
+	    cout << "  tile to construct = " << tile << endl;
+	    if (!must_generate(bucket)) {
+		cout << "No need to build tile " << tile << "\n";
+		status = "skipped";
+	    } else {
+		status = construct_tile( bucket, gen );
+	    }
+
+	    // a tile of a lost connection may be leased to someone else by
+	    // now - it is not ours to report
+	    if ( status ) {
+		std::ostringstream report;
+		report << "RESULT " << tile << " " << status << " "
+		       << (SGTimeStamp::now() - start).toSecs() << " "
+		       << output_size( bucket );
+
+		conn.request( report.str(), gen );
+	    }
+	    queue.finished( gen );
+	}
+    }
+
+private:
+    // build the specified tile, return "ok" or "failed" - or NULL if
+    // the lease was lost on the way
+    const char* construct_tile( const SGBucket& b, unsigned int gen ) {
+	try {
+	    for ( unsigned int stage = 1; stage <= 3; stage++ ) {
+		if ( conn.get_generation() != gen ) {
+		    cout << "Lost the lease of tile " << b.gen_index_str() << ", abandoned" << endl;
+		    return NULL;
+		}
+		construct.ConstructBucket( b, stage );
+	    }
+	} catch ( sg_exception& e ) {
+	    cout << "Tile " << b.gen_index_str() << ": " << e.getFormattedMessage() << endl;
+	    cout << "Build of tile " << b.gen_index_str() << " failed\n";
+	    return "failed";
+	} catch ( std::exception& e ) {
+	    cout << "Tile " << b.gen_index_str() << ": " << e.what() << endl;
+	    cout << "Build of tile " << b.gen_index_str() << " failed\n";
+	    return "failed";
+	} catch ( ... ) {
+	    cout << "Tile " << b.gen_index_str() << ": unknown error" << endl;
+	    cout << "Build of tile " << b.gen_index_str() << " failed\n";
+	    return "failed";
+	}
+
+	cout << "Tile " << b.gen_index_str() << " finished successfully" << endl;
+	return "ok";
+    }
+
+    TileQueue&              queue;
+    ServerConnection&       conn;
+    SGLockedQueue<SGBucket> unused;	// construct runs without its queue
+    TGConstruct             construct;
+};
+
+
 void
 usage (const string name)
 {
   cout << "Usage: " << name << endl;
   cout << "[ --output-dir=<directory>" << endl;
   cout << "  --work-dir=<directory>" << endl;
+  cout << "  --share-dir=<directory>" << endl;
   cout << "  --host=<address>" << endl;
   cout << "  --port=<number>" << endl;
+  cout << "  --threads" << endl;
+  cout << "  --threads=<numthreads>" << endl;
   cout << "  --rude" << endl;
   cout << "  --no-overwrite" << endl;
   cout << "  --cover=<landcover-raster>" << endl;
+  cout << "  --priorities=<filename>" << endl;
+  cout << "  --usgs-map=<filename>" << endl;
   cout << "<load directory...>" << endl;
   exit(-1);
 }
 
 int main(int argc, char *argv[]) {
-    long int tile, last_tile;
     bool rude = false;
-    bool result;
+    unsigned int num_threads = 1;
 
     string cover;
+    string priorities_file = DEFAULT_PRIORITIES_FILE;
+    string usgs_map_file = DEFAULT_USGS_MAPFILE;
     string host = "127.0.0.1";
     int port=4001;
 
+    sglog().setLogLevels( SG_ALL, SG_INFO );
+
     //
     // Parse the command-line arguments.
     //
@@ -346,16 +613,26 @@ int main(int argc, char *argv[]) {
 	output_base = arg.substr(13);
       } else if (arg.find("--work-dir=") == 0) {
 	work_base = arg.substr(11);
+      } else if (arg.find("--share-dir=") == 0) {
+	share_base = arg.substr(12);
       } else if (arg.find("--host=") == 0) {
 	host = arg.substr(7);
       } else if (arg.find("--port=") == 0) {
 	port = atoi(arg.substr(7).c_str());
+      } else if (arg.find("--threads=") == 0) {
+	num_threads = atoi(arg.substr(10).c_str());
+      } else if (arg == "--threads") {
+	num_threads = boost::thread::hardware_concurrency();
       } else if (arg == "--rude") {
 	rude = true;
       } else if (arg == "--no-overwrite") {
 	do_overwrite = false; 
       } else if (arg.find("--cover=") == 0) {
 	cover = arg.substr(8);
+      } else if (arg.find("--priorities=") == 0) {
+	priorities_file = arg.substr(13);
+      } else if (arg.find("--usgs-map=") == 0) {
+	usgs_map_file = arg.substr(11);
       } else if (arg.find("--") == 0) {
 	usage(argv[0]);
       } else {
@@ -363,10 +640,17 @@ int main(int argc, char *argv[]) {
       }
     }
 
+    if ( share_base == "" ) {
+	share_base = work_base + "/Shared";
+    }
+    num_threads = std::max( num_threads, 1u );
+
     cout << "Output directory is " << output_base << endl;
     cout << "Working directory is " << work_base << endl;
+    cout << "Shared directory is " << share_base << endl;
     cout << "Server host is " << host << endl;
     cout << "Server port is " << port << endl;
+    cout << "Building " << num_threads << " tiles at a time" << endl;
     if (rude)
       cout << "Running in rude mode" << endl;
     else
@@ -382,33 +666,85 @@ int main(int argc, char *argv[]) {
       cout << "Load directory: " << dir << endl;
     }
 
+    // loaded once, for all tiles of this client
+    TGAreaDefinitions areas;
+    if ( areas.init( priorities_file ) ) {
+	exit( -1 );
+    }
+
+    LandCover* landcover = NULL;
+    if ( cover.size() > 0 ) {
+	try {
+	    landcover = new LandCover( cover );
+	} catch ( std::string e ) {
+	    cout << "Unable to open land cover " << cover << ": " << e << endl;
+	    exit( -1 );
+	}
+	if ( load_usgs_map( usgs_map_file, areas ) ) {
+	    exit( -1 );
+	}
+    }
+
     // get hostname and pid
     char hostname[MAXBUF];
     gethostname( hostname, MAXBUF );
     pid_t pid = getpid();
 
     char tmp[MAXBUF];
-    sprintf(tmp, "result.%s.%d.", hostname, pid);
-    string result_file = tempnam( 0, tmp );
-
-    last_tile = 0;
+    sprintf(tmp, "%s:%d", hostname, pid);
+    string name = tmp;
 
     // check if the master switch is on
     check_master_switch();
 
-    while ( (tile = get_next_task( host, port, last_tile )) >= 0 ) {
-        SGBucket bucket(tile);
-	if (!must_generate(bucket)) {
-	    cout << "No need to build tile " << tile << "\n";
-	    result=true;
-	} else {
-	    result=construct_tile( bucket, result_file, cover );
+    ServerConnection conn( host, port );
+    conn.open( name );
+
+    HeartbeatThread heartbeat( conn );
+    heartbeat.start();
+
+    TileQueue queue( conn.get_generation() );
+    std::vector<TileWorker*> workers;
+    for ( unsigned int i = 0; i < num_threads; i++ ) {
+	workers.push_back( new TileWorker( queue, conn, areas, landcover ) );
+	workers.back()->start();
+    }
+
+    bool done = false;
+    while ( !done ) {
+	// lease for the idle workers
+	unsigned int busy = queue.wait_below( num_threads );
+	unsigned int gen = conn.get_generation();
+
+	std::ostringstream lease;
+	lease << "LEASE " << num_threads - busy;
+
+	std::istringstream reply( conn.request( lease.str() ) );
+	string kind;
+
+	if ( !(reply >> kind) ) {
+	    // server went away - it takes our leases back
+	    conn.open( name );
+	    queue.abandon( conn.get_generation() );
+	    continue;
+	} else if ( kind == "DONE" ) {
+	    done = true;
+	    continue;
+	} else if ( kind == "WAIT" ) {
+	    // until a tile of ours finishes, which may free its neighbours
+	    int seconds = 10;
+	    reply >> seconds;
+	    queue.wait_below( busy, std::max( seconds, 1 ) * 1000 );
+	    continue;
+	} else if ( kind != "TILES" ) {
+	    cout << "unexpected reply from server: " << kind << endl;
+	    sleep( 1 );
+	    continue;
 	}
-	if ( result ) {
-	    last_tile = tile;
-	} else {
-            cout << "Build of tile " << tile << " failed\n";
-	    last_tile = -tile;
+
+	long int tile;
+	while ( reply >> tile ) {
+	    queue.push( tile, gen );
 	}
 
 	// check if the master switch is on
@@ -416,7 +752,7 @@ int main(int argc, char *argv[]) {
 
 	// niceness policy: This whole process should run niced.  But
 	// additionally, if there is interactive use, we will sleep
-	// for 60 seconds between each tile to stagger out the load
+	// for 60 seconds between each lease to stagger out the load
 	// and impose less of an impact on the machine.
 	if ( !system_free() && !rude) {
 	    cout << "System has interactive use, sleeping for " 
@@ -425,5 +761,21 @@ int main(int argc, char *argv[]) {
 	}
     }
 
+    // the server says DONE only once our own tiles are reported
+    for ( unsigned int i = 0; i < workers.size(); i++ ) {
+	queue.push( -1, 0 );
+    }
+    for ( unsigned int i = 0; i < workers.size(); i++ ) {
+	workers[i]->join();
+	delete workers[i];
+    }
+
+    heartbeat.stop();
+    heartbeat.join();
+
+    delete landcover;
+
+    cout << "server has no more work" << endl;
+
     return 0;
 }
@@ -7,10 +7,16 @@
 
 #include <simgear/compiler.h>
 
+#include <algorithm>
 #include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
 #include <string>
+#include <vector>
 
 #include <stdio.h>
+#include <math.h>
 #include <stdlib.h>
 #include <string.h>
 #ifdef _MSC_VER
@@ -21,7 +27,7 @@
 #  include <unistd.h>
 #  include <sys/socket.h>		// bind
 #  include <netinet/in.h>
-#  include <sys/wait.h>
+#  include <signal.h>		// ignore SIGPIPE
 #endif
 #include <sys/stat.h>		// for stat()
 #include <time.h>               // for time();
@@ -31,35 +37,21 @@
 
 #include <simgear/bucket/newbucket.hxx>
 #include <simgear/misc/sg_path.hxx>
+#include <simgear/misc/sg_dir.hxx>
 
 using std:: cout ;
 using std:: cerr ;
 using std:: endl ;
 using std:: string ;
 
-#if defined (__sun) || defined (__CYGWIN__) || defined(sgi)
-#  define WAIT_ANY (pid_t)-1
-#endif
-
 #define MAXBUF 16384
 
-static double start_lon, start_lat;
-static double lat = 0.0;
-static double lon = 0.0;
-static double dy = 0.0;
-static int pass = 0;
 static double area_width = 10.0; // width of generated area in degrees
 static double area_height = 10.0; // height of generated area in degrees
 
-#ifdef _MSC_VER
-
-#define numWorkerThreads 10
-
-HANDLE	gWorkerThreads[numWorkerThreads];
-HANDLE	gIoPort;
-DWORD WINAPI ThreadProc(void *);
-
-#endif
+static int lease_time = 600;	// seconds a lease lasts without a heartbeat
+static int max_batch = 8;	// most tiles handed out in one lease
+static int max_attempts = 3;	// leases of a tile before it counts as failed
 
 
 int make_socket (unsigned short int* port) {
@@ -130,274 +122,600 @@ static bool has_data( const string& path, const SGBucket& b ) {
 #endif
 
 
-// initialize the tile counting system
-void init_tile_count( const string& chunk ) {
-    // pre-pass
-    pass = 0;
-
-    // initial bogus value
-    lat = 100;
-
-    // determine tile height
-    SGBucket tmp1( 0.0, 0.0 );
-    dy = tmp1.get_height();
-
+// parse a chunk name of the form [we]xxx[ns]yy into its south west corner
+void parse_chunk( const string& chunk, double* start_lon, double* start_lat ) {
     string lons = chunk.substr(0, 4);
     string lats = chunk.substr(4, 3);
     cout << "lons = " << lons << " lats = " << lats << endl;
 
     string horz = lons.substr(0, 1);
-    start_lon = atof( lons.substr(1,3).c_str() );
-    if ( horz == "w" ) { start_lon *= -1; }
+    *start_lon = atof( lons.substr(1,3).c_str() );
+    if ( horz == "w" ) { *start_lon *= -1; }
 
     string vert = lats.substr(0, 1);
-    start_lat = atof( lats.substr(1,2).c_str() );
-    if ( vert == "s" ) { start_lat *= -1; }
+    *start_lat = atof( lats.substr(1,2).c_str() );
+    if ( vert == "s" ) { *start_lat *= -1; }
 
-    cout << "start_lon = " << start_lon << "  start_lat = " << start_lat
+    cout << "start_lon = " << *start_lon << "  start_lat = " << *start_lat
 	 << endl;
 }
 
 
-// return the next tile
-long int get_next_tile() {
-    SGBucket b;
-    static double shift_over = 0.0;
-    static double shift_up = 0.0;
-    static bool first_time = true;
-    static time_t start_seconds, seconds;
-    static int counter;
-    static int global_counter;
+// all tiles of a chunk, row by row
+void get_chunk_tiles( const string& chunk, std::vector<long>& chunk_tiles ) {
+    double start_lon, start_lat;
+    parse_chunk( chunk, &start_lon, &start_lat );
 
-    // first time this routine is called, init counters
-    if ( first_time ) {
-	first_time = false;
-	start_seconds = seconds = time(NULL);
-	counter = global_counter = 0;
+    SGBucket tmp1( 0.0, 0.0 );
+    double dy = tmp1.get_height();
+
+    for ( double lat = start_lat + dy * 0.5;
+	  lat < start_lat + area_height; lat += dy ) {
+	SGBucket tmp( 0.0, lat );
+	double dx = tmp.get_width();
+
+	for ( double lon = start_lon + dx * 0.5;
+	      lon < start_lon + area_width; lon += dx ) {
+	    chunk_tiles.push_back( SGBucket( lon, lat ).gen_index() );
+	}
     }
+}
 
-    // cout << "lon = " << lon << " lat = " << lat << endl;
-    // cout << "start_lat = " << start_lat << endl;
 
-    if ( lon > start_lon + area_width ) {
-	// increment to next row
-	// skip every other row (to avoid two clients working on
-	// adjacent tiles)
-	lat += 2.0 * dy;
+// The tiles sharing an edge or a corner with a tile.  Rows of different
+// latitude may have buckets of different widths, so each row is sampled
+// across the whole width of the tile, a little past both edges.
+void get_neighbours( long tile, std::vector<long>& neighbours ) {
+    SGBucket b( tile );
+    double west = b.get_center_lon() - b.get_width() * 0.5;
+    double east = b.get_center_lon() + b.get_width() * 0.5;
+    double eps = 0.0001;
 
-	SGBucket tmp( 0.0, lat );
-	double dx = tmp.get_width();
-	lon = start_lon + (shift_over*dx) + (dx*0.5);
-    }
-
-    if ( lat > start_lat + area_height ) {
-	++pass;
-	if ( pass == 1 ) {
-	    shift_over = 0.0;
-	    shift_up = 0.0;
-	} else if ( pass == 2 ) {
-	    shift_over = 1.0;
-	    shift_up = 0.0;
-	} else if ( pass == 3 ) {
-	    shift_over = 0.0;
-	    shift_up = 1.0;
-	} else if ( pass == 4 ) {
-	    shift_over = 1.0;
-	    shift_up = 1.0;
-	} else {
-	    return -1;
+    neighbours.clear();
+
+    for ( int dy = -1; dy <= 1; dy++ ) {
+	double lat = b.get_center_lat() + dy * b.get_height();
+	if ( lat <= -90.0 || lat >= 90.0 ) {
+	    continue;
 	}
 
-	// reset lat
-	// lat = -89.0 + (shift_up*dy) - (dy*0.5);
-	// lat = 27.0 + (0*dy) + (dy*0.5);
-	lat = start_lat + (shift_up*dy) + (dy*0.5);
+	double width = SGBucket( b.get_center_lon(), lat ).get_width();
+	int steps = (int)ceil( 2.0 * b.get_width() / std::min( width, b.get_width() ) );
 
-	// reset lon
-	SGBucket tmp( 0.0, lat );
-	double dx = tmp.get_width();
-	// lon = -82 + (shift_over*dx) + (dx*0.5);
-	lon = start_lon + (shift_over*dx) + (dx*0.5);
+	for ( int i = 0; i <= steps; i++ ) {
+	    double lon = west + i * (east - west) / steps;
+	    if ( i == 0 )     { lon -= eps; }
+	    if ( i == steps ) { lon += eps; }
+	    if ( lon < -180.0 )  { lon += 360.0; }
+	    if ( lon >= 180.0 )  { lon -= 360.0; }
 
-	cout << "starting pass = " << pass
-	     << " with lat = " << lat << " lon = " << lon << endl;
+	    long n = SGBucket( lon, lat ).gen_index();
+	    if ( n != tile &&
+		 std::find( neighbours.begin(), neighbours.end(), n ) == neighbours.end() ) {
+		neighbours.push_back( n );
+	    }
+	}
     }
+}
 
-    // if ( ! start_lon ) {
-    // lon = -180 + dx * 0.5;
-    // } else {
-    //    start_lon = false;
-    // }
 
-    b = SGBucket( lon, lat );
+// display usage and exit
+void usage( const string name ) {
+    cout << "Usage: " << name
+	 << "[--width=<width> --height=<height>] "
+	 << "[--lease-time=<seconds> --batch=<tiles> --attempts=<n>] "
+	 << " <work_base> <output_base> chunk1 chunk2 ..."
+	 << endl;
+    cout << "\twhere chunk represents the south west corner of the area"
+	 << endl;
+    cout << "\tto build and is of the form [we]xxx[ns]yy.  For example:"
+	 << endl;
+    cout << "\tw020n10 e150s70, and the width and height are supplied"
+	 << endl;
+    cout << "\tin degrees (default: 10x10)." << endl;
+    cout << "\tClients hold leases on up to <tiles> tiles (default: 8) and"
+	 << endl;
+    cout << "\tmust be heard from every <seconds> (default: 600).  A tile is"
+	 << endl;
+    cout << "\tfailed after <n> lost leases (default: 3).  Results are kept"
+	 << endl;
+    cout << "\tin <work_base>/Status/tiles.journal across runs." << endl;
+    exit(-1);
+}
+
+
+// work table
+//
+// The server keeps the state of every tile in memory.  Every change that
+// must survive a restart goes to an append-only journal in the status
+// directory, one line per event:
+//
+//   <time> lease <tile> <client>
+//   <time> expire <tile> <client>
+//   <time> release <tile> <client>
+//   <time> result <tile> <ok|skipped|failed> <seconds> <bytes> <client>
+//
+// On startup the results of earlier runs are replayed, so finished and
+// failed tiles are not handed out again.
+//
+// Two clients must not build adjacent tiles at the same time, as they
+// share edge data.  A leased tile locks its neighbours; any pending tile
+// without locks may be handed out, the most expensive first.
+
+enum TileStatus {
+    TILE_PENDING = 0,		// waiting to be handed out
+    TILE_LEASED,		// a client is building it
+    TILE_DONE,			// built, or found up to date
+    TILE_FAILED,		// failed, or lost too many leases
+    NUM_TILE_STATUS
+};
+
+struct TileState {
+    TileStatus status;
+    int        client;		// socket of the lease holder
+    time_t     expires;		// end of the lease unless renewed
+    int        attempts;	// leases so far
+    int        locks;		// leased neighbours
+    double     cost;		// estimated - bytes of source data
+};
+
+struct Client {
+    string          name;	// host:pid given in HELLO
+    string          input;	// received, but not yet a whole line
+    std::set<long>  leased;
+};
+
+static std::map<long, TileState> tiles;
 
-    // increment to next tile
-    SGBucket tmp( 0.0, lat );
-    double dx = tmp.get_width();
+// pending tiles by descending cost
+typedef std::set< std::pair<double, long> > pending_set;
+static pending_set pending;
 
-    // skip every other column (to avoid two clients working on
-    // adjacent tiles)
-    lon += 2.0 * dx;
+static int status_count[NUM_TILE_STATUS];
+static std::map<int, Client> clients;
+static FILE* journal = NULL;
+static time_t start_time;
+static int results_this_run = 0;
 
-    ++global_counter;
-    ++counter;
 
-    time_t tmp_time = time(NULL);
-    if ( tmp_time != seconds ) {
-	seconds = tmp_time;
-	cout << "Current tile per second rate = " << counter << endl;
-	cout << "Overall tile per second rate = "
-	     << (double)global_counter / (double)(seconds - start_seconds)
-	     << endl;
-	cout << "Overall tile per hour rate = "
-	     <<  (double)global_counter * 3600.0 /
-	           (double)(seconds - start_seconds)
-	     << endl;
-	counter = 0;
+static void close_socket( int sock ) {
+#ifdef _MSC_VER
+    closesocket(sock);
+#else
+    close(sock);
+#endif
+}
+
+
+static void lock_neighbours( long tile, int delta ) {
+    std::vector<long> neighbours;
+    get_neighbours( tile, neighbours );
+
+    for ( unsigned int i = 0; i < neighbours.size(); i++ ) {
+	std::map<long, TileState>::iterator it = tiles.find( neighbours[i] );
+	if ( it != tiles.end() ) {
+	    it->second.locks += delta;
+	}
+    }
+}
+
+
+// move a tile to a new status - keeping the counts, the pending set and
+// the neighbour locks in step
+static void set_status( long tile, TileState& state, TileStatus status ) {
+    if ( state.status == TILE_PENDING ) {
+	pending.erase( std::make_pair( -state.cost, tile ) );
+    } else if ( state.status == TILE_LEASED ) {
+	lock_neighbours( tile, -1 );
     }
 
-    return b.gen_index();
+    status_count[state.status]--;
+    status_count[status]++;
+    state.status = status;
+
+    if ( status == TILE_PENDING ) {
+	pending.insert( std::make_pair( -state.cost, tile ) );
+    } else if ( status == TILE_LEASED ) {
+	lock_neighbours( tile, 1 );
+    }
 }
 
 
-// log a pending tile (has been given out as a taks for some client)
-void log_pending_tile( const string& path, long int tile ) {
-    SGBucket b(tile);
+// add a tile to the work list (once) - it is queued by queue_tiles()
+// once its cost is known
+static void add_tile( long tile ) {
+    if ( tiles.find( tile ) != tiles.end() ) {
+	return;
+    }
+
+    TileState state;
+    state.status = TILE_PENDING;
+    state.client = -1;
+    state.expires = 0;
+    state.attempts = 0;
+    state.locks = 0;
+    state.cost = 0.0;
+    tiles[tile] = state;
+    status_count[TILE_PENDING]++;
+}
 
-    string pending_file = path + "/" + b.gen_index_str() + ".pending";
 
-    string command = "touch " + pending_file;
-    system( command.c_str() );
+static void queue_tiles() {
+    for ( std::map<long, TileState>::iterator it = tiles.begin();
+	  it != tiles.end(); ++it ) {
+	if ( it->second.status == TILE_PENDING ) {
+	    pending.insert( std::make_pair( -it->second.cost, it->first ) );
+	}
+    }
 }
 
 
-// a tile is finished (removed the .pending file)
-void log_finished_tile( const string& path, long int tile ) {
-    SGBucket b(tile);
+// Estimate the cost of each tile from the size of its source data in the
+// work directories, so the big tiles are started early instead of
+// holding up the end of the run.
+static void estimate_costs( const string& work_base ) {
+    std::set<string> base_paths;
+    for ( std::map<long, TileState>::iterator it = tiles.begin();
+	  it != tiles.end(); ++it ) {
+	base_paths.insert( SGBucket( it->first ).gen_base_path() );
+    }
+
+    simgear::Dir work( (SGPath( work_base )) );
+    simgear::PathList dirs = work.children( simgear::Dir::TYPE_DIR |
+					    simgear::Dir::NO_DOT_OR_DOTDOT );
+    double total = 0.0;
+
+    for ( unsigned int i = 0; i < dirs.size(); i++ ) {
+	if ( dirs[i].file() == "Status" || dirs[i].file() == "Shared" ) {
+	    continue;
+	}
+
+	for ( std::set<string>::iterator bp = base_paths.begin();
+	      bp != base_paths.end(); ++bp ) {
+	    simgear::Dir dir( SGPath( dirs[i].str() + "/" + *bp ) );
+	    if ( !dir.exists() ) {
+		continue;
+	    }
+
+	    simgear::PathList files = dir.children( simgear::Dir::TYPE_FILE );
+	    for ( unsigned int j = 0; j < files.size(); j++ ) {
+		// <tile index>.<extension>
+		string name = files[j].file();
+		char *end;
+		long tile = strtol( name.c_str(), &end, 10 );
+		if ( *end != '.' ) {
+		    continue;
+		}
+
+		std::map<long, TileState>::iterator it = tiles.find( tile );
+		struct stat buf;
+		if ( it != tiles.end() &&
+		     stat( files[j].str().c_str(), &buf ) == 0 ) {
+		    it->second.cost += buf.st_size;
+		    total += buf.st_size;
+		}
+	    }
+	}
+    }
 
-    string finished_file = path + "/" + b.gen_index_str() + ".pending";
-    // cout << "unlinking " << finished_file << endl;
-    unlink( finished_file.c_str() );
+    cout << "Source data for the work list: " << total << " bytes" << endl;
 }
 
 
-// make note of a failed tile
-void log_failed_tile( const string& path, long int tile ) {
-    SGBucket b(tile);
+// mark the tiles finished by earlier runs
+static void replay_journal( const string& file ) {
+    FILE *fp = fopen( file.c_str(), "r" );
+    if ( fp == NULL ) {
+	return;
+    }
 
-    string failed_file = path + "/" + b.gen_index_str() + ".failed";
+    int replayed = 0;
+    char line[MAXBUF];
+    while ( fgets( line, MAXBUF, fp ) != NULL ) {
+	std::istringstream in( line );
+	long t, tile;
+	string kind, status;
 
-    string command = "touch " + failed_file;
-    system( command.c_str() );
+	if ( !(in >> t >> kind >> tile) || kind != "result" ) {
+	    continue;
+	}
+	in >> status;
+
+	std::map<long, TileState>::iterator it = tiles.find( tile );
+	if ( it == tiles.end() ) {
+	    continue;
+	}
+
+	if ( status == "failed" ) {
+	    set_status( it->first, it->second, TILE_FAILED );
+	} else {
+	    set_status( it->first, it->second, TILE_DONE );
+	}
+	replayed++;
+    }
+    fclose( fp );
 
-    cout << "logged bad tile = " << tile << endl;
+    cout << "Replayed " << replayed << " results from " << file << endl;
 }
 
 
-// display usage and exit
-void usage( const string name ) {
-    cout << "Usage: " << name
-	 << "[--width=<width> --height=<height>] "
-	 << " <work_base> <output_base> chunk1 chunk2 ..."
-	 << endl;
-    cout << "\twhere chunk represents the south west corner of the area"
-	 << endl;
-    cout << "\tto build and is of the form [we]xxx[ns]yy.  For example:"
-	 << endl;
-    cout << "\tw020n10 e150s70, and the width and height are supplied"
-	 << endl;
-    cout << "\tin degrees (default: 10x10)." << endl;
-    exit(-1);
+static void journal_record( const string& event ) {
+    if ( journal == NULL ) {
+	return;
+    }
+
+    fprintf( journal, "%ld %s\n", (long)time(NULL), event.c_str() );
+    fflush( journal );
 }
 
-void alloc_new_tile( int msgsock, long int next_tile, const string &status_dir ) {
-    // cout << "new process started to handle new connection for "
-    //      << next_tile << endl;
 
-    // Read client's message (which is the status of the
-    // last scenery creation task.)
-    char buf[MAXBUF];
-    int length;
-    if ( (length = recv(msgsock, buf, MAXBUF, 0)) < 0) {
-        perror("Cannot read command");
-        exit(-1);
-    }
-    buf[length] = '\0';
-    long int returned_tile = atoi(buf);
-    cout << "client returned = " << returned_tile << endl;
-
-    // record status
-    if ( returned_tile < 0 ) {
-	// failure
-	log_failed_tile( status_dir, -returned_tile );
-	log_finished_tile( status_dir, -returned_tile );
+// lease up to max tiles to a client - the most expensive ones of those
+// with no neighbour being built.  Only the neighbours of leased tiles are
+// locked, so few pending tiles are passed over.
+static void lease_tiles( int sock, int max, time_t now,
+			 std::vector<long>& leased ) {
+    Client& client = clients[sock];
+    pending_set::iterator next = pending.begin();
+
+    while ( (int)leased.size() < max && next != pending.end() ) {
+	long tile = next->second;
+	++next;
+
+	TileState& state = tiles[tile];
+	if ( state.locks ) {
+	    continue;
+	}
+
+	// may lock the next candidates, but erases only this one
+	set_status( tile, state, TILE_LEASED );
+	state.client = sock;
+	state.expires = now + lease_time;
+	state.attempts++;
+	client.leased.insert( tile );
+	leased.push_back( tile );
+
+	std::ostringstream event;
+	event << "lease " << tile << " " << client.name;
+	journal_record( event.str() );
+    }
+}
+
+
+// take a lease back - the tile is pending again, unless it has been
+// lost too often
+static void release_tile( long tile, const string& why ) {
+    TileState& state = tiles[tile];
+    Client& client = clients[state.client];
+
+    client.leased.erase( tile );
+
+    std::ostringstream event;
+    event << why << " " << tile << " " << client.name;
+    journal_record( event.str() );
+
+    state.client = -1;
+    if ( state.attempts >= max_attempts ) {
+	cout << "Tile " << tile << " lost " << state.attempts
+	     << " leases, giving up" << endl;
+	set_status( tile, state, TILE_FAILED );
+
+	std::ostringstream failed;
+	failed << "result " << tile << " failed 0 0 " << client.name;
+	journal_record( failed.str() );
     } else {
-	// success
-	log_finished_tile( status_dir, returned_tile );
+	set_status( tile, state, TILE_PENDING );
     }
+}
+
+
+static void renew_leases( int sock, time_t now ) {
+    Client& client = clients[sock];
 
-    // reply to the client
-    char message[MAXBUF];
-    sprintf(message, "%ld", next_tile);
-    length = strlen(message);
-    if ( send(msgsock, message, length, 0) < 0 ) {
-	perror("Cannot write to stream socket");
+    for ( std::set<long>::iterator it = client.leased.begin();
+	  it != client.leased.end(); ++it ) {
+	tiles[*it].expires = now + lease_time;
     }
-#ifdef _MSC_VER
-    closesocket(msgsock);
-#else
-    close(msgsock);
-#endif
-    // cout << "process for " << next_tile << " ended" << endl;
 }
 
-#ifdef _MSC_VER
 
-struct Parameters {
-    int msgsock;
-    long next_tile;
-    string status_dir;
-};
+static void expire_leases( time_t now ) {
+    std::vector<long> expired;
+
+    for ( std::map<int, Client>::iterator c = clients.begin();
+	  c != clients.end(); ++c ) {
+	for ( std::set<long>::iterator it = c->second.leased.begin();
+	      it != c->second.leased.end(); ++it ) {
+	    if ( tiles[*it].expires < now ) {
+		expired.push_back( *it );
+	    }
+	}
+    }
+
+    for ( unsigned int i = 0; i < expired.size(); i++ ) {
+	cout << "Lease of tile " << expired[i] << " expired" << endl;
+	release_tile( expired[i], "expire" );
+    }
+}
+
+
+static void record_result( int sock, long tile, const string& status,
+			   double seconds, long bytes ) {
+    std::map<long, TileState>::iterator it = tiles.find( tile );
+    if ( it == tiles.end() ) {
+	cout << "Result for unknown tile " << tile << endl;
+	return;
+    }
+
+    TileState& state = it->second;
+    if ( state.status == TILE_DONE ) {
+	// a late result for a tile that was re-leased and finished
+	return;
+    }
+
+    // the lease may have expired and moved on to another client, which
+    // is still building the tile and holds its neighbours
+    if ( state.status == TILE_LEASED ) {
+	if ( state.client != sock ) {
+	    cout << "Ignoring stale result for tile " << tile << " from "
+		 << clients[sock].name << ", now leased to "
+		 << clients[state.client].name << endl;
+	    return;
+	}
+	clients[sock].leased.erase( tile );
+    }
+    state.client = -1;
 
-DWORD WINAPI
-ThreadProc(void* p)
-{
-    DWORD pN1;
-    ULONG_PTR pN2;
-    OVERLAPPED*	pOverLapped;
+    if ( status == "failed" ) {
+	set_status( tile, state, TILE_FAILED );
+	cout << "logged bad tile = " << tile << endl;
+    } else {
+	set_status( tile, state, TILE_DONE );
+    }
 
-    while( GetQueuedCompletionStatus(gIoPort, &pN1, &pN2, &pOverLapped, INFINITE)) {
-	if (pOverLapped == (OVERLAPPED*)0xFFFFFFFF)
-		break;
+    std::ostringstream event;
+    event << "result " << tile << " " << status << " " << seconds
+	  << " " << bytes << " " << clients[sock].name;
+    journal_record( event.str() );
+
+    results_this_run++;
+    time_t elapsed = time(NULL) - start_time;
+
+    cout << "Tile " << SGBucket(tile) << " " << status << " in "
+	 << seconds << "s, " << bytes << " bytes ("
+	 << clients[sock].name << ")" << endl;
+    cout << "  " << status_count[TILE_DONE] << " done, "
+	 << status_count[TILE_FAILED] << " failed, "
+	 << status_count[TILE_LEASED] << " leased, "
+	 << status_count[TILE_PENDING] << " pending";
+    if ( elapsed > 0 ) {
+	cout << ", " << (double)results_this_run * 3600.0 / (double)elapsed
+	     << " tiles per hour";
+    }
+    cout << endl;
+}
 
-	Parameters *p = (Parameters*)pN1;
 
-	if ( p ) {
-	    alloc_new_tile( p->msgsock, p->next_tile, p->status_dir );
-	    delete p;
+// handle one request line of a client, return the reply
+//
+//   HELLO <name>                         -> OK <lease time> <max batch>
+//   LEASE <count>                        -> TILES <tile> ... | WAIT <s> | DONE
+//   HEARTBEAT                            -> OK
+//   RESULT <tile> <status> <s> <bytes>   -> OK
+//
+// Any request renews the client's leases.
+static string handle_request( int sock, const string& line, time_t now ) {
+    std::istringstream in( line );
+    std::ostringstream reply;
+    string command;
+
+    in >> command;
+    renew_leases( sock, now );
+
+    if ( command == "HELLO" ) {
+	in >> clients[sock].name;
+	cout << "Client " << clients[sock].name << " connected" << endl;
+	reply << "OK " << lease_time << " " << max_batch;
+    } else if ( command == "LEASE" ) {
+	int count = 1;
+	in >> count;
+	count = std::max( 1, std::min( count, max_batch ) );
+
+	std::vector<long> leased;
+	lease_tiles( sock, count, now, leased );
+
+	if ( leased.size() ) {
+	    reply << "TILES";
+	    for ( unsigned int i = 0; i < leased.size(); i++ ) {
+		reply << " " << leased[i];
+	    }
+	} else if ( status_count[TILE_LEASED] ) {
+	    // waiting for neighbours to finish, or for running leases
+	    // that may still come back
+	    reply << "WAIT 10";
+	} else {
+	    reply << "DONE";
 	}
+    } else if ( command == "HEARTBEAT" ) {
+	reply << "OK";
+    } else if ( command == "RESULT" ) {
+	long tile = 0, bytes = 0;
+	double seconds = 0.0;
+	string status;
+
+	if ( in >> tile >> status >> seconds >> bytes ) {
+	    record_result( sock, tile, status, seconds, bytes );
+	    reply << "OK";
+	} else {
+	    reply << "ERROR bad result";
+	}
+    } else {
+	reply << "ERROR unknown command " << command;
     }
-    return 1;
+
+    reply << "\n";
+    return reply.str();
 }
 
-#endif
+
+// a client went away - its tiles are handed out again
+static void drop_client( int sock ) {
+    Client& client = clients[sock];
+    cout << "Client " << client.name << " disconnected" << endl;
+
+    std::vector<long> leased( client.leased.begin(), client.leased.end() );
+    for ( unsigned int i = 0; i < leased.size(); i++ ) {
+	release_tile( leased[i], "release" );
+    }
+
+    close_socket( sock );
+    clients.erase( sock );
+}
+
+
+// read from a client and answer all its complete requests
+static void serve_client( int sock, time_t now ) {
+    char buf[MAXBUF];
+    int length = recv(sock, buf, MAXBUF, 0);
+
+    if ( length <= 0 ) {
+	drop_client( sock );
+	return;
+    }
+
+    Client& client = clients[sock];
+    client.input.append( buf, length );
+
+    string::size_type eol;
+    while ( (eol = client.input.find( '\n' )) != string::npos ) {
+	string line = client.input.substr( 0, eol );
+	client.input.erase( 0, eol + 1 );
+
+	string reply = handle_request( sock, line, now );
+	if ( send(sock, reply.c_str(), reply.length(), 0) < 0 ) {
+	    perror("Cannot write to stream socket");
+	    drop_client( sock );
+	    return;
+	}
+    }
+
+    if ( client.input.length() > MAXBUF ) {
+	cout << "Client " << client.name << " sent garbage" << endl;
+	drop_client( sock );
+    }
+}
 
 
 int main( int argc, char **argv ) {
     int arg_counter;
-    long int next_tile;
     int sock, msgsock;
     fd_set ready;
     short unsigned int port;
 
-#ifdef _MSC_VER
-    gIoPort = CreateIoCompletionPort((HANDLE)INVALID_HANDLE_VALUE, NULL, 0, 0);
-
-    for (int n = 0; n < numWorkerThreads; ++n) {
-	DWORD id;
-	gWorkerThreads[n] = CreateThread(NULL, 0, ThreadProc, gIoPort, 0, &id);
-    }
+#ifndef _MSC_VER
+    // a client that went away must not take the server with it
+    signal( SIGPIPE, SIG_IGN );
 #endif
+
 				// Get any options first
     int arg_offset = 0;
     for (int i = 1; i < argc; i++) {
@@ -408,6 +726,15 @@ int main( int argc, char **argv ) {
       } else if (opt.find("--height=") == 0) {
 	area_height = atof(opt.substr(9).c_str());
 	arg_offset++;
+      } else if (opt.find("--lease-time=") == 0) {
+	lease_time = atoi(opt.substr(13).c_str());
+	arg_offset++;
+      } else if (opt.find("--batch=") == 0) {
+	max_batch = atoi(opt.substr(8).c_str());
+	arg_offset++;
+      } else if (opt.find("--attempts=") == 0) {
+	max_attempts = atoi(opt.substr(11).c_str());
+	arg_offset++;
       } else if (opt == "--") {
 	break;
       } else if (opt.find("-") == 0) {
@@ -428,18 +755,20 @@ int main( int argc, char **argv ) {
     cout << "Output base: " << output_base << endl;
     cout << "Area width: " << area_width << " degrees" << endl;
     cout << "Area height: " << area_height << " degrees" << endl;
+    cout << "Lease time: " << lease_time << " seconds" << endl;
+    cout << "Lease batch: " << max_batch << " tiles" << endl;
 
-    arg_counter = arg_offset + 3;
-
-    // initialize tile counter / incrementer
-    init_tile_count( argv[arg_counter++] );
+    // build the work list, chunk by chunk
+    for ( arg_counter = arg_offset + 3; arg_counter < argc; arg_counter++ ) {
+	std::vector<long> chunk_tiles;
+	get_chunk_tiles( argv[arg_counter], chunk_tiles );
 
-    // temp test
-    // while ( (next_tile = get_next_tile()) != -1 ) {
-    //     cout << next_tile << " " << SGBucket(next_tile) << endl;
-    // }
-    // cout << "done" << endl;
-    // exit(0);
+	for ( unsigned int i = 0; i < chunk_tiles.size(); i++ ) {
+	    add_tile( chunk_tiles[i] );
+	}
+    }
+    cout << "Work list has " << tiles.size() << " tiles" << endl;
+    estimate_costs( work_base );
 
     // create the status directory
     string status_dir = work_base + "/Status";
@@ -447,6 +776,17 @@ int main( int argc, char **argv ) {
     sgp.append( "dummy" );
     sgp.create_dir( 0755 );
 
+    // pick up where an earlier run left off, then keep appending
+    string journal_file = status_dir + "/tiles.journal";
+    replay_journal( journal_file );
+    queue_tiles();
+    journal = fopen( journal_file.c_str(), "a" );
+    if ( journal == NULL ) {
+	perror( journal_file.c_str() );
+	exit(-1);
+    }
+    start_time = time(NULL);
+
     // setup socket to listen on
     sock = make_socket( &port );
     cout << "socket is connected to port = " << port << endl;
@@ -454,72 +794,59 @@ int main( int argc, char **argv ) {
     // Specify the maximum length of the connection queue
     listen(sock, 10);
 
-    for ( ;; ) {
+    // serve until all tiles are finished and every client has gone
+    while ( status_count[TILE_PENDING] || status_count[TILE_LEASED] ||
+	    !clients.empty() ) {
 	FD_ZERO(&ready);
 	FD_SET(sock, &ready);
 
-	// block until we get some input on sock
-	select(sock+1, &ready, 0, 0, NULL);
-
-	if ( FD_ISSET(sock, &ready) ) {
-	    // printf("%d %d Incomming message --> ", getpid(), pid);
+	int max_sock = sock;
+	for ( std::map<int, Client>::iterator c = clients.begin();
+	      c != clients.end(); ++c ) {
+	    FD_SET(c->first, &ready);
+	    max_sock = std::max( max_sock, c->first );
+	}
 
-	    // get the next tile to work on
-	    next_tile = get_next_tile();
+	// wake up now and then to expire leases
+	struct timeval timeout;
+	timeout.tv_sec = 1;
+	timeout.tv_usec = 0;
 
-	    if ( next_tile == -1 ) {
-		// end of chunk see if there are more chunks
-		if ( arg_counter < argc ) {
-		    // still more chunks to process
-		    init_tile_count( argv[arg_counter++] );
-		    next_tile = get_next_tile();
-		}
-	    }
+	if ( select(max_sock+1, &ready, 0, 0, &timeout) < 0 ) {
+	    perror("select");
+	    continue;
+	}
 
-	    cout << "Bucket = " << SGBucket(next_tile)
-		 << " (" << pass << ")" << endl;
+	time_t now = time(NULL);
 
-	    log_pending_tile( status_dir, next_tile );
-	    // cout << "next tile = " << next_tile << endl;;
+	std::vector<int> active;
+	for ( std::map<int, Client>::iterator c = clients.begin();
+	      c != clients.end(); ++c ) {
+	    if ( FD_ISSET(c->first, &ready) ) {
+		active.push_back( c->first );
+	    }
+	}
+	for ( unsigned int i = 0; i < active.size(); i++ ) {
+	    if ( clients.find( active[i] ) != clients.end() ) {
+		serve_client( active[i], now );
+	    }
+	}
 
+	if ( FD_ISSET(sock, &ready) ) {
 	    msgsock = accept(sock, 0, 0);
-	    // cout << "msgsock = " << msgsock << endl;
-
-#ifndef _MSC_VER
-	    // spawn a child
-	    int pid = fork();
-
-	    if ( pid < 0 ) {
-		// error
-		perror("Cannot fork child process");
-		exit(-1);
-	    } else if ( pid > 0 ) {
-		// This is the parent
-		close(msgsock);
-
-		// clean up all of our zombie children
-		int status;
-		while ( (pid = waitpid( WAIT_ANY, &status, WNOHANG )) > 0 ) {
-		    // cout << "waitpid(): pid = " << pid
-		    //      << " status = " << status << endl;
-		}
-	    } else {
-		// This is the child
-		close(sock);
+	    if ( msgsock >= 0 ) {
+		clients[msgsock].name = "unknown";
+	    }
+	}
 
-		alloc_new_tile( msgsock, next_tile, status_dir );
+	expire_leases( now );
+    }
 
-		exit(0);
-	    }
-#else
+    cout << "All tiles finished: " << status_count[TILE_DONE] << " done, "
+	 << status_count[TILE_FAILED] << " failed" << endl;
 
-	    Parameters *p = new Parameters;
-	    p->msgsock = msgsock;
-	    p->next_tile = next_tile;
-	    p->status_dir = status_dir;
-	    PostQueuedCompletionStatus(gIoPort, (DWORD)p, 0, NULL);
+    fclose( journal );
+    close_socket( sock );
 
-#endif
-	}
-    }
+    return 0;
 }
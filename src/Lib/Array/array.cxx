@@ -23,6 +23,8 @@
 #  include <config.h>
 #endif
 
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
 
 #include <simgear/compiler.h>
@@ -36,6 +38,9 @@
 
 using std::string;
 
+// first word of a binary fitted node file, 'TGFT'
+#define TG_FITTED_MAGIC     (0x54474654)
+
 
 TGArray::TGArray( void ):
   array_in(NULL),
@@ -67,15 +72,13 @@ bool TGArray::open( const string& file_base ) {
 
     // open fitted data file
     string fitted_name = file_base + ".fit.gz";
-    fitted_in = new sg_gzifstream( fitted_name );
-    if ( !fitted_in->is_open() ) {
+    fitted_in = gzopen( fitted_name.c_str(), "rb" );
+    if ( fitted_in == NULL ) {
         // not having a .fit file is unfortunate, but not fatal.  We
         // can do a really stupid/crude fit on the fly, but it will
         // not be nearly as nice as what the offline terrafit utility
         // would have produced.
         SG_LOG(SG_GENERAL, SG_DEBUG, "  Cannot open " << fitted_name );
-        delete fitted_in;
-        fitted_in = NULL;
     } else {
         SG_LOG(SG_GENERAL, SG_DEBUG, "  Opening fitted data file: " << fitted_name );
     }
@@ -93,8 +96,7 @@ TGArray::close() {
     }
 
     if (fitted_in ) {
-        fitted_in->close();
-        delete fitted_in;
+        gzclose(fitted_in);
         fitted_in = NULL;
     }
 
@@ -109,8 +111,7 @@ TGArray::unload( void ) {
     }
 
     if (fitted_in ) {
-        fitted_in->close();
-        delete fitted_in;
+        gzclose(fitted_in);
         fitted_in = NULL;
     }
 
@@ -157,21 +158,83 @@ TGArray::parse( SGBucket& b ) {
     }
 
     // Parse/load the fitted data file
-    if ( fitted_in && fitted_in->is_open() ) {
-        int fitted_size;
-        double x, y, z;
-        *fitted_in >> fitted_size;
-        for ( int i = 0; i < fitted_size; ++i ) {
-            *fitted_in >> x >> y >> z;
-            fitted_list.push_back( SGGeod::fromDegM(x, y, z) );
-			printf("***************** fitted node: %f %f %f\n",x,y,z);
-            SG_LOG(SG_GENERAL, SG_DEBUG, " loading fitted = " << SGGeod::fromDegM(x, y, z) );
+    if ( fitted_in ) {
+        int magic = 0;
+        sgReadInt(fitted_in, &magic);
+
+        if ( magic == TG_FITTED_MAGIC ) {
+            parse_fitted_bin();
+        } else {
+            // older text format
+            gzrewind(fitted_in);
+            parse_fitted_text();
         }
     }
 
     return true;
 }
 
+// binary fitted nodes : grid origin and steps, then (col, row, elev)
+// triplets of shorts.  col and row are unsigned, so a full resolution
+// degree of 43200 columns still fits.  Positions are computed the same
+// way terrafit computes them for the text file.
+void TGArray::parse_fitted_bin()
+{
+    double fit_originx, fit_originy, fit_col_step, fit_row_step;
+    int    fitted_size;
+
+    sgClearReadError();
+    sgReadDouble(fitted_in, &fit_originx);
+    sgReadDouble(fitted_in, &fit_originy);
+    sgReadDouble(fitted_in, &fit_col_step);
+    sgReadDouble(fitted_in, &fit_row_step);
+    sgReadInt(fitted_in, &fitted_size);
+    if ( sgReadError() || fitted_size < 0 ) {
+        SG_LOG(SG_GENERAL, SG_ALERT, "Bad fitted node file header");
+        return;
+    }
+
+    std::vector<short> nodes( 3 * fitted_size );
+    if ( fitted_size ) {
+        sgReadShort(fitted_in, nodes.size(), &nodes[0]);
+    }
+    if ( sgReadError() ) {
+        SG_LOG(SG_GENERAL, SG_ALERT, "Truncated fitted node file");
+        return;
+    }
+
+    fitted_list.reserve( fitted_list.size() + fitted_size );
+    for ( int i = 0; i < fitted_size; ++i ) {
+        double x = ( fit_originx + (unsigned short)nodes[3*i]   * fit_col_step ) / 3600.0;
+        double y = ( fit_originy + (unsigned short)nodes[3*i+1] * fit_row_step ) / 3600.0;
+
+        fitted_list.push_back( SGGeod::fromDegM(x, y, nodes[3*i+2]) );
+    }
+}
+
+void TGArray::parse_fitted_text()
+{
+    char   line[256];
+    int    fitted_size = 0;
+    double x, y, z;
+
+    if ( gzgets(fitted_in, line, sizeof(line)) == NULL ) {
+        return;
+    }
+    fitted_size = atoi( line );
+
+    fitted_list.reserve( fitted_list.size() + fitted_size );
+    for ( int i = 0; i < fitted_size; ++i ) {
+        if ( gzgets(fitted_in, line, sizeof(line)) == NULL ||
+             sscanf(line, "%lf %lf %lf", &x, &y, &z) != 3 ) {
+            SG_LOG(SG_GENERAL, SG_ALERT, "Truncated fitted node file");
+            break;
+        }
+        fitted_list.push_back( SGGeod::fromDegM(x, y, z) );
+        SG_LOG(SG_GENERAL, SG_DEBUG, " loading fitted = " << SGGeod::fromDegM(x, y, z) );
+    }
+}
+
 void TGArray::parse_bin()
 {
     int32_t header;
@@ -239,6 +302,61 @@ bool TGArray::write( const string root_dir, SGBucket& b ) {
     return true;
 }
 
+// write a fitted node file
+bool TGArray::write_fitted( const string& file, const std::vector<SGVec2i>& nodes,
+                            bool text, int level ) const
+{
+    char mode[8];
+    snprintf( mode, sizeof(mode), "wb%d", level );
+
+    gzFile fp;
+    if ( (fp = gzopen( file.c_str(), mode )) == NULL ) {
+        SG_LOG(SG_GENERAL, SG_ALERT, "ERROR:  cannot open " << file << " for writing!" );
+        return false;
+    }
+
+    // binary grid indices are unsigned shorts
+    if ( !text && ( cols > 65536 || rows > 65536 ) ) {
+        SG_LOG(SG_GENERAL, SG_INFO, "Array of " << cols << "x" << rows << " too large for binary fitted nodes, writing text" );
+        text = true;
+    }
+
+    if ( text ) {
+        gzprintf( fp, "%d\n", (int)nodes.size() );
+        for ( unsigned int i = 0; i < nodes.size(); ++i ) {
+            double x = ( originx + nodes[i].x() * col_step ) / 3600.0;
+            double y = ( originy + nodes[i].y() * row_step ) / 3600.0;
+            double z = get_array_elev( nodes[i].x(), nodes[i].y() );
+
+            gzprintf( fp, "%+03.8f %+02.8f %0.2f\n", x, y, z );
+        }
+    } else {
+        std::vector<short> data( 3 * nodes.size() );
+        for ( unsigned int i = 0; i < nodes.size(); ++i ) {
+            data[3*i]   = (unsigned short)nodes[i].x();
+            data[3*i+1] = (unsigned short)nodes[i].y();
+            data[3*i+2] = get_array_elev( nodes[i].x(), nodes[i].y() );
+        }
+
+        sgWriteInt( fp, TG_FITTED_MAGIC );
+        sgWriteDouble( fp, originx );
+        sgWriteDouble( fp, originy );
+        sgWriteDouble( fp, col_step );
+        sgWriteDouble( fp, row_step );
+        sgWriteInt( fp, nodes.size() );
+        if ( !data.empty() ) {
+            sgWriteShort( fp, data.size(), &data[0] );
+        }
+    }
+
+    if ( gzclose(fp) != Z_OK ) {
+        SG_LOG(SG_GENERAL, SG_ALERT, "ERROR:  failed writing " << file );
+        return false;
+    }
+
+    return true;
+}
+
 
 // do our best to remove voids by picking data from the nearest neighbor.
 void TGArray::remove_voids( ) {
@@ -474,8 +592,7 @@ TGArray::~TGArray( void )
     }
 
     if (fitted_in ) {
-        fitted_in->close();
-        delete fitted_in;
+        gzclose(fitted_in);
         fitted_in = NULL;
     }
 }
@@ -26,6 +26,7 @@
 #include <simgear/compiler.h>
 #include <simgear/bucket/newbucket.hxx>
 #include <simgear/math/sg_types.hxx>
+#include <simgear/math/SGMath.hxx>
 #include <simgear/misc/sgstream.hxx>
 
 class TGArray {
@@ -34,7 +35,7 @@ private:
     gzFile array_in;
 
     // fitted file pointer
-    sg_gzifstream *fitted_in;
+    gzFile fitted_in;
 
     // coordinates (in arc seconds) of south west corner
     double originx, originy;
@@ -53,6 +54,8 @@ private:
     std::vector<SGGeod> fitted_list;
 
     void parse_bin();
+    void parse_fitted_bin();
+    void parse_fitted_text();
 public:
 
     // Constructor
@@ -77,6 +80,12 @@ public:
     // write an Array file
     bool write( const std::string root_dir, SGBucket& b );
 
+    // write a fitted node file (.fit.gz) for the given grid points.  The
+    // default binary form stores the grid indices and elevation of each
+    // node, text writes the original "lon lat elev" list
+    bool write_fitted( const std::string& file, const std::vector<SGVec2i>& nodes,
+                       bool text = false, int level = 6 ) const;
+
     // do our best to remove voids by picking data from the nearest
     // neighbor.
     void remove_voids();
@@ -46,8 +46,15 @@
 
 #include <boost/foreach.hpp>
 
+#include <vector>
+
 #include "hgt.hxx"
 
+#if defined(__SSE2__) || defined(_M_X64) || ( defined(_M_IX86_FP) && _M_IX86_FP >= 2 )
+#  include <emmintrin.h>
+#  define HGT_SSE2
+#endif
+
 using std::cout;
 using std::endl;
 using std::string;
@@ -58,7 +65,6 @@ TGHgt::TGHgt( int _res )
     hgt_resolution = _res;
 
     data = new short int[MAX_HGT_SIZE][MAX_HGT_SIZE];
-    output_data = new short int[MAX_HGT_SIZE][MAX_HGT_SIZE];
 }
 
 
@@ -66,7 +72,6 @@ TGHgt::TGHgt( int _res, const SGPath &file )
 {
     hgt_resolution = _res;
     data = new short int[MAX_HGT_SIZE][MAX_HGT_SIZE];
-    output_data = new short int[MAX_HGT_SIZE][MAX_HGT_SIZE];
 
     TGHgt::open( file );
 }
@@ -160,16 +165,23 @@ TGHgt::load( ) {
         return false;
     }
 
-    short int *var;
-    for ( int row = size - 1; row >= 0; --row ) {
+    // read the whole file at once - rows are stored north to south
+    std::vector<unsigned short> raw( size * size );
+    int bytes = size * size * sizeof(short);
+
+    if ( gzread( fd, &raw[0], bytes ) != bytes ) {
+        return false;
+    }
+
+    // samples are big endian
+    if ( sgIsLittleEndian() ) {
+        swap_samples( &raw[0], raw.size() );
+    }
+
+    for ( int row = 0; row < size; ++row ) {
+        const short int* src = (const short int*)&raw[(size - 1 - row) * size];
         for ( int col = 0; col < size; ++col ) {
-            var = &data[col][row];
-            if ( gzread ( fd, var, sizeof(short) ) != sizeof(short) ) {
-                return false;
-            }
-            if ( sgIsLittleEndian() ) {
-                sgEndianSwap( (unsigned short int*)var);
-            }
+            data[col][row] = src[col];
         }
     }
 
@@ -177,9 +189,26 @@ TGHgt::load( ) {
 }
 
 
+void
+TGHgt::swap_samples( unsigned short* samples, unsigned int count ) {
+    unsigned int i = 0;
+
+#ifdef HGT_SSE2
+    for ( ; i + 8 <= count; i += 8 ) {
+        __m128i v = _mm_loadu_si128( (const __m128i*)(samples + i) );
+        v = _mm_or_si128( _mm_slli_epi16( v, 8 ), _mm_srli_epi16( v, 8 ) );
+        _mm_storeu_si128( (__m128i*)(samples + i), v );
+    }
+#endif
+
+    for ( ; i < count; ++i ) {
+        samples[i] = (unsigned short)( (samples[i] << 8) | (samples[i] >> 8) );
+    }
+}
+
+
 
 TGHgt::~TGHgt() {
     // printf("class TGSrtmBase DEstructor called.\n");
     delete [] data;
-    delete [] output_data;
 }
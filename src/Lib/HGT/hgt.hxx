@@ -53,7 +53,9 @@ private:
     
     // pointers to the actual grid data allocated here
     short int (*data)[MAX_HGT_SIZE];
-    short int (*output_data)[MAX_HGT_SIZE];
+
+    // byte swap a block of samples
+    static void swap_samples( unsigned short* samples, unsigned int count );
 
 public:
 
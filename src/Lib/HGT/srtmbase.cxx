@@ -26,11 +26,19 @@
 #endif
 
 #include <iostream>
+#include <stdio.h>
 #include <stdlib.h>
 #include <zlib.h>
 
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
 #include <simgear/compiler.h>
 #include <simgear/io/lowlevel.hxx>
+#include <simgear/threads/SGThread.hxx>
+#include <simgear/threads/SGGuard.hxx>
 
 #include "srtmbase.hxx"
 
@@ -110,8 +118,11 @@ bool TGSrtmBase::write_area_bin(const SGPath& aPath, int start_x, int start_y,
     int min_x, int min_y,
     int span_x, int span_y, int col_step, int row_step)
 {
+    char mode[8];
+    sprintf( mode, "wb%d", compression_level );
+
     gzFile fp;
-    if ( (fp = gzopen( aPath.c_str(), "wb9" )) == NULL ) {
+    if ( (fp = gzopen( aPath.c_str(), mode )) == NULL ) {
 	    cout << "ERROR:  cannot open " << aPath.str() << " for writing!" << endl;
 	    return false;
     }
@@ -122,22 +133,116 @@ bool TGSrtmBase::write_area_bin(const SGPath& aPath, int start_x, int start_y,
     sgWriteInt(fp, span_x + 1); sgWriteInt(fp, col_step);
     sgWriteInt(fp, span_y + 1); sgWriteInt(fp, row_step);
 
+    // gather the samples, column by column, and write them in one go
+    std::vector<short> samples;
+    samples.reserve( (span_x + 1) * (span_y + 1) );
+
     for ( int i = start_x; i <= start_x + span_x; ++i ) {
 	    for ( int j = start_y; j <= start_y + span_y; ++j ) {
-            sgWriteShort(fp, height(i,j));
+            samples.push_back( height(i,j) );
 	    }
     }
 
+    // arrays are little endian, as written by sgWriteShort()
+    if ( !sgIsLittleEndian() ) {
+        for ( unsigned int i = 0; i < samples.size(); ++i ) {
+            sgEndianSwap( (unsigned short int*)&samples[i] );
+        }
+    }
+
+    gzwrite( fp, &samples[0], samples.size() * sizeof(short) );
+
     gzclose(fp);
     return true;
 }
 
+// buckets shared out to the write_areas() threads
+struct TGSrtmAreaJob {
+    TGSrtmBase*             srtm;
+    std::string             root;
+    std::vector<SGBucket>   buckets;
+    unsigned int            next;
+    int                     written;
+    SGMutex                 lock;
+};
+
+static void write_areas_thread( TGSrtmAreaJob* job )
+{
+    while ( true ) {
+        SGBucket b;
+        {
+            SGGuard<SGMutex> g(job->lock);
+            if ( job->next >= job->buckets.size() ) {
+                break;
+            }
+            b = job->buckets[job->next++];
+        }
+
+        if ( job->srtm->write_area( job->root, b ) ) {
+            SGGuard<SGMutex> g(job->lock);
+            job->written++;
+        }
+    }
+}
+
+int
+TGSrtmBase::write_areas( const string& root, int max_span, unsigned int threads ) {
+    TGSrtmAreaJob job;
+    job.srtm    = this;
+    job.root    = root;
+    job.next    = 0;
+    job.written = 0;
+
+    SGVec2d min, max;
+    min.x() = originx / 3600.0 + SG_HALF_BUCKET_SPAN;
+    min.y() = originy / 3600.0 + SG_HALF_BUCKET_SPAN;
+    SGBucket b_min( min.x(), min.y() );
+
+    max.x() = (originx + cols * col_step) / 3600.0 - SG_HALF_BUCKET_SPAN;
+    max.y() = (originy + rows * row_step) / 3600.0 - SG_HALF_BUCKET_SPAN;
+    SGBucket b_max( max.x(), max.y() );
+
+    if ( b_min == b_max ) {
+        job.buckets.push_back( b_min );
+    } else {
+        int dx, dy, i, j;
+
+        sgBucketDiff(b_min, b_max, &dx, &dy);
+        cout << "HGT file spans tile boundaries (ok)" << endl;
+        cout << "  dx = " << dx << "  dy = " << dy << endl;
+
+        if ( (dx > max_span) || (dy > max_span) ) {
+            cout << "somethings really wrong!!!!" << endl;
+            exit(-1);
+        }
+
+        for ( j = 0; j <= dy; j++ ) {
+            for ( i = 0; i <= dx; i++ ) {
+                job.buckets.push_back( sgBucketOffset(min.x(), min.y(), i, j) );
+            }
+        }
+    }
+
+    if ( threads <= 1 ) {
+        write_areas_thread( &job );
+    } else {
+        boost::thread_group group;
+        for ( unsigned int t = 0; t < threads && t < job.buckets.size(); t++ ) {
+            group.create_thread( boost::bind( write_areas_thread, &job ) );
+        }
+        group.join_all();
+    }
+
+    return job.written;
+}
+
 bool
 TGSrtmBase::has_non_zero_elev (int start_x, int span_x,
                           int start_y, int span_y) const
 {
-    for ( int row = start_y; row < start_y + span_y; row++ ) {
-        for ( int col = start_x; col < start_x + span_x; col++ ) {
+    // columns are contiguous in memory
+    for ( int col = start_x; col < start_x + span_x; col++ ) {
+        for ( int row = start_y; row < start_y + span_y; row++ ) {
             if ( height(col,row) != 0 )
                 return true;
         }
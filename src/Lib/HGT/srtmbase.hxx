@@ -36,7 +36,7 @@
 class TGSrtmBase {
 
 protected:
-    TGSrtmBase() : remove_tmp_file(false)
+    TGSrtmBase() : remove_tmp_file(false), compression_level(9)
     {}
 
     ~TGSrtmBase();
@@ -53,6 +53,9 @@ protected:
     bool remove_tmp_file;
     simgear::Dir tmp_dir;
 
+    // gzip level of the .arr.gz output
+    int compression_level;
+
 public:
 
     // write out the area of data covered by the specified bucket.
@@ -64,6 +67,12 @@ public:
         int start_x, int start_y, int min_x, int min_y,
     int span_x, int span_y, int col_step, int row_step);
 
+    // write out every bucket covered by the data, on up to the given
+    // number of threads.  Returns the number of buckets written
+    int write_areas( const std::string& root, int max_span, unsigned int threads = 1 );
+
+    inline void set_compression_level( int level ) { compression_level = level; }
+
     // Informational methods
     inline double get_originx() const { return originx; }
     inline double get_originy() const { return originy; }
@@ -6,13 +6,36 @@
 
 #include <simgear/compiler.h>
 #include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 
+#ifdef _WIN32
+#  include <windows.h>
+#else
+#  include <sys/types.h>
+#  include <sys/stat.h>
+#  include <sys/mman.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
 
 #include "landcover.hxx"
 
-using std::ifstream;
 using std::string;
 
+static void fail (const string &message)
+{
+#ifdef _MSC_VER
+    // there are no try or catch statements to support
+    // the throw-expression except in test-landcover.cxx
+    printf( "%s\n", message.c_str() );
+    exit( 1 );
+#else
+    throw message;
+#endif
+}
+
 LandCover::LandCover( const string &filename )
 {
     // MSVC chokes when these are defined and initialized as "static
@@ -20,23 +43,59 @@ LandCover::LandCover( const string &filename )
     WIDTH = 43200;
     HEIGHT = 21600;
 
-    _input = new ifstream(filename.c_str());
-    if (!_input->good())  {
-#ifdef _MSC_VER
-	// there are no try or catch statements to support
-	// the throw-expression except in test-landcover.cxx
-	printf( "Failed to open %s\n", filename.c_str() );
-	exit( 1 );
+    _data = NULL;
+    _size = 0;
+
+#ifdef _WIN32
+    _mapping = NULL;
+    _file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                        OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+    if (_file == INVALID_HANDLE_VALUE)
+        fail(string("Failed to open ") + filename);
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx((HANDLE)_file, &size))
+        fail(string("Failed to stat ") + filename);
+    _size = (size_t)size.QuadPart;
+
+    _mapping = CreateFileMappingA((HANDLE)_file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (_mapping != NULL)
+        _data = (const unsigned char *)MapViewOfFile((HANDLE)_mapping, FILE_MAP_READ, 0, 0, 0);
 #else
-	throw (string("Failed to open ") + filename);
-#endif
+    _fd = open(filename.c_str(), O_RDONLY);
+    if (_fd < 0)
+        fail(string("Failed to open ") + filename);
+
+    struct stat buf;
+    if (fstat(_fd, &buf) != 0)
+        fail(string("Failed to stat ") + filename);
+    _size = (size_t)buf.st_size;
+
+    void * data = mmap(NULL, _size, PROT_READ, MAP_SHARED, _fd, 0);
+    if (data != MAP_FAILED) {
+        _data = (const unsigned char *)data;
+        // queries for a tile touch a few rows spread over the file
+        madvise(data, _size, MADV_RANDOM);
     }
+#endif
+
+    if (_data == NULL)
+        fail(string("Failed to map ") + filename);
 }
 
 LandCover::~LandCover ()
 {
-  _input->close();
-  delete _input;
+#ifdef _WIN32
+  if (_data)
+    UnmapViewOfFile(_data);
+  if (_mapping)
+    CloseHandle((HANDLE)_mapping);
+  CloseHandle((HANDLE)_file);
+#else
+  if (_data)
+    munmap((void *)_data, _size);
+  close(_fd);
+#endif
 }
 
 int
@@ -45,14 +104,10 @@ LandCover::getValue (long x, long y) const
   if (x < 0 || x >= WIDTH || y < 0 || y >= HEIGHT)
     return -1;			// TODO: exception
 
-  long offset = x + (y * WIDTH);
-  _input->seekg(offset);
-  if (!_input->good())
+  size_t offset = x + (y * WIDTH);
+  if (offset >= _size)
     throw string("Failed to seek to position");
-  int value = _input->get();
-  if (!_input->good())
-    throw string("Failed to read character");
-  return value;
+  return _data[offset];
 }
 
 int
@@ -61,9 +116,42 @@ LandCover::getValue (double lon, double lat) const
   if (lon < -180.0 || lon > 180.0 || lat < -90.0 || lat > 90.0)
     return -1;			// TODO: exception
 
-  long x = long((lon + 180.0) * 120.0);
-  long y = HEIGHT - long((lat + 90.0) * 120.0);
-  return getValue(x, y);
+  return getValue(getX(lon), getY(lat));
+}
+
+long
+LandCover::getX (double lon) const
+{
+  return long((lon + 180.0) * 120.0);
+}
+
+long
+LandCover::getY (double lat) const
+{
+  return HEIGHT - long((lat + 90.0) * 120.0);
+}
+
+void
+LandCover::getBlock (long x, long y, long w, long h, unsigned char * buffer) const
+{
+  memset(buffer, 0, w * h);
+
+  for (long row = 0; row < h; row++) {
+    long iy = y + row;
+    if (iy < 0 || iy >= HEIGHT)
+      continue;
+
+    // clamp the row to the image (and file)
+    long x0 = (x < 0) ? 0 : x;
+    long x1 = (x + w > WIDTH) ? WIDTH : x + w;
+    size_t offset = x0 + (iy * WIDTH);
+    if (x1 <= x0 || offset >= _size)
+      continue;
+    if (offset + (x1 - x0) > _size)
+      x1 = x0 + (long)(_size - offset);
+
+    memcpy(buffer + row * w + (x0 - x), _data + offset, x1 - x0);
+  }
 }
 
 const char *
@@ -10,7 +10,7 @@
 #include <simgear/compiler.h>
 
 #include <string>
-#include <fstream>
+#include <cstddef>
 
 /**
  * Query class for the USGS worldwide 30 arcsec land-cover image.
@@ -29,9 +29,10 @@
  * www.terragear.org and www.flightgear.org).
  *
  * The image uncompresses to nearly a gigabyte, so this class does not
- * attempt to hold the entire image in memory; instead, it opens a
- * stream to the file and seeks to the appropriate position for each query.
- * The stream is closed automatically by the destructor.
+ * read the entire image into memory; instead, it maps the file read-only
+ * and lets the OS page in the parts that are queried.  Queries never
+ * modify the object, so one LandCover can be shared by several threads.
+ * The mapping is released automatically by the destructor.
  *
  * The image file is 43200 bytes wide and 21600 bytes high, and represents
  * 30 arc second increments from longitude -180.0 to 180.0 horizontally
@@ -47,6 +48,10 @@
  * bottom right corner.  The second method returns the value at a
  * location using longitude and latitude, where -180.0,90.0 is the top
  * left corner and 180.0,-90.0 is the bottom right corner.
+ *
+ * To process a whole area (e.g. a tile) at once, getBlock copies a
+ * rectangle of the image, in native image coordinates, into a buffer.
+ * Use getX and getY to find the image coordinates of a location.
  * 
  * This class should work with any image file using the same coordinate
  * system and resolution.  For the USGS image, you can look up the
@@ -68,8 +73,23 @@ public:
   virtual int getValue (double lon, double lat) const;
   virtual const char *getDescUSGS (int value) const;
 
+  // image coordinates of a longitude / latitude
+  long getX (double lon) const;
+  long getY (double lat) const;
+
+  // copy the w x h cells starting at x, y into buffer, row by row.
+  // Cells outside of the image are returned as 0.
+  void getBlock (long x, long y, long w, long h, unsigned char * buffer) const;
+
 private:
-  mutable std::ifstream * _input;
+  const unsigned char * _data;
+  size_t _size;
+#ifdef _WIN32
+  void * _file;
+  void * _mapping;
+#else
+  int _fd;
+#endif
   long WIDTH;
   long HEIGHT;
 };
@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include <simgear/math/sg_geodesy.hxx>
 #include <simgear/io/lowlevel.hxx>
 #include <simgear/debug/logstream.hxx>
@@ -5,6 +7,7 @@
 #include "tg_misc.hxx"
 #include "tg_accumulator.hxx"
 #include "tg_contour.hxx"
+#include "tg_node_grid.hxx"
 #include "tg_polygon.hxx"
 
 tgContour tgContour::Snap( const tgContour& subject, double snap )
@@ -623,6 +626,40 @@ static void AddIntermediateNodes( const SGGeod& p0, const SGGeod& p1, std::vecto
     }
 }
 
+// as above, with candidate nodes from the grid : only nodes within
+// errEpsilon of the edge's bounding box can be on it.  Candidates come in
+// list order, so the same node is picked as with the full list.
+static void AddIntermediateNodes( const SGGeod& p0, const SGGeod& p1, const tgNodeGrid& grid,
+                                  std::vector<unsigned int>& candidates, std::vector<SGGeod>& candidate_nodes,
+                                  tgContour& result, double bbEpsilon, double errEpsilon )
+{
+    SGGeod new_pt;
+
+    SG_LOG(SG_GENERAL, SG_BULK, "   " << p0 << " <==> " << p1 );
+
+    grid.Query( std::min( p0.getLongitudeDeg(), p1.getLongitudeDeg() ) - errEpsilon,
+                std::min( p0.getLatitudeDeg(),  p1.getLatitudeDeg() )  - errEpsilon,
+                std::max( p0.getLongitudeDeg(), p1.getLongitudeDeg() ) + errEpsilon,
+                std::max( p0.getLatitudeDeg(),  p1.getLatitudeDeg() )  + errEpsilon,
+                candidates );
+
+    candidate_nodes.clear();
+    for ( unsigned int i = 0; i < candidates.size(); i++ ) {
+        candidate_nodes.push_back( grid.GetNode( candidates[i] ) );
+    }
+
+    bool found_extra = FindIntermediateNode( p0, p1, candidate_nodes, new_pt, bbEpsilon, errEpsilon );
+
+    if ( found_extra ) {
+        AddIntermediateNodes( p0, new_pt, grid, candidates, candidate_nodes, result, bbEpsilon, errEpsilon  );
+
+        result.AddNode( new_pt );
+        SG_LOG(SG_GENERAL, SG_BULK, "    adding = " << new_pt);
+
+        AddIntermediateNodes( new_pt, p1, grid, candidates, candidate_nodes, result, bbEpsilon, errEpsilon  );
+    }
+}
+
 tgContour tgContour::AddColinearNodes( const tgContour& subject, UniqueSGGeodSet& nodes )
 {
     SGGeod p0, p1;
@@ -686,6 +723,39 @@ tgContour tgContour::AddColinearNodes( const tgContour& subject, std::vector<SGG
     return result;
 }
 
+tgContour tgContour::AddColinearNodes( const tgContour& subject, const tgNodeGrid& grid )
+{
+    SGGeod p0, p1;
+    tgContour result;
+    std::vector<unsigned int> candidates;
+    std::vector<SGGeod> candidate_nodes;
+
+    for ( unsigned int n = 0; n < subject.GetSize()-1; n++ ) {
+        p0 = subject.GetNode( n );
+        p1 = subject.GetNode( n+1 );
+
+        // add start of segment
+        result.AddNode( p0 );
+
+        // add intermediate points
+        AddIntermediateNodes( p0, p1, grid, candidates, candidate_nodes, result, SG_EPSILON*10, SG_EPSILON*4 );
+    }
+
+    p0 = subject.GetNode( subject.GetSize() - 1 );
+    p1 = subject.GetNode( 0 );
+
+    // add start of segment
+    result.AddNode( p0 );
+
+    // add intermediate points
+    AddIntermediateNodes( p0, p1, grid, candidates, candidate_nodes, result, SG_EPSILON*10, SG_EPSILON*4 );
+
+    // maintain original hole flag setting
+    result.SetHole( subject.GetHole() );
+
+    return result;
+}
+
 // this is the opposite of FindColinearNodes - it takes a single SGGeode,
 // and tries to find the line segment the point is colinear with
 bool tgContour::FindColinearLine( const tgContour& subject, const SGGeod& node, SGGeod& start, SGGeod& end )
@@ -772,8 +842,6 @@ tgpolygon_list tgContour::ExpandToPolygons( const tgContour& subject, double wid
         last_end_v = 0.0f;
         turn_dir   = 0;
 
-        sglog().setLogLevels( SG_ALL, SG_INFO );
-
         SG_LOG(SG_GENERAL, SG_DEBUG, "makePolygonsTP: calculating offsets for segment " << i);
 
         // for each point on the PointsList, generate a quad from
@@ -860,7 +928,69 @@ tgpolygon_list tgContour::ExpandToPolygons( const tgContour& subject, double wid
         prev_inner = cur_inner;
     }
 
-    sglog().setLogLevels( SG_ALL, SG_INFO );
+    return result;
+}
+
+// start a new textured polygon when the line turns more than this
+#define MERGE_MAX_TURN      (10.0)
+
+// and when a corner falls this far (in widths) outside the texture strip
+#define MERGE_MAX_DRIFT     (0.25)
+
+static void FlushMergedSegments( tgpolygon_list& run, tgpolygon_list& result )
+{
+    if ( run.size() == 1 ) {
+        result.push_back( run[0] );
+    } else if ( run.size() > 1 ) {
+        tgPolygon merged = tgPolygon::Union( run );
+
+        // the whole run is textured in the frame of its first segment
+        merged.SetTexParams( run[0].GetTexParams() );
+        result.push_back( merged );
+    }
+
+    run.clear();
+}
+
+tgpolygon_list tgContour::ExpandToMergedPolygons( const tgContour& subject, double width, bool textured, unsigned int max_segments )
+{
+    tgpolygon_list segments = ExpandToPolygons( subject, width );
+    tgpolygon_list result;
+    tgpolygon_list run;
+
+    for ( unsigned int i = 0; i < segments.size(); i++ ) {
+        bool fits = !run.empty() && ( run.size() < max_segments );
+
+        if ( fits && textured ) {
+            // Every corner has to map into the u range of the run's first
+            // segment, or the texture would be clipped across the road
+            const tgTexParams& frame = run[0].GetTexParams();
+            const tgTexParams& tp    = segments[i].GetTexParams();
+
+            double turn = SGMiscd::normalizePeriodic( -180, 180, tp.heading - frame.heading );
+            if ( fabs( turn ) > MERGE_MAX_TURN ) {
+                fits = false;
+            }
+
+            for ( unsigned int j = 0; fits && j < segments[i].ContourSize( 0 ); j++ ) {
+                double az1, az2, dist;
+
+                // same projection as tgPolygon::Texture()
+                SGGeodesy::inverse( frame.ref, segments[i].GetNode( 0, j ), az1, az2, dist );
+                double x = sin( (az2 - frame.heading) * SGD_DEGREES_TO_RADIANS ) * dist;
+
+                if ( ( x < -MERGE_MAX_DRIFT * width ) || ( x > (1.0 + MERGE_MAX_DRIFT) * width ) ) {
+                    fits = false;
+                }
+            }
+        }
+
+        if ( !fits ) {
+            FlushMergedSegments( run, result );
+        }
+        run.push_back( segments[i] );
+    }
+    FlushMergedSegments( run, result );
 
     return result;
 }
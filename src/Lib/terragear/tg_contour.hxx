@@ -14,6 +14,7 @@
 #include "clipper.hpp"
 
 /* forward declarations */
+class tgNodeGrid;
 class tgPolygon;
 typedef std::vector <tgPolygon>  tgpolygon_list;
 
@@ -109,6 +110,7 @@ public:
     static bool      IsInside( const tgContour& inside, const tgContour& outside );
     static tgContour AddColinearNodes( const tgContour& subject, UniqueSGGeodSet& nodes );
     static tgContour AddColinearNodes( const tgContour& subject, std::vector<SGGeod>& nodes );
+    static tgContour AddColinearNodes( const tgContour& subject, const tgNodeGrid& grid );
     static bool      FindColinearLine( const tgContour& subject, const SGGeod& node, SGGeod& start, SGGeod& end );
 
     // conversions
@@ -118,6 +120,10 @@ public:
     static tgContour Expand( const tgContour& subject, double offset );
     static tgpolygon_list ExpandToPolygons( const tgContour& subject, double width );
 
+    // As above, but consecutive segments are merged into one polygon, as
+    // long as they fit into the texture frame of the first (when textured)
+    static tgpolygon_list ExpandToMergedPolygons( const tgContour& subject, double width, bool textured, unsigned int max_segments = 256 );
+
     static void ToShapefile( const tgContour& subject, const std::string& datasource, const std::string& layer, const std::string& feature );
 
     void SaveToGzFile( gzFile& fp ) const;
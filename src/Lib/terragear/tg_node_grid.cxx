@@ -0,0 +1,109 @@
+#include <algorithm>
+#include <cmath>
+
+#include "tg_node_grid.hxx"
+
+// aim for this many nodes per cell
+#define TG_NODE_GRID_PER_CELL   (4)
+#define TG_NODE_GRID_MAX_DIM    (1024)
+
+tgNodeGrid::tgNodeGrid( const std::vector<SGGeod>& n ) :
+    nodes( n )
+{
+    double max_lon, max_lat;
+
+    min_lon = min_lat = 0.0;
+    max_lon = max_lat = 0.0;
+
+    for ( unsigned int i = 0; i < nodes.size(); i++ ) {
+        double lon = nodes[i].getLongitudeDeg();
+        double lat = nodes[i].getLatitudeDeg();
+
+        if ( i == 0 || lon < min_lon ) { min_lon = lon; }
+        if ( i == 0 || lon > max_lon ) { max_lon = lon; }
+        if ( i == 0 || lat < min_lat ) { min_lat = lat; }
+        if ( i == 0 || lat > max_lat ) { max_lat = lat; }
+    }
+
+    double width  = max_lon - min_lon;
+    double height = max_lat - min_lat;
+    double cells  = std::max( 1.0, (double)nodes.size() / TG_NODE_GRID_PER_CELL );
+
+    if ( width > 0.0 && height > 0.0 ) {
+        cols = (int)ceil( sqrt( cells * width / height ) );
+    } else if ( width > 0.0 ) {
+        cols = (int)cells;
+    } else {
+        cols = 1;
+    }
+    cols = std::min( std::max( cols, 1 ), TG_NODE_GRID_MAX_DIM );
+    rows = std::min( std::max( (int)ceil( cells / cols ), 1 ), TG_NODE_GRID_MAX_DIM );
+    if ( height <= 0.0 ) {
+        rows = 1;
+    }
+
+    cell_lon = ( width  > 0.0 ) ? width  / cols : 1.0;
+    cell_lat = ( height > 0.0 ) ? height / rows : 1.0;
+
+    // counting sort of the nodes into their cells - each cell keeps its
+    // nodes in list order
+    std::vector<unsigned int> cell_of( nodes.size() );
+    cell_start.assign( cols * rows + 1, 0 );
+
+    for ( unsigned int i = 0; i < nodes.size(); i++ ) {
+        cell_of[i] = CellRow( nodes[i].getLatitudeDeg() ) * cols + CellCol( nodes[i].getLongitudeDeg() );
+        cell_start[cell_of[i] + 1]++;
+    }
+    for ( int c = 0; c < cols * rows; c++ ) {
+        cell_start[c + 1] += cell_start[c];
+    }
+
+    std::vector<unsigned int> fill( cell_start.begin(), cell_start.end() - 1 );
+    cell_nodes.resize( nodes.size() );
+    for ( unsigned int i = 0; i < nodes.size(); i++ ) {
+        cell_nodes[fill[cell_of[i]]++] = i;
+    }
+}
+
+int tgNodeGrid::CellCol( double lon ) const
+{
+    int c = (int)floor( (lon - min_lon) / cell_lon );
+    return std::min( std::max( c, 0 ), cols - 1 );
+}
+
+int tgNodeGrid::CellRow( double lat ) const
+{
+    int r = (int)floor( (lat - min_lat) / cell_lat );
+    return std::min( std::max( r, 0 ), rows - 1 );
+}
+
+void tgNodeGrid::Query( double qmin_lon, double qmin_lat, double qmax_lon, double qmax_lat,
+                        std::vector<unsigned int>& result ) const
+{
+    result.clear();
+
+    if ( nodes.empty() ) {
+        return;
+    }
+
+    int c0 = CellCol( qmin_lon ), c1 = CellCol( qmax_lon );
+    int r0 = CellRow( qmin_lat ), r1 = CellRow( qmax_lat );
+
+    for ( int r = r0; r <= r1; r++ ) {
+        for ( int c = c0; c <= c1; c++ ) {
+            int cell = r * cols + c;
+
+            for ( unsigned int k = cell_start[cell]; k < cell_start[cell + 1]; k++ ) {
+                const SGGeod& p = nodes[cell_nodes[k]];
+
+                if ( p.getLongitudeDeg() >= qmin_lon && p.getLongitudeDeg() <= qmax_lon &&
+                     p.getLatitudeDeg()  >= qmin_lat && p.getLatitudeDeg()  <= qmax_lat ) {
+                    result.push_back( cell_nodes[k] );
+                }
+            }
+        }
+    }
+
+    // cells are visited row by row - restore list order
+    std::sort( result.begin(), result.end() );
+}
@@ -0,0 +1,52 @@
+#ifndef _TG_NODE_GRID_HXX
+#define _TG_NODE_GRID_HXX
+
+#ifndef __cplusplus
+# error This library requires C++
+#endif
+
+#include <vector>
+
+#include <simgear/math/SGMath.hxx>
+
+// A uniform lon/lat grid over a fixed set of nodes, to find the nodes
+// close to an edge without testing all of them.
+//
+// Built once from a node list, then only read - so one grid can be
+// shared by all the polygons (and threads) adding colinear nodes against
+// the same node set.  Queries return node indices in ascending order, so
+// callers see candidates in the same order as the original list.
+
+class tgNodeGrid
+{
+public:
+    tgNodeGrid( const std::vector<SGGeod>& nodes );
+
+    // indices of all nodes inside the box (inclusive)
+    void Query( double min_lon, double min_lat, double max_lon, double max_lat,
+                std::vector<unsigned int>& result ) const;
+
+    const SGGeod& GetNode( unsigned int i ) const {
+        return nodes[i];
+    }
+
+    unsigned int size( void ) const {
+        return nodes.size();
+    }
+
+private:
+    int CellCol( double lon ) const;
+    int CellRow( double lat ) const;
+
+    std::vector<SGGeod> nodes;
+
+    double min_lon, min_lat;
+    double cell_lon, cell_lat;
+    int    cols, rows;
+
+    // nodes of cell c are cell_nodes[cell_start[c]] .. cell_nodes[cell_start[c+1]-1]
+    std::vector<unsigned int> cell_start;
+    std::vector<unsigned int> cell_nodes;
+};
+
+#endif // _TG_NODE_GRID_HXX
@@ -0,0 +1,274 @@
+#include <algorithm>
+#include <limits>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include <simgear/debug/logstream.hxx>
+
+#include "tg_normals.hxx"
+
+#if defined(__SSE2__) || defined(_M_X64) || ( defined(_M_IX86_FP) && _M_IX86_FP >= 2 )
+#  include <emmintrin.h>
+#  define TG_NORMALS_SSE2
+#endif
+
+// Don't bother starting threads for less work than this
+#define TG_NORMALS_MIN_PER_THREAD   (4096)
+
+void tgNormals::clear( void )
+{
+    wgs_x.clear();
+    wgs_y.clear();
+    wgs_z.clear();
+    lon_deg.clear();
+    lat_deg.clear();
+
+    tri_nodes.clear();
+    face_normals.clear();
+    face_areas.clear();
+
+    node_offsets.clear();
+    node_tris.clear();
+    normal_sums.clear();
+    area_sums.clear();
+}
+
+void tgNormals::SetNodes( const TGNodes& nodes )
+{
+    unsigned int num_nodes = nodes.size();
+
+    clear();
+    wgs_x.resize( num_nodes );
+    wgs_y.resize( num_nodes );
+    wgs_z.resize( num_nodes );
+    lon_deg.resize( num_nodes );
+    lat_deg.resize( num_nodes );
+
+    for ( unsigned int i = 0; i < num_nodes; i++ ) {
+        TGNode const& node = nodes.get_node( i );
+
+        wgs_x[i]   = node.GetWgs84().x();
+        wgs_y[i]   = node.GetWgs84().y();
+        wgs_z[i]   = node.GetWgs84().z();
+        lon_deg[i] = node.GetPosition().getLongitudeDeg();
+        lat_deg[i] = node.GetPosition().getLatitudeDeg();
+    }
+}
+
+unsigned int tgNormals::AddTriangles( const tgPolygon& poly )
+{
+    unsigned int first = Triangles();
+
+    for ( unsigned int tri = 0; tri < poly.Triangles(); tri++ ) {
+        tri_nodes.push_back( poly.GetTriIdx( tri, 0 ) );
+        tri_nodes.push_back( poly.GetTriIdx( tri, 1 ) );
+        tri_nodes.push_back( poly.GetTriIdx( tri, 2 ) );
+    }
+
+    return first;
+}
+
+SGVec3f tgNormals::CalcNormal( double area, const SGVec3d& p1, const SGVec3d& p2, const SGVec3d& p3 )
+{
+    SGVec3f v1, v2;
+    SGVec3f normal;
+
+    // do some sanity checking.  With the introduction of landuse
+    // areas, we can get some long skinny triangles that blow up our
+    // "normal" calculations here.  Let's check for really small
+    // triangle areas and check if one dimension of the triangle
+    // coordinates is nearly coincident.  If so, assign the "default"
+    // normal of straight up.
+
+    bool degenerate = false;
+    const double area_eps = 1.0e-12;
+    if ( area < area_eps ) {
+        degenerate = true;
+    } else if ( fabs(p1.x() - p2.x()) < SG_EPSILON && fabs(p1.x() - p3.x()) < SG_EPSILON ) {
+        degenerate = true;
+    } else if ( fabs(p1.y() - p2.y()) < SG_EPSILON && fabs(p1.y() - p3.y()) < SG_EPSILON ) {
+        degenerate = true;
+    } else if ( fabs(p1.z() - p2.z()) < SG_EPSILON && fabs(p1.z() - p3.z()) < SG_EPSILON ) {
+        degenerate = true;
+    }
+
+    if ( degenerate ) {
+        normal = normalize(SGVec3f(p1.x(), p1.y(), p1.z()));
+    } else {
+        v1[0] = p2.x() - p1.x();
+        v1[1] = p2.y() - p1.y();
+        v1[2] = p2.z() - p1.z();
+        v2[0] = p3.x() - p1.x();
+        v2[1] = p3.y() - p1.y();
+        v2[2] = p3.z() - p1.z();
+        normal = normalize(cross(v1, v2));
+    }
+
+    return normal;
+}
+
+void tgNormals::FaceNormalRange( unsigned int start, unsigned int end )
+{
+    const double area_eps = 1.0e-12;
+
+    for ( unsigned int base = start; base < end; base += 4 ) {
+        float e1x[4], e1y[4], e1z[4];
+        float e2x[4], e2y[4], e2z[4];
+        float nx[4], ny[4], nz[4], len[4];
+        bool  degenerate[4];
+
+        // gather 4 triangles : area, sanity check and edge vectors
+        for ( unsigned int k = 0; k < 4; k++ ) {
+            unsigned int t = base + k;
+
+            e1x[k] = e1y[k] = e1z[k] = 0.0f;
+            e2x[k] = e2y[k] = e2z[k] = 0.0f;
+            degenerate[k] = true;
+            if ( t >= end ) {
+                continue;
+            }
+
+            int i1 = tri_nodes[3*t], i2 = tri_nodes[3*t+1], i3 = tri_nodes[3*t+2];
+
+            // same expression as tgTriangle::area()
+            double area = fabs(0.5 * ( lon_deg[i1] * lat_deg[i2] - lon_deg[i2] * lat_deg[i1] +
+                                       lon_deg[i2] * lat_deg[i3] - lon_deg[i3] * lat_deg[i2] +
+                                       lon_deg[i3] * lat_deg[i1] - lon_deg[i1] * lat_deg[i3] ));
+            face_areas[t] = area;
+
+            if ( area < area_eps ) {
+                continue;
+            } else if ( fabs(wgs_x[i1] - wgs_x[i2]) < SG_EPSILON && fabs(wgs_x[i1] - wgs_x[i3]) < SG_EPSILON ) {
+                continue;
+            } else if ( fabs(wgs_y[i1] - wgs_y[i2]) < SG_EPSILON && fabs(wgs_y[i1] - wgs_y[i3]) < SG_EPSILON ) {
+                continue;
+            } else if ( fabs(wgs_z[i1] - wgs_z[i2]) < SG_EPSILON && fabs(wgs_z[i1] - wgs_z[i3]) < SG_EPSILON ) {
+                continue;
+            }
+
+            degenerate[k] = false;
+            e1x[k] = wgs_x[i2] - wgs_x[i1];
+            e1y[k] = wgs_y[i2] - wgs_y[i1];
+            e1z[k] = wgs_z[i2] - wgs_z[i1];
+            e2x[k] = wgs_x[i3] - wgs_x[i1];
+            e2y[k] = wgs_y[i3] - wgs_y[i1];
+            e2z[k] = wgs_z[i3] - wgs_z[i1];
+        }
+
+        // cross product and normalization, as SGVec3f cross() and normalize()
+#ifdef TG_NORMALS_SSE2
+        __m128 ax = _mm_loadu_ps( e1x ), ay = _mm_loadu_ps( e1y ), az = _mm_loadu_ps( e1z );
+        __m128 bx = _mm_loadu_ps( e2x ), by = _mm_loadu_ps( e2y ), bz = _mm_loadu_ps( e2z );
+
+        __m128 cx = _mm_sub_ps( _mm_mul_ps( ay, bz ), _mm_mul_ps( az, by ) );
+        __m128 cy = _mm_sub_ps( _mm_mul_ps( az, bx ), _mm_mul_ps( ax, bz ) );
+        __m128 cz = _mm_sub_ps( _mm_mul_ps( ax, by ), _mm_mul_ps( ay, bx ) );
+
+        __m128 dot = _mm_add_ps( _mm_add_ps( _mm_mul_ps( cx, cx ), _mm_mul_ps( cy, cy ) ), _mm_mul_ps( cz, cz ) );
+        __m128 l   = _mm_sqrt_ps( dot );
+        __m128 inv = _mm_div_ps( _mm_set1_ps( 1.0f ), l );
+
+        _mm_storeu_ps( nx,  _mm_mul_ps( inv, cx ) );
+        _mm_storeu_ps( ny,  _mm_mul_ps( inv, cy ) );
+        _mm_storeu_ps( nz,  _mm_mul_ps( inv, cz ) );
+        _mm_storeu_ps( len, l );
+#else
+        for ( unsigned int k = 0; k < 4; k++ ) {
+            SGVec3f c = cross( SGVec3f( e1x[k], e1y[k], e1z[k] ), SGVec3f( e2x[k], e2y[k], e2z[k] ) );
+            SGVec3f n = normalize( c );
+            nx[k]  = n.x();
+            ny[k]  = n.y();
+            nz[k]  = n.z();
+            len[k] = norm( c );
+        }
+#endif
+
+        for ( unsigned int k = 0; k < 4 && base + k < end; k++ ) {
+            unsigned int t = base + k;
+
+            if ( degenerate[k] ) {
+                int i1 = tri_nodes[3*t];
+                face_normals[t] = normalize( SGVec3f( wgs_x[i1], wgs_y[i1], wgs_z[i1] ) );
+            } else if ( len[k] <= std::numeric_limits<float>::min() ) {
+                face_normals[t] = SGVec3f::zeros();
+            } else {
+                face_normals[t] = SGVec3f( nx[k], ny[k], nz[k] );
+            }
+        }
+    }
+}
+
+void tgNormals::PointNormalRange( unsigned int start, unsigned int end )
+{
+    for ( unsigned int n = start; n < end; n++ ) {
+        SGVec3f average( 0.0, 0.0, 0.0 );
+        double  total_area = 0.0;
+
+        for ( unsigned int j = node_offsets[n]; j < node_offsets[n+1]; j++ ) {
+            unsigned int t = node_tris[j];
+            SGVec3f normal = face_normals[t];
+
+            normal *= face_areas[t];    // scale normal weight relative to area
+            total_area += face_areas[t];
+            average += normal;
+        }
+
+        normal_sums[n] = average;
+        area_sums[n]   = total_area;
+    }
+}
+
+void tgNormals::RunParallel( void (tgNormals::*range)( unsigned int, unsigned int ), unsigned int count )
+{
+    unsigned int threads = std::min( num_threads, count / TG_NORMALS_MIN_PER_THREAD );
+
+    if ( threads <= 1 ) {
+        (this->*range)( 0, count );
+        return;
+    }
+
+    // keep chunks a multiple of 4, so SSE blocks don't straddle them
+    unsigned int chunk = ( ( count + threads - 1 ) / threads + 3 ) & ~3u;
+    boost::thread_group group;
+
+    for ( unsigned int start = 0; start < count; start += chunk ) {
+        group.create_thread( boost::bind( range, this, start, std::min( start + chunk, count ) ) );
+    }
+    group.join_all();
+}
+
+void tgNormals::CalcFaceNormals( void )
+{
+    face_normals.resize( Triangles() );
+    face_areas.resize( Triangles() );
+
+    RunParallel( &tgNormals::FaceNormalRange, Triangles() );
+}
+
+void tgNormals::CalcPointNormals( void )
+{
+    unsigned int num_nodes = wgs_x.size();
+
+    // build the node -> triangle table.  Triangles are listed in the order
+    // they were added, so the sums accumulate in the same order as the
+    // per node face lists
+    node_offsets.assign( num_nodes + 1, 0 );
+    for ( unsigned int i = 0; i < tri_nodes.size(); i++ ) {
+        node_offsets[tri_nodes[i] + 1]++;
+    }
+    for ( unsigned int n = 0; n < num_nodes; n++ ) {
+        node_offsets[n + 1] += node_offsets[n];
+    }
+
+    std::vector<unsigned int> fill( node_offsets.begin(), node_offsets.end() - 1 );
+    node_tris.resize( tri_nodes.size() );
+    for ( unsigned int i = 0; i < tri_nodes.size(); i++ ) {
+        node_tris[fill[tri_nodes[i]]++] = i / 3;
+    }
+
+    normal_sums.resize( num_nodes );
+    area_sums.resize( num_nodes );
+
+    RunParallel( &tgNormals::PointNormalRange, num_nodes );
+}
@@ -0,0 +1,84 @@
+#ifndef _TG_NORMALS_HXX
+#define _TG_NORMALS_HXX
+
+#ifndef __cplusplus
+# error This library requires C++
+#endif
+
+#include <vector>
+
+#include <simgear/math/SGMath.hxx>
+
+#include "tg_nodes.hxx"
+#include "tg_polygon.hxx"
+
+// Face and point normal calculation over a flat triangle array.
+//
+// Node positions are copied once into contiguous arrays, and every
+// triangle of the tile is appended to one index list.  Face normals are
+// then a flat loop over the triangles (4 at a time with SSE2), and the
+// area weighted point normals are a gather over a node -> triangle table.
+// Both loops can be split over several threads.
+//
+// The arithmetic is the same as SGVec3f cross() / normalize() in the same
+// order, so results are bit-identical to the per polygon calculation.
+
+class tgNormals
+{
+public:
+    tgNormals( unsigned int threads = 1 ) {
+        num_threads = threads ? threads : 1;
+    }
+
+    inline void SetThreads( unsigned int threads ) { num_threads = threads ? threads : 1; }
+
+    void clear( void );
+
+    // snapshot the node positions - call before adding triangles
+    void SetNodes( const TGNodes& nodes );
+
+    // append the (indexed) triangles of a polygon.  Returns the index of
+    // its first triangle in the flat list
+    unsigned int AddTriangles( const tgPolygon& poly );
+
+    void CalcFaceNormals( void );
+
+    // area weighted sum of the face normals around each node.  The caller
+    // can add contributions from neighbouring tiles before dividing
+    void CalcPointNormals( void );
+
+    inline unsigned int Triangles( void ) const                 { return tri_nodes.size() / 3; }
+    inline const SGVec3f& GetFaceNormal( unsigned int t ) const { return face_normals[t]; }
+    inline double GetFaceArea( unsigned int t ) const           { return face_areas[t]; }
+
+    inline const SGVec3f& GetNormalSum( unsigned int n ) const  { return normal_sums[n]; }
+    inline double GetAreaSum( unsigned int n ) const            { return area_sums[n]; }
+
+    // the sanity checked face normal, as used by tg-construct
+    static SGVec3f CalcNormal( double area, const SGVec3d& p1, const SGVec3d& p2, const SGVec3d& p3 );
+
+private:
+    void FaceNormalRange( unsigned int start, unsigned int end );
+    void PointNormalRange( unsigned int start, unsigned int end );
+    void RunParallel( void (tgNormals::*range)( unsigned int, unsigned int ), unsigned int count );
+
+    unsigned int          num_threads;
+
+    // node positions
+    std::vector<double>   wgs_x, wgs_y, wgs_z;
+    std::vector<double>   lon_deg, lat_deg;
+
+    // triangles
+    std::vector<int>      tri_nodes;
+    std::vector<SGVec3f>  face_normals;
+    std::vector<double>   face_areas;
+
+    // node -> triangle lookup as compressed rows
+    std::vector<unsigned int> node_offsets;
+    std::vector<unsigned int> node_tris;
+
+    std::vector<SGVec3f>  normal_sums;
+    std::vector<double>   area_sums;
+};
+
+#endif // _TG_NORMALS_HXX
@@ -130,6 +130,21 @@ tgPolygon tgPolygon::AddColinearNodes( const tgPolygon& subject, UniqueSGGeodSet
     return AddColinearNodes( subject, nodes.get_list() );
 }
 
+tgPolygon tgPolygon::AddColinearNodes( const tgPolygon& subject, const tgNodeGrid& grid )
+{
+    tgPolygon result;
+
+    result.SetMaterial( subject.GetMaterial() );
+    result.SetTexParams( subject.GetTexParams() );
+    result.SetId( subject.GetId() );
+
+    for ( unsigned int c = 0; c < subject.Contours(); c++ ) {
+        result.AddContour( tgContour::AddColinearNodes( subject.GetContour(c), grid ) );
+    }
+
+    return result;
+}
+
 // this is the opposite of FindColinearNodes - it takes a single SGGeode,
 // and tries to find the line segment the point is colinear with
 bool tgPolygon::FindColinearLine( const tgPolygon& subject, SGGeod& node, SGGeod& start, SGGeod& end )
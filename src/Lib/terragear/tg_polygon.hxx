@@ -409,6 +409,7 @@ public:
     // T-Junctions and segment search
     static tgPolygon AddColinearNodes( const tgPolygon& subject, UniqueSGGeodSet& nodes );
     static tgPolygon AddColinearNodes( const tgPolygon& subject, std::vector<SGGeod>& nodes );
+    static tgPolygon AddColinearNodes( const tgPolygon& subject, const tgNodeGrid& grid );
     static bool      FindColinearLine( const tgPolygon& subject, SGGeod& node, SGGeod& start, SGGeod& end );
 
     // IO
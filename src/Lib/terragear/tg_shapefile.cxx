@@ -1,3 +1,7 @@
+#include <map>
+
+#include <boost/thread/tss.hpp>
+
 #include <ogrsf_frmts.h>
 
 #include <simgear/debug/logstream.hxx>
@@ -5,8 +9,152 @@
 #include "tg_misc.hxx"
 #include "tg_shapefile.hxx"
 
+// features per transaction
+#define TG_SHAPEFILE_BATCH_SIZE     (1000)
+
 bool tgShapefile::initialized = false;
 
+// open datasources and layers of one thread's debug output
+class tgShapefileSink
+{
+public:
+    struct SinkLayer {
+        OGRLayer*       layer;
+        unsigned int    seen;       // features offered
+        unsigned int    pending;    // features in the open transaction
+    };
+
+    typedef std::map<std::string, OGRDataSource*>   datasource_map;
+    typedef std::map<OGRLayer*, SinkLayer>          layer_map;
+    typedef std::map<std::string, OGRLayer*>        layer_name_map;
+
+    unsigned int                sample;
+    std::vector<std::string>    prefixes;
+
+    datasource_map              datasources;
+    layer_map                   layers;
+    layer_name_map              layer_names;
+
+    bool Accept( const std::string& layer ) const {
+        if ( prefixes.empty() ) {
+            return true;
+        }
+        for ( unsigned int i = 0; i < prefixes.size(); i++ ) {
+            if ( layer.compare( 0, prefixes[i].size(), prefixes[i] ) == 0 ) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+static boost::thread_specific_ptr<tgShapefileSink> sink;
+
+void tgShapefile::BeginSink( unsigned int sample, const std::vector<std::string>& layers )
+{
+    EndSink();
+
+    tgShapefileSink* s = new tgShapefileSink;
+    s->sample   = sample ? sample : 1;
+    s->prefixes = layers;
+
+    sink.reset( s );
+}
+
+void tgShapefile::EndSink( void )
+{
+    tgShapefileSink* s = sink.get();
+    if ( !s ) {
+        return;
+    }
+
+    for ( tgShapefileSink::layer_map::iterator it = s->layers.begin(); it != s->layers.end(); ++it ) {
+        if ( it->second.pending ) {
+            it->first->CommitTransaction();
+        }
+    }
+    for ( tgShapefileSink::datasource_map::iterator it = s->datasources.begin(); it != s->datasources.end(); ++it ) {
+        CloseDatasource( it->second );
+    }
+
+    sink.reset();
+}
+
+void* tgShapefile::BeginWrite( const std::string& datasource, const std::string& layer, void** ds_id )
+{
+    tgShapefileSink* s = sink.get();
+
+    if ( !s ) {
+        *ds_id = tgShapefile::OpenDatasource( datasource.c_str() );
+        return tgShapefile::OpenLayer( *ds_id, layer.c_str() );
+    }
+
+    *ds_id = NULL;
+    if ( !s->Accept( layer ) ) {
+        return NULL;
+    }
+
+    std::string key = datasource + '\n' + layer;
+    tgShapefileSink::layer_name_map::iterator lit = s->layer_names.find( key );
+    if ( lit != s->layer_names.end() ) {
+        return lit->second;
+    }
+
+    tgShapefileSink::datasource_map::iterator dit = s->datasources.find( datasource );
+    if ( dit == s->datasources.end() ) {
+        OGRDataSource* ds = (OGRDataSource*)tgShapefile::OpenDatasource( datasource.c_str() );
+        dit = s->datasources.insert( std::make_pair( datasource, ds ) ).first;
+    }
+
+    OGRLayer* l_id = (OGRLayer*)tgShapefile::OpenLayer( dit->second, layer.c_str() );
+    if ( l_id ) {
+        tgShapefileSink::SinkLayer sl = { l_id, 0, 0 };
+        s->layers[l_id] = sl;
+    }
+    s->layer_names[key] = l_id;
+
+    return l_id;
+}
+
+void tgShapefile::WriteFeature( void* l_id, void* feature )
+{
+    OGRLayer*        layer = (OGRLayer*)l_id;
+    tgShapefileSink* s     = sink.get();
+
+    if ( s ) {
+        tgShapefileSink::SinkLayer& sl = s->layers[layer];
+
+        if ( sl.seen++ % s->sample ) {
+            return;
+        }
+        if ( sl.pending == 0 ) {
+            layer->StartTransaction();
+        }
+    }
+
+    if( layer->CreateFeature( (OGRFeature*)feature ) != OGRERR_NONE )
+    {
+        SG_LOG(SG_GENERAL, SG_ALERT, "Failed to create feature in shapefile");
+    }
+
+    if ( s ) {
+        tgShapefileSink::SinkLayer& sl = s->layers[layer];
+
+        if ( ++sl.pending >= TG_SHAPEFILE_BATCH_SIZE ) {
+            layer->CommitTransaction();
+            sl.pending = 0;
+        }
+    }
+}
+
+void tgShapefile::EndWrite( void* ds_id )
+{
+    // close after each write, unless the sink keeps it open
+    if ( ds_id ) {
+        tgShapefile::CloseDatasource( ds_id );
+    }
+}
+
 void* tgShapefile::OpenDatasource( const char* datasource_name )
 {
     OGRDataSource*  datasource;
@@ -75,11 +223,14 @@ void* tgShapefile::CloseDatasource( void* ds_id )
 
 void tgShapefile::FromClipper( const ClipperLib::Polygons& subject, const std::string& datasource, const std::string& layer, const std::string& description )
 {
-    void*          ds_id = tgShapefile::OpenDatasource( datasource.c_str() );
-    SG_LOG(SG_GENERAL, SG_DEBUG, "tgShapefile::OpenDatasource returned " << (unsigned long)ds_id);
+    void*          ds_id;
+    OGRLayer*      l_id  = (OGRLayer *)tgShapefile::BeginWrite( datasource, layer, &ds_id );
+    SG_LOG(SG_GENERAL, SG_DEBUG, "tgShapefile::BeginWrite returned " << (unsigned long)l_id);
 
-    OGRLayer*      l_id  = (OGRLayer *)tgShapefile::OpenLayer( ds_id, layer.c_str() );
-    SG_LOG(SG_GENERAL, SG_DEBUG, "tgShapefile::OpenLayer returned " << (unsigned long)l_id);
+    if ( !l_id ) {
+        tgShapefile::EndWrite( ds_id );
+        return;
+    }
 
     OGRPolygon*    polygon = new OGRPolygon();
     SG_LOG(SG_GENERAL, SG_DEBUG, "subject has " << subject.size() << " contours ");
@@ -114,27 +265,24 @@ void tgShapefile::FromClipper( const ClipperLib::Polygons& subject, const std::s
 
         feature->SetField("ID", description.c_str());
         feature->SetGeometry(polygon);
-        if( l_id->CreateFeature( feature ) != OGRERR_NONE )
-        {
-            SG_LOG(SG_GENERAL, SG_ALERT, "Failed to create feature in shapefile");
-        }
+        tgShapefile::WriteFeature( l_id, feature );
 
         OGRFeature::DestroyFeature(feature);
     }
 
-    // close after each write
-    if ( ds_id >= 0 ) {
-        ds_id = tgShapefile::CloseDatasource( ds_id );
-    }
+    tgShapefile::EndWrite( ds_id );
 }
 
 void tgShapefile::FromContour( const tgContour& subject, const std::string& datasource, const std::string& layer, const std::string& description )
 {
-    void*          ds_id = tgShapefile::OpenDatasource( datasource.c_str() );
-    SG_LOG(SG_GENERAL, SG_DEBUG, "tgShapefile::OpenDatasource returned " << (unsigned long)ds_id);
+    void*          ds_id;
+    OGRLayer*      l_id  = (OGRLayer *)tgShapefile::BeginWrite( datasource, layer, &ds_id );
+    SG_LOG(SG_GENERAL, SG_DEBUG, "tgShapefile::BeginWrite returned " << (unsigned long)l_id);
 
-    OGRLayer*      l_id  = (OGRLayer *)tgShapefile::OpenLayer( ds_id, layer.c_str() );
-    SG_LOG(SG_GENERAL, SG_DEBUG, "tgShapefile::OpenLayer returned " << (unsigned long)l_id);
+    if ( !l_id ) {
+        tgShapefile::EndWrite( ds_id );
+        return;
+    }
 
     OGRPolygon*    polygon = new OGRPolygon();
 
@@ -161,24 +309,23 @@ void tgShapefile::FromContour( const tgContour& subject, const std::string& data
         feature = new OGRFeature( l_id->GetLayerDefn() );
         feature->SetField("ID", description.c_str());
         feature->SetGeometry(polygon);
-        if( l_id->CreateFeature( feature ) != OGRERR_NONE )
-        {
-            SG_LOG(SG_GENERAL, SG_ALERT, "Failed to create feature in shapefile");
-        }
+        tgShapefile::WriteFeature( l_id, feature );
         OGRFeature::DestroyFeature(feature);
     }
 
-    // close after each write
-    ds_id = tgShapefile::CloseDatasource( ds_id );
+    tgShapefile::EndWrite( ds_id );
 }
 
 void tgShapefile::FromPolygon( const tgPolygon& subject, const std::string& datasource, const std::string& layer, const std::string& description )
 {
-    void*          ds_id = tgShapefile::OpenDatasource( datasource.c_str() );
-    SG_LOG(SG_GENERAL, SG_DEBUG, "tgShapefile::OpenDatasource returned " << (unsigned long)ds_id);
+    void*          ds_id;
+    OGRLayer*      l_id  = (OGRLayer *)tgShapefile::BeginWrite( datasource, layer, &ds_id );
+    SG_LOG(SG_GENERAL, SG_DEBUG, "tgShapefile::BeginWrite returned " << (unsigned long)l_id);
 
-    OGRLayer*      l_id  = (OGRLayer *)tgShapefile::OpenLayer( ds_id, layer.c_str() );
-    SG_LOG(SG_GENERAL, SG_DEBUG, "tgShapefile::OpenLayer returned " << (unsigned long)l_id);
+    if ( !l_id ) {
+        tgShapefile::EndWrite( ds_id );
+        return;
+    }
 
     OGRPolygon*    polygon = new OGRPolygon();
 
@@ -215,15 +362,11 @@ void tgShapefile::FromPolygon( const tgPolygon& subject, const std::string& data
         feature = new OGRFeature( l_id->GetLayerDefn() );
         feature->SetField("ID", description.c_str());
         feature->SetGeometry(polygon);
-        if( l_id->CreateFeature( feature ) != OGRERR_NONE )
-        {
-            SG_LOG(SG_GENERAL, SG_ALERT, "Failed to create feature in shapefile");
-        }
+        tgShapefile::WriteFeature( l_id, feature );
         OGRFeature::DestroyFeature(feature);
     }
 
-    // close after each write
-    ds_id = tgShapefile::CloseDatasource( ds_id );
+    tgShapefile::EndWrite( ds_id );
 }
 
 tgPolygon tgShapefile::ToPolygon( const void* subject )
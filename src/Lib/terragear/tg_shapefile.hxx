@@ -12,10 +12,25 @@ public:
 
     static void  FromClipper( const ClipperLib::Polygons& subject, const std::string& datasource, const std::string& layer, const std::string& description );
 
+    // Buffered debug output for the calling thread.  Between BeginSink and
+    // EndSink, datasources and layers stay open and features are committed
+    // in batches, instead of opening and closing the datasource per shape.
+    // Only every sample'th feature of a layer is written, and if layers is
+    // not empty, only layers starting with one of its prefixes.
+    static void  BeginSink( unsigned int sample = 1, const std::vector<std::string>& layers = std::vector<std::string>() );
+    static void  EndSink( void );
+
 private:
     static bool initialized;
 
     static void* OpenDatasource( const char* datasource_name );
     static void* OpenLayer( void* ds_id, const char* layer_name );
     static void* CloseDatasource( void* ds_id );
+
+    // open the layer through the thread's sink, or on its own.  Returns NULL
+    // if the sink filters the layer out.  ds_id is set when the caller has
+    // to close the datasource
+    static void* BeginWrite( const std::string& datasource, const std::string& layer, void** ds_id );
+    static void  WriteFeature( void* l_id, void* feature );
+    static void  EndWrite( void* ds_id );
 };
\ No newline at end of file
@@ -25,15 +25,26 @@
 #endif
 
 #include <simgear/compiler.h>
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+
 #include <simgear/constants.h>
 #include <simgear/math/SGMath.hxx>
 #include <simgear/debug/logstream.hxx>
+#include <simgear/bucket/newbucket.hxx>
 
 #include <Array/array.hxx>
 
 #include "TNT/jama_qr.h"
 #include "tg_surface.hxx"
 
+#if defined(__SSE2__) || defined(_M_X64) || ( defined(_M_IX86_FP) && _M_IX86_FP >= 2 )
+#  include <emmintrin.h>
+#  define TG_SURFACE_SSE2
+#endif
+
 // Final grid size for surface (in meters)
 const double coarse_grid = 300.0;
 
@@ -41,180 +52,88 @@ const double coarse_grid = 300.0;
 // this many meters of the average
 const double max_clamp = 100.0;
 
-static bool limit_slope( tgMatrix* Pts, int i1, int j1, int i2, int j2,
-                         double average_elev_m, double slope_max, double slope_eps )
+// limit the slope between two grid points, dist apart.  The point
+// furthest from the average elevation is moved towards the other.
+static inline bool limit_slope( double& e1, double& e2, double dist,
+                                double average_elev_m, double slope_max, double slope_eps )
 {
-    bool slope_error = false;
-
-    SGGeod p1, p2;
-    p1 = Pts->element(i1,j1);
-    p2 = Pts->element(i2,j2);
-
-    double dist = SGGeodesy::distanceM(p1, p2);
-    double slope = (p2.getElevationM() - p1.getElevationM()) / dist;
+    double slope = (e2 - e1) / dist;
 
-    if ( fabs(slope) > (slope_max + slope_eps) ) {
-        // need to throttle slope, let's move the point
-        // furthest away from average towards the center.
-
-        slope_error = true;
-
-        SG_LOG( SG_GENERAL, SG_DEBUG, " (a) detected slope of " << slope << " dist = " << dist );
+    if ( fabs(slope) <= (slope_max + slope_eps) ) {
+        return false;
+    }
 
-        double e1 = fabs(average_elev_m - p1.getElevationM());
-        double e2 = fabs(average_elev_m - p2.getElevationM());
+    // need to throttle slope, let's move the point
+    // furthest away from average towards the center.
+    SG_LOG( SG_GENERAL, SG_DEBUG, " (a) detected slope of " << slope << " dist = " << dist );
 
-        if ( e1 > e2 ) {
-            // p1 error larger
-            if ( slope > 0 ) {
-                p1.setElevationM( p2.getElevationM() - (dist * slope_max) );
-            } else {
-                p1.setElevationM( p2.getElevationM() + (dist * slope_max) );
-            }
-            Pts->set(i1, j1, p1);
+    if ( fabs(average_elev_m - e1) > fabs(average_elev_m - e2) ) {
+        // p1 error larger
+        if ( slope > 0 ) {
+            e1 = e2 - (dist * slope_max);
         } else {
-            // p2 error larger
-            if ( slope > 0 ) {
-                p2.setElevationM( p1.getElevationM() + (dist * slope_max) );
-            } else {
-                p2.setElevationM( p1.getElevationM() - (dist * slope_max) );
-            }
-            Pts->set(i2, j2, p2);
+            e1 = e2 + (dist * slope_max);
+        }
+    } else {
+        // p2 error larger
+        if ( slope > 0 ) {
+            e2 = e1 + (dist * slope_max);
+        } else {
+            e2 = e1 - (dist * slope_max);
         }
     }
 
-    return slope_error;
+    return true;
 }
 
 
-// lookup node elevations for each point in the specified simple
-// matrix.  Returns average of all points.
-static void tgCalcElevations( const std::string &root, const string_list elev_src,
-                              tgMatrix &Pts, const double average )
+// lookup node elevations for each point, one bucket at a time
+void tgCalcElevations( const std::string &root, const string_list& elev_src,
+                       const std::vector<SGGeod>& points, std::vector<double>& elevations )
 {
-    bool done = false;
-    int i, j;
-    TGArray array;
+    typedef std::map<long int, std::vector<unsigned int> > BucketPoints;
+    BucketPoints buckets;
 
-    // just bail if no work to do
-    if ( Pts.rows() == 0 || Pts.cols() == 0 ) {
-        return;
-    }
+    elevations.assign( points.size(), -9999.0 );
 
-    // set all elevations to -9999
-    for ( j = 0; j < Pts.rows(); ++j ) {
-        for ( i = 0; i < Pts.cols(); ++i ) {
-            SGGeod p = Pts.element(i, j);
-            p.setElevationM(-9999.0);
-            Pts.set(i, j, p);
-        }
+    for ( unsigned int i = 0; i < points.size(); ++i ) {
+        buckets[SGBucket( points[i] ).gen_index()].push_back( i );
     }
 
-    while ( !done ) {
-        // find first node with -9999 elevation
-        SGGeod first = SGGeod();
-        bool found_one = false;
-        for ( j = 0; j < Pts.rows(); ++j ) {
-            for ( i = 0; i < Pts.cols(); ++i ) {
-                SGGeod p = Pts.element(i,j);
-                if ( p.getElevationM() < -9000.0 && !found_one ) {
-                    first = p;
-                    found_one = true;
-                }
-            }
-        }
-
-        if ( found_one ) {
-            SGBucket b( first );
-            std::string base = b.gen_base_path();
+    for ( BucketPoints::const_iterator it = buckets.begin(); it != buckets.end(); ++it ) {
+        const std::vector<unsigned int>& indices = it->second;
+        SGBucket b( it->first );
+        std::string base = b.gen_base_path();
+        TGArray array;
 
-            // try the various elevation sources
-            j = 0;
-            bool found_file = false;
-            while ( !found_file && j < (int)elev_src.size() ) {
-                std::string array_path = root + "/" + elev_src[j] + "/" + base + "/" + b.gen_index_str();
+        // try the various elevation sources
+        for ( unsigned int j = 0; j < elev_src.size(); j++ ) {
+            std::string array_path = root + "/" + elev_src[j] + "/" + base + "/" + b.gen_index_str();
 
-                if ( array.open(array_path) ) {
-                    found_file = true;
-                    SG_LOG( SG_GENERAL, SG_DEBUG, "Using array_path = " << array_path );
-                }
-                j++;
+            if ( array.open(array_path) ) {
+                SG_LOG( SG_GENERAL, SG_DEBUG, "Using array_path = " << array_path );
+                break;
             }
-
-            // this will fill in a zero structure if no array data
-            // found/opened
-            array.parse( b );
-
-            // this will do a hasty job of removing voids by inserting
-            // data from the nearest neighbor (sort of)
-            array.remove_voids();
-
-            // update all the non-updated elevations that are inside
-            // this array file
-            double elev;
-            done = true;
-            for ( j = 0; j < Pts.rows(); ++j ) {
-                for ( i = 0; i < Pts.cols(); ++i ) {
-                    SGGeod p = Pts.element(i,j);
-                    if ( p.getElevationM() < -9000.0 ) {
-                        done = false;
-                        elev = array.altitude_from_grid( p.getLongitudeDeg() * 3600.0,
-                                                         p.getLatitudeDeg() * 3600.0 );
-                        if ( elev > -9000 ) {
-                            p.setElevationM( elev );
-                            Pts.set(i, j, p);
-                        }
-                    }
-                }
-            }
-
-            array.close();
-
-        } else {
-            done = true;
         }
-    }
 
-#ifdef DEBUG
-    // do some post processing for sanity's sake
-    // find the average height of the queried points
-    double total = 0.0;
-    int count = 0;
-    for ( j = 0; j < Pts.rows(); ++j ) {
-        for ( i = 0; i < Pts.cols(); ++i ) {
-            SGGeod p = Pts.element(i,j);
-            total += p.getElevationM();
-            count++;
-        }
-    }
-    double grid_average = total / (double) count;
-    SG_LOG(SG_GENERAL, SG_DEBUG, "Average surface height of matrix = " << grid_average);
-#endif
-}
+        // this will fill in a zero structure if no array data
+        // found/opened
+        array.parse( b );
 
-// clamp all elevations to the specified range
-static void tgClampElevations( tgMatrix& Pts,
-                               double center_m,
-                               double max_clamp_m )
-{
-    int i, j;
-
-    // go through the elevations and clamp all elevations to within
-    // +/-max_m of the center_m elevation.
-    for ( j = 0; j < Pts.rows(); ++j ) {
-        for ( i = 0; i < Pts.cols(); ++i ) {
-            SGGeod p = Pts.element(i,j);
-            if ( p.getElevationM() < center_m - max_clamp_m ) {
-                SG_LOG(SG_GENERAL, SG_DEBUG, "   clamping " << p.getElevationM() << " to " << center_m - max_clamp_m );
-                p.setElevationM( center_m - max_clamp_m );
-                Pts.set(i, j, p);
-            }
-            if ( p.getElevationM() > center_m + max_clamp_m ) {
-                SG_LOG(SG_GENERAL, SG_DEBUG, "   clamping " << p.getElevationM() << " to " << center_m + max_clamp_m );
-                p.setElevationM( center_m + max_clamp_m );
-                Pts.set(i, j, p);
+        // this will do a hasty job of removing voids by inserting
+        // data from the nearest neighbor (sort of)
+        array.remove_voids();
+
+        for ( unsigned int k = 0; k < indices.size(); ++k ) {
+            const SGGeod& p = points[indices[k]];
+            double elev = array.altitude_from_grid( p.getLongitudeDeg() * 3600.0,
+                                                    p.getLatitudeDeg() * 3600.0 );
+            if ( elev > -9000 ) {
+                elevations[indices[k]] = elev;
             }
         }
+
+        array.close();
     }
 }
 
@@ -260,73 +179,100 @@ tgSurface::tgSurface( const std::string& path,
 
     SG_LOG(SG_GENERAL, SG_DEBUG, "  M(" << ydivs << "," << xdivs << ")");
 
-    double dlon = x_deg / xdivs;
-    double dlat = y_deg / ydivs;
+    _dlon = x_deg / xdivs;
+    _dlat = y_deg / ydivs;
 
-    double dlon_h = dlon * 0.5;
-    double dlat_h = dlat * 0.5;
+    double dlon_h = _dlon * 0.5;
+    double dlat_h = _dlat * 0.5;
 
     // Build the extra res input grid (shifted SW by half (dlon,dlat)
     // with an added major row column on the NE sides.)
-    int mult = 10;
-    tgMatrix dPts( (xdivs + 1) * mult + 1, (ydivs + 1) * mult + 1 );
-    for ( int j = 0; j < dPts.rows(); ++j ) {
-        for ( int i = 0; i < dPts.cols(); ++i ) {
-            dPts.set(i, j, SGGeod::fromDegM( _min_deg.getLongitudeDeg() - dlon_h + i * (dlon / (double)mult),
-                     _min_deg.getLatitudeDeg() - dlat_h + j * (dlat / (double)mult),
-                     -9999 ) );
+    const int mult = 10;
+    int dcols = (xdivs + 1) * mult + 1;
+    int drows = (ydivs + 1) * mult + 1;
+
+    std::vector<SGGeod> dPts( dcols * drows );
+    for ( int j = 0; j < drows; ++j ) {
+        for ( int i = 0; i < dcols; ++i ) {
+            dPts[j * dcols + i] = SGGeod::fromDeg( _min_deg.getLongitudeDeg() - dlon_h + i * (_dlon / (double)mult),
+                                                   _min_deg.getLatitudeDeg() - dlat_h + j * (_dlat / (double)mult) );
         }
     }
 
     // Lookup the elevations of all the grid points
-    tgCalcElevations( path, elev_src, dPts, 0.0 );
+    std::vector<double> delev;
+    tgCalcElevations( path, elev_src, dPts, delev );
+    dPts.clear();
 
     // Clamp the elevations against the externally provided average
-    // elevation.
-    tgClampElevations( dPts, _average_elev_m, max_clamp );
+    // elevation, into a flat float grid
+    std::vector<float> dgrid( dcols * drows );
+    double clamp_min = _average_elev_m - max_clamp;
+    double clamp_max = _average_elev_m + max_clamp;
+    for ( unsigned int k = 0; k < delev.size(); ++k ) {
+        dgrid[k] = (float)std::min( std::max( delev[k], clamp_min ), clamp_max );
+    }
+
+    // Build the normal res input grid from the extra res version : a box
+    // filter over (mult+1) x (mult+1) points, summed along the rows first
+    _cols = xdivs + 1;
+    _rows = ydivs + 1;
+    _elev.resize( _cols * _rows );
+
+    std::vector<double> row_sums( _cols * drows );
+    for ( int jj = 0; jj < drows; ++jj ) {
+        const float* row = &dgrid[jj * dcols];
+        for ( int i = 0; i < _cols; ++i ) {
+            double accum = 0.0;
+            for ( int ii = 0; ii <= mult; ++ii ) {
+                accum += row[mult*i + ii];
+            }
+            row_sums[jj * _cols + i] = accum;
+        }
+    }
 
-    // Build the normal res input grid from the double res version
-    Pts = new tgMatrix(xdivs + 1, ydivs + 1 );
     double ave_divider = (mult+1) * (mult+1);
-    for ( int j = 0; j < Pts->rows(); ++j ) {
-        for ( int i = 0; i < Pts->cols(); ++i ) {
-            SG_LOG(SG_GENERAL, SG_DEBUG, i << "," << j);
+    for ( int j = 0; j < _rows; ++j ) {
+        for ( int i = 0; i < _cols; ++i ) {
             double accum = 0.0;
-            double lon_accum = 0.0;
-            double lat_accum = 0.0;
             for ( int jj = 0; jj <= mult; ++jj ) {
-                for ( int ii = 0; ii <= mult; ++ii ) {
-                    double value = dPts.element(mult*i + ii, mult*j + jj).getElevationM();
-                    SG_LOG( SG_GENERAL, SG_DEBUG, "value = " << value );
-                    accum += value;
-                    lon_accum += dPts.element(mult*i + ii, mult*j + jj).getLongitudeDeg();
-                    lat_accum += dPts.element(mult*i + ii, mult*j + jj).getLatitudeDeg();
-                }
+                accum += row_sums[(mult*j + jj) * _cols + i];
             }
-            double val_ave = accum / ave_divider;
-
-            SG_LOG( SG_GENERAL, SG_DEBUG, "  val_ave = " << val_ave );
-            Pts->set(i, j, SGGeod::fromDegM( _min_deg.getLongitudeDeg() + i * dlon,
-				    _min_deg.getLatitudeDeg() + j * dlat,
-				    val_ave )
-		    );
+            _elev[j * _cols + i] = accum / ave_divider;
         }
     }
 
+    // The grid is regular, so the length of each kind of edge only
+    // depends on the row
+    std::vector<double> dist_x( _rows ), dist_y( _rows ), dist_xy( _rows );
+    for ( int j = 0; j < _rows - 1; ++j ) {
+        SGGeod p  = SGGeod::fromDeg( _min_deg.getLongitudeDeg(),         _min_deg.getLatitudeDeg() + j * _dlat );
+        SGGeod px = SGGeod::fromDeg( _min_deg.getLongitudeDeg() + _dlon, _min_deg.getLatitudeDeg() + j * _dlat );
+        SGGeod py = SGGeod::fromDeg( _min_deg.getLongitudeDeg(),         _min_deg.getLatitudeDeg() + (j+1) * _dlat );
+        SGGeod pxy = SGGeod::fromDeg( _min_deg.getLongitudeDeg() + _dlon, _min_deg.getLatitudeDeg() + (j+1) * _dlat );
+
+        dist_x[j]  = SGGeodesy::distanceM( p, px );
+        dist_y[j]  = SGGeodesy::distanceM( p, py );
+        dist_xy[j] = SGGeodesy::distanceM( p, pxy );
+    }
+
     bool slope_error = true;
     while ( slope_error ) {
         SG_LOG( SG_GENERAL, SG_DEBUG, "start of slope processing pass" );
         slope_error = false;
         // Add some "slope" sanity to the resulting surface grid points
-        for ( int j = 0; j < Pts->rows() - 1; ++j ) {
-            for ( int i = 0; i < Pts->cols() - 1; ++i ) {
-                if ( limit_slope( Pts, i, j, i+1, j, _average_elev_m, slope_max, slope_eps ) ) {
+        for ( int j = 0; j < _rows - 1; ++j ) {
+            double* row  = &_elev[j * _cols];
+            double* next = &_elev[(j+1) * _cols];
+
+            for ( int i = 0; i < _cols - 1; ++i ) {
+                if ( limit_slope( row[i], row[i+1], dist_x[j], _average_elev_m, slope_max, slope_eps ) ) {
                     slope_error = true;
                 }
-                if ( limit_slope( Pts, i, j, i, j+1, _average_elev_m, slope_max, slope_eps ) ) {
+                if ( limit_slope( row[i], next[i], dist_y[j], _average_elev_m, slope_max, slope_eps ) ) {
                     slope_error = true;
                 }
-                if ( limit_slope( Pts, i, j, i+1, j+1, _average_elev_m, slope_max, slope_eps ) ) {
+                if ( limit_slope( row[i], next[i+1], dist_xy[j], _average_elev_m, slope_max, slope_eps ) ) {
                     slope_error = true;
                 }
             }
@@ -347,7 +293,6 @@ tgSurface::tgSurface( const std::string& path,
 
 
 tgSurface::~tgSurface() {
-    delete Pts;
 }
 
 
@@ -361,7 +306,7 @@ void tgSurface::fit() {
     //          A9*x*x*x + A10*x*x*x*y + A11*x*x*x*y*y + A12*x*x*x*y*y*y +
     //            A13*y*y*y + A14*x*y*y*y + A15*x*x*y*y*y
 
-    int nobs = Pts->cols() * Pts->rows();	// number of observations
+    int nobs = _cols * _rows;	// number of observations
 
     SG_LOG(SG_GENERAL, SG_DEBUG, "QR triangularisation" );
 
@@ -372,13 +317,12 @@ void tgSurface::fit() {
     TNT::Array1D<double> zmat(nobs);
 
     // generate the required fit data
-    for ( int j = 0; j < Pts->rows(); j++ ) {
-        for ( int i = 0; i < Pts->cols(); i++ ) {
-            SGGeod p = Pts->element( i, j );
-            int index = ( j * Pts->cols() ) + i;
-            double x = p.getLongitudeDeg() - area_center.getLongitudeDeg();
-            double y = p.getLatitudeDeg() - area_center.getLatitudeDeg();
-            double z = p.getElevationM() - area_center.getElevationM();
+    for ( int j = 0; j < _rows; j++ ) {
+        for ( int i = 0; i < _cols; i++ ) {
+            int index = ( j * _cols ) + i;
+            double x = _min_deg.getLongitudeDeg() + i * _dlon - area_center.getLongitudeDeg();
+            double y = _min_deg.getLatitudeDeg() + j * _dlat - area_center.getLatitudeDeg();
+            double z = _elev[index] - area_center.getElevationM();
 
             zmat[index] = z;
 
@@ -405,6 +349,28 @@ void tgSurface::fit() {
     JAMA::QR<double> qr( mat );
     // find the least squares solution using the QR factors
     surface_coefficients = qr.solve(zmat);
+
+    // regroup the coefficients by powers of x and y for evaluation
+    const TNT::Array1D<double>& A = surface_coefficients;
+    double poly[4][4] = {
+        { A[0],  A[3],  A[7],  A[13] },
+        { A[1],  A[2],  A[8],  A[14] },
+        { A[4],  A[5],  A[6],  A[15] },
+        { A[9],  A[10], A[11], A[12] }
+    };
+    memcpy( _poly, poly, sizeof(_poly) );
+}
+
+// evaluate the fitted polynomial, x and y relative to area_center
+double tgSurface::evaluate( double x, double y ) const
+{
+    double c[4];
+
+    for ( int i = 0; i < 4; i++ ) {
+        c[i] = ((_poly[i][3] * y + _poly[i][2]) * y + _poly[i][1]) * y + _poly[i][0];
+    }
+
+    return ((c[3] * x + c[2]) * x + c[1]) * x + c[0] + area_center.getElevationM();
 }
 
 
@@ -419,22 +385,70 @@ double tgSurface::query( SGGeod query ) const {
     }
 
     // compute the function with solved coefficients
+    return evaluate( query.getLongitudeDeg() - area_center.getLongitudeDeg(),
+                     query.getLatitudeDeg() - area_center.getLatitudeDeg() );
+}
 
-    // the fit function is:
-    // f(x,y) = A1*x + A2*x*y + A3*y +
-    //          A4*x*x + A5+x*x*y + A6*x*x*y*y + A7*y*y + A8*x*y*y +
-    //          A9*x*x*x + A10*x*x*x*y + A11*x*x*x*y*y + A12*x*x*x*y*y*y +
-    //            A13*y*y*y + A14*x*y*y*y + A15*x*x*y*y*y
+// Query the elevations of a list of points, -9999 for those out of range
+void tgSurface::query( const std::vector<SGGeod>& points, std::vector<double>& elevations ) const
+{
+    unsigned int n = points.size();
+    unsigned int outside = 0;
+    std::vector<double> x( n ), y( n );
 
-    double x = query.getLongitudeDeg() - area_center.getLongitudeDeg();
-    double y = query.getLatitudeDeg() - area_center.getLatitudeDeg();
-    TNT::Array1D<double> A = surface_coefficients;
+    elevations.resize( n );
 
-    double result = A[0] + A[1]*x + A[2]*x*y + A[3]*y + A[4]*x*x + A[5]*x*x*y
-    + A[6]*x*x*y*y + A[7]*y*y + A[8]*x*y*y + A[9]*x*x*x + A[10]*x*x*x*y
-    + A[11]*x*x*x*y*y + A[12]*x*x*x*y*y*y + A[13]*y*y*y + A[14]*x*y*y*y
-    + A[15]*x*x*y*y*y;
-    result += area_center.getElevationM();
+    for ( unsigned int i = 0; i < n; ++i ) {
+        if ( _aptBounds.isInside( points[i] ) ) {
+            x[i] = points[i].getLongitudeDeg() - area_center.getLongitudeDeg();
+            y[i] = points[i].getLatitudeDeg() - area_center.getLatitudeDeg();
+        } else {
+            x[i] = y[i] = 0.0;
+            outside++;
+        }
+    }
+
+    unsigned int i = 0;
+
+#ifdef TG_SURFACE_SSE2
+    // same operations, in the same order, as evaluate() - two points at a time
+    __m128d p[4][4];
+    for ( int k = 0; k < 4; k++ ) {
+        for ( int l = 0; l < 4; l++ ) {
+            p[k][l] = _mm_set1_pd( _poly[k][l] );
+        }
+    }
+    __m128d center = _mm_set1_pd( area_center.getElevationM() );
+
+    for ( ; i + 2 <= n; i += 2 ) {
+        __m128d vx = _mm_loadu_pd( &x[i] );
+        __m128d vy = _mm_loadu_pd( &y[i] );
+        __m128d c[4];
+
+        for ( int k = 0; k < 4; k++ ) {
+            c[k] = _mm_add_pd( _mm_mul_pd( p[k][3], vy ), p[k][2] );
+            c[k] = _mm_add_pd( _mm_mul_pd( c[k], vy ), p[k][1] );
+            c[k] = _mm_add_pd( _mm_mul_pd( c[k], vy ), p[k][0] );
+        }
 
-    return result;
-}
\ No newline at end of file
+        __m128d r = _mm_add_pd( _mm_mul_pd( c[3], vx ), c[2] );
+        r = _mm_add_pd( _mm_mul_pd( r, vx ), c[1] );
+        r = _mm_add_pd( _mm_mul_pd( r, vx ), c[0] );
+
+        _mm_storeu_pd( &elevations[i], _mm_add_pd( r, center ) );
+    }
+#endif
+
+    for ( ; i < n; ++i ) {
+        elevations[i] = evaluate( x[i], y[i] );
+    }
+
+    if ( outside ) {
+        for ( i = 0; i < n; ++i ) {
+            if ( !_aptBounds.isInside( points[i] ) ) {
+                elevations[i] = -9999.0;
+            }
+        }
+        SG_LOG(SG_GENERAL, SG_WARN, "Warning: " << outside << " queries out of bounds for fitted surface!");
+    }
+}
@@ -30,58 +30,11 @@
 #include "TNT/tnt_array2d.h"
 #include "tg_polygon.hxx"
 
-/***
- * A dirt simple matrix class for our convenience based on top of SGGeod
- */
-class tgMatrix {
-
-typedef std::vector<SGGeod>  GeodRow;
-typedef std::vector<GeodRow> GeodMatrix;
-
-public:
-    inline tgMatrix( unsigned int columns, unsigned int rows ) {
-        _cols = columns;
-        _rows = rows;
-
-        m.resize( rows );
-        for (unsigned int i=0; i<rows; i++ ) {
-            m[i].resize( columns );
-        }
-    }
-
-    inline SGGeod const& element( unsigned int col, unsigned int row ) const {
-        //int index = ( row * _cols ) + col;
-        if ( col < 0 || col >= _cols ) {
-            SG_LOG(SG_GENERAL, SG_WARN, "column out of bounds on read (" << col << " >= " << _cols << ")");
-            int *p = 0; *p = 1; // force crash
-        } else if ( row < 0 || row >= _rows ) {
-            SG_LOG(SG_GENERAL, SG_WARN, "row out of bounds on read (" << row << " >= " << _rows << ")");
-            int *p = 0; *p = 1; // force crash
-        }
-
-        return m[row][col];
-    }
-
-    inline void set( unsigned int col, unsigned int row, const SGGeod& p ) {
-        //int index = ( row * _cols ) + col;
-        if ( col < 0 || col >= _cols ) {
-            SG_LOG(SG_GENERAL, SG_WARN,"column out of bounds on set (" << col << " >= " << _cols << ")");
-            int *p = 0; *p = 1; // force crash
-        } else if ( row < 0 || row >= _rows ) {
-            SG_LOG(SG_GENERAL, SG_WARN,"row out of bounds on set (" << row << " >= " << _rows << ")");
-            int *p = 0; *p = 1; // force crash
-        }
-        m[row][col] = p;
-    }
-
-    inline int cols() const { return _cols; }
-    inline int rows() const { return _rows; }
-
-private:
-    unsigned int _rows;
-    unsigned int _cols;
-    GeodMatrix m;
-};
+// Look up the DEM elevation of each point.  Points are grouped by
+// bucket, so each bucket's array is opened, parsed and void filled once.
+// Points without elevation data are set to -9999.
+void tgCalcElevations( const std::string &root, const string_list& elev_src,
+                       const std::vector<SGGeod>& points, std::vector<double>& elevations );
 
 /***
  * Note of explanation.  When a tgSurface instance is created, you
@@ -119,11 +72,24 @@ public:
     // proportional to u,v space on the nurbs surface which it isn't.
     double query( SGGeod query ) const;
 
+    // Query the elevations of a list of points in one pass, -9999 for
+    // those out of range.  Gives the same results as query() per point.
+    void query( const std::vector<SGGeod>& points, std::vector<double>& elevations ) const;
+
 private:
-    // The actual nurbs surface approximation for the airport
-    tgMatrix* Pts;
+    // The coarse grid the surface is fitted to : _cols x _rows
+    // elevations, row major, starting at _min_deg and spaced _dlon, _dlat
+    int _cols, _rows;
+    double _dlon, _dlat;
+    std::vector<double> _elev;
+
     TNT::Array1D<double> surface_coefficients;
 
+    // surface_coefficients by power : _poly[i][j] is the x^i * y^j term
+    double _poly[4][4];
+
+    double evaluate( double x, double y ) const;
+
     tgRectangle _aptBounds;
     SGGeod _min_deg, _max_deg;
 
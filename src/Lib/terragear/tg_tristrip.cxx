@@ -0,0 +1,418 @@
+#include <algorithm>
+#include <cmath>
+#include <deque>
+
+#include <boost/unordered_map.hpp>
+
+#include "tg_tristrip.hxx"
+
+// Forsyth vertex scoring constants - from the original paper
+#define TG_CACHE_DECAY_POWER    (1.5f)
+#define TG_LAST_TRI_SCORE       (0.75f)
+#define TG_VALENCE_BOOST_SCALE  (2.0f)
+#define TG_VALENCE_BOOST_POWER  (0.5f)
+
+typedef boost::unordered_map<unsigned long long, int> tg_edge_map;
+
+static inline unsigned long long EdgeKey( int a, int b )
+{
+    return ( (unsigned long long)(unsigned int)a << 32 ) | (unsigned int)b;
+}
+
+// build the vertex -> triangle lookup as compressed rows
+static int BuildVertexTris( const tgIndexList& tris, std::vector<unsigned int>& offsets, std::vector<int>& vtx_tris )
+{
+    int num_verts = 0;
+    for ( unsigned int i = 0; i < tris.size(); i++ ) {
+        num_verts = std::max( num_verts, tris[i] + 1 );
+    }
+
+    offsets.assign( num_verts + 1, 0 );
+    for ( unsigned int i = 0; i < tris.size(); i++ ) {
+        offsets[tris[i] + 1]++;
+    }
+    for ( int v = 0; v < num_verts; v++ ) {
+        offsets[v + 1] += offsets[v];
+    }
+
+    std::vector<unsigned int> fill( offsets.begin(), offsets.end() - 1 );
+    vtx_tris.resize( tris.size() );
+    for ( unsigned int i = 0; i < tris.size(); i++ ) {
+        vtx_tris[fill[tris[i]]++] = i / 3;
+    }
+
+    return num_verts;
+}
+
+static void FeedCache( std::deque<int>& cache, unsigned int cache_size, int v, unsigned int* misses )
+{
+    if ( std::find( cache.begin(), cache.end(), v ) == cache.end() ) {
+        cache.push_back( v );
+        if ( cache.size() > cache_size ) {
+            cache.pop_front();
+        }
+        if ( misses ) {
+            (*misses)++;
+        }
+    }
+}
+
+static float VertexScore( int cache_pos, unsigned int remaining, unsigned int cache_size )
+{
+    if ( remaining == 0 ) {
+        // no triangles left - never pick this vertex
+        return -1.0f;
+    }
+
+    float score = 0.0f;
+    if ( cache_pos >= 0 ) {
+        if ( cache_pos < 3 ) {
+            // used by the last triangle - fixed score so we don't favour
+            // any particular direction of the previous triangle
+            score = TG_LAST_TRI_SCORE;
+        } else {
+            float scaler = 1.0f / ( cache_size - 3 );
+            score = powf( 1.0f - ( cache_pos - 3 ) * scaler, TG_CACHE_DECAY_POWER );
+        }
+    }
+
+    // bonus for vertices with few triangles left, so we don't leave lone triangles behind
+    score += TG_VALENCE_BOOST_SCALE * powf( (float)remaining, -TG_VALENCE_BOOST_POWER );
+
+    return score;
+}
+
+void tgTriStripper::OptimizeVertexCache( tgIndexList& tris, unsigned int cache_size )
+{
+    unsigned int num_tris = tris.size() / 3;
+    if ( num_tris < 2 ) {
+        return;
+    }
+    cache_size = std::max( cache_size, 4u );
+
+    std::vector<unsigned int> offsets;
+    std::vector<int>          vtx_tris;
+    int num_verts = BuildVertexTris( tris, offsets, vtx_tris );
+
+    // the first 'remaining' entries of each row are the triangles not yet emitted
+    std::vector<unsigned int> remaining( num_verts );
+    std::vector<int>          cache_pos( num_verts, -1 );
+    std::vector<float>        vtx_score( num_verts );
+    for ( int v = 0; v < num_verts; v++ ) {
+        remaining[v] = offsets[v + 1] - offsets[v];
+        vtx_score[v] = VertexScore( -1, remaining[v], cache_size );
+    }
+
+    std::vector<float> tri_score( num_tris );
+    std::vector<bool>  emitted( num_tris, false );
+    int best = -1;
+    for ( unsigned int t = 0; t < num_tris; t++ ) {
+        tri_score[t] = vtx_score[tris[3*t]] + vtx_score[tris[3*t+1]] + vtx_score[tris[3*t+2]];
+        if ( best < 0 || tri_score[t] > tri_score[best] ) {
+            best = t;
+        }
+    }
+
+    tgIndexList      result;
+    std::vector<int> cache, new_cache;
+    unsigned int     cursor = 0;
+
+    result.reserve( tris.size() );
+    cache.reserve( cache_size + 3 );
+    new_cache.reserve( cache_size + 3 );
+
+    for ( unsigned int n = 0; n < num_tris; n++ ) {
+        if ( best < 0 ) {
+            // nothing in the cache touches a remaining triangle - restart from the first one left
+            while ( emitted[cursor] ) {
+                cursor++;
+            }
+            best = cursor;
+        }
+
+        emitted[best] = true;
+        new_cache.clear();
+        for ( unsigned int i = 0; i < 3; i++ ) {
+            int v = tris[3*best+i];
+            result.push_back( v );
+
+            // remove the triangle from the vertex's remaining list
+            for ( unsigned int j = offsets[v]; j < offsets[v] + remaining[v]; j++ ) {
+                if ( vtx_tris[j] == best ) {
+                    std::swap( vtx_tris[j], vtx_tris[offsets[v] + remaining[v] - 1] );
+                    remaining[v]--;
+                    break;
+                }
+            }
+
+            if ( std::find( new_cache.begin(), new_cache.end(), v ) == new_cache.end() ) {
+                new_cache.push_back( v );
+            }
+        }
+
+        // LRU : the triangle's vertices go to the front
+        for ( unsigned int i = 0; i < cache.size(); i++ ) {
+            if ( std::find( new_cache.begin(), new_cache.end(), cache[i] ) == new_cache.end() ) {
+                new_cache.push_back( cache[i] );
+            }
+        }
+
+        // rescore the cached vertices (including the ones falling out), and
+        // every remaining triangle that uses them
+        best = -1;
+        for ( unsigned int i = 0; i < new_cache.size(); i++ ) {
+            int v = new_cache[i];
+            cache_pos[v] = ( i < cache_size ) ? (int)i : -1;
+            vtx_score[v] = VertexScore( cache_pos[v], remaining[v], cache_size );
+        }
+        for ( unsigned int i = 0; i < new_cache.size(); i++ ) {
+            int v = new_cache[i];
+            for ( unsigned int j = offsets[v]; j < offsets[v] + remaining[v]; j++ ) {
+                int t = vtx_tris[j];
+                tri_score[t] = vtx_score[tris[3*t]] + vtx_score[tris[3*t+1]] + vtx_score[tris[3*t+2]];
+                if ( best < 0 || tri_score[t] > tri_score[best] ) {
+                    best = t;
+                }
+            }
+        }
+
+        if ( new_cache.size() > cache_size ) {
+            new_cache.resize( cache_size );
+        }
+        cache.swap( new_cache );
+    }
+
+    tris.swap( result );
+}
+
+unsigned int tgTriStripper::CountCacheMisses( const tgIndexGroupList& strips, const tgIndexList& tris, unsigned int cache_size )
+{
+    std::deque<int> cache;
+    unsigned int    misses = 0;
+
+    for ( unsigned int i = 0; i < strips.size(); i++ ) {
+        for ( unsigned int j = 0; j < strips[i].size(); j++ ) {
+            FeedCache( cache, cache_size, strips[i][j], &misses );
+        }
+    }
+    for ( unsigned int i = 0; i < tris.size(); i++ ) {
+        FeedCache( cache, cache_size, tris[i], &misses );
+    }
+
+    return misses;
+}
+
+double tgTriStripper::CalcACMR( const tgIndexGroupList& strips, const tgIndexList& tris, unsigned int cache_size )
+{
+    unsigned int num_tris = tris.size() / 3;
+    for ( unsigned int i = 0; i < strips.size(); i++ ) {
+        if ( strips[i].size() > 2 ) {
+            num_tris += strips[i].size() - 2;
+        }
+    }
+
+    if ( num_tris == 0 ) {
+        return 0.0;
+    }
+
+    return (double)CountCacheMisses( strips, tris, cache_size ) / (double)num_tris;
+}
+
+// Count the unused neighbours of a triangle - strips are best started
+// on triangles that have few ways out
+static unsigned int UnusedNeighbours( const tgIndexList& tris, const tg_edge_map& edges, const std::vector<bool>& used, int t )
+{
+    unsigned int count = 0;
+
+    for ( unsigned int e = 0; e < 3; e++ ) {
+        tg_edge_map::const_iterator it = edges.find( EdgeKey( tris[3*t+(e+1)%3], tris[3*t+e] ) );
+        if ( it != edges.end() && !used[it->second] ) {
+            count++;
+        }
+    }
+
+    return count;
+}
+
+// Grow a strip from triangle t, starting with the given rotation of its vertices
+static void WalkStrip( const tgIndexList& tris, const tg_edge_map& edges, const std::vector<bool>& used,
+                       std::vector<unsigned int>& stamp, unsigned int cur_stamp,
+                       int t, unsigned int rot, tgIndexList& strip, tgIndexList& strip_tris )
+{
+    strip.clear();
+    strip_tris.clear();
+
+    for ( unsigned int i = 0; i < 3; i++ ) {
+        strip.push_back( tris[3*t+(rot+i)%3] );
+    }
+    strip_tris.push_back( t );
+    stamp[t] = cur_stamp;
+
+    while ( true ) {
+        // odd triangles in a strip are wound (last, prev, next), even ones (prev, last, next)
+        int prev = strip[strip.size()-2];
+        int last = strip[strip.size()-1];
+        int a    = ( strip_tris.size() % 2 ) ? last : prev;
+        int b    = ( strip_tris.size() % 2 ) ? prev : last;
+
+        tg_edge_map::const_iterator it = edges.find( EdgeKey( a, b ) );
+        if ( it == edges.end() ) {
+            break;
+        }
+
+        int nt = it->second;
+        if ( used[nt] || stamp[nt] == cur_stamp ) {
+            break;
+        }
+
+        for ( unsigned int e = 0; e < 3; e++ ) {
+            if ( tris[3*nt+e] == a && tris[3*nt+(e+1)%3] == b ) {
+                strip.push_back( tris[3*nt+(e+2)%3] );
+                break;
+            }
+        }
+        strip_tris.push_back( nt );
+        stamp[nt] = cur_stamp;
+    }
+}
+
+void tgTriStripper::Stripify( const tgIndexList& tris, tgIndexGroupList& strips, tgIndexList& leftover ) const
+{
+    unsigned int num_tris = tris.size() / 3;
+
+    strips.clear();
+    leftover.clear();
+
+    if ( num_tris == 0 ) {
+        return;
+    }
+
+    std::vector<bool> used( num_tris, false );
+    tg_edge_map       edges;
+
+    // index every directed edge - degenerate triangles can't be stripped
+    for ( unsigned int t = 0; t < num_tris; t++ ) {
+        int a = tris[3*t], b = tris[3*t+1], c = tris[3*t+2];
+        if ( a == b || b == c || c == a ) {
+            used[t] = true;
+            leftover.push_back( a );
+            leftover.push_back( b );
+            leftover.push_back( c );
+            continue;
+        }
+
+        edges.insert( std::make_pair( EdgeKey( a, b ), (int)t ) );
+        edges.insert( std::make_pair( EdgeKey( b, c ), (int)t ) );
+        edges.insert( std::make_pair( EdgeKey( c, a ), (int)t ) );
+    }
+
+    std::vector<unsigned int> offsets;
+    std::vector<int>          vtx_tris;
+    BuildVertexTris( tris, offsets, vtx_tris );
+
+    std::vector<unsigned int> stamp( num_tris, 0 );
+    unsigned int              cur_stamp = 0;
+    unsigned int              cursor = 0;
+    std::deque<int>           cache;
+    tgIndexList               strip, strip_tris;
+    tgIndexList               best_strip, best_tris;
+
+    while ( true ) {
+        // prefer a start triangle touching the vertex cache, so the new
+        // strip reuses what the last one left behind
+        int          start = -1;
+        unsigned int start_degree = 4;
+
+        for ( std::deque<int>::reverse_iterator cit = cache.rbegin(); cit != cache.rend(); ++cit ) {
+            for ( unsigned int j = offsets[*cit]; j < offsets[*cit + 1]; j++ ) {
+                int t = vtx_tris[j];
+                if ( !used[t] ) {
+                    unsigned int degree = UnusedNeighbours( tris, edges, used, t );
+                    if ( degree < start_degree ) {
+                        start = t;
+                        start_degree = degree;
+                    }
+                }
+            }
+        }
+
+        if ( start < 0 ) {
+            while ( cursor < num_tris && used[cursor] ) {
+                cursor++;
+            }
+            if ( cursor == num_tris ) {
+                break;
+            }
+            start = cursor;
+        }
+
+        // try all three rotations of the start triangle, and keep the longest
+        best_strip.clear();
+        best_tris.clear();
+        for ( unsigned int rot = 0; rot < 3; rot++ ) {
+            WalkStrip( tris, edges, used, stamp, ++cur_stamp, start, rot, strip, strip_tris );
+            if ( strip_tris.size() > best_tris.size() ) {
+                best_strip.swap( strip );
+                best_tris.swap( strip_tris );
+            }
+        }
+
+        for ( unsigned int i = 0; i < best_tris.size(); i++ ) {
+            used[best_tris[i]] = true;
+        }
+
+        if ( best_tris.size() >= min_strip_len ) {
+            for ( unsigned int i = 0; i < best_strip.size(); i++ ) {
+                FeedCache( cache, cache_size, best_strip[i], NULL );
+            }
+            strips.push_back( best_strip );
+        } else {
+            // too short to be worth the strip header - keep the original triangles
+            for ( unsigned int i = 0; i < best_tris.size(); i++ ) {
+                for ( unsigned int j = 0; j < 3; j++ ) {
+                    int v = tris[3*best_tris[i]+j];
+                    FeedCache( cache, cache_size, v, NULL );
+                    leftover.push_back( v );
+                }
+            }
+        }
+    }
+
+    OptimizeVertexCache( leftover, cache_size );
+}
+
+void tgTriStripper::FirstUseOrder( const tgIndexGroupList& strips, const tgIndexGroupList& tris, unsigned int num_verts, tgIndexList& remap )
+{
+    int next = 0;
+
+    remap.assign( num_verts, -1 );
+    for ( unsigned int i = 0; i < strips.size(); i++ ) {
+        for ( unsigned int j = 0; j < strips[i].size(); j++ ) {
+            if ( remap[strips[i][j]] < 0 ) {
+                remap[strips[i][j]] = next++;
+            }
+        }
+    }
+    for ( unsigned int i = 0; i < tris.size(); i++ ) {
+        for ( unsigned int j = 0; j < tris[i].size(); j++ ) {
+            if ( remap[tris[i][j]] < 0 ) {
+                remap[tris[i][j]] = next++;
+            }
+        }
+    }
+
+    for ( unsigned int i = 0; i < num_verts; i++ ) {
+        if ( remap[i] < 0 ) {
+            remap[i] = next++;
+        }
+    }
+}
+
+void tgTriStripper::Remap( tgIndexGroupList& groups, const tgIndexList& remap )
+{
+    for ( unsigned int i = 0; i < groups.size(); i++ ) {
+        for ( unsigned int j = 0; j < groups[i].size(); j++ ) {
+            groups[i][j] = remap[groups[i][j]];
+        }
+    }
+}
@@ -0,0 +1,66 @@
+#ifndef _TG_TRISTRIP_HXX
+#define _TG_TRISTRIP_HXX
+
+#ifndef __cplusplus
+# error This library requires C++
+#endif
+
+#include <vector>
+
+// Triangle strip generation and vertex cache optimization for btg output.
+//
+// Triangles are passed in as a flat index list, 3 indices per triangle.  An
+// index identifies a unique output vertex - in a btg, that is a unique
+// combination of node, normal and texture coordinate.  Triangles must be
+// wound consistently : a strip is only continued across an edge when the
+// neighbour traverses that edge in the opposite direction, so the winding
+// of every triangle in a strip is preserved.
+
+typedef std::vector<int>              tgIndexList;
+typedef std::vector<tgIndexList>      tgIndexGroupList;
+
+class tgTriStripper
+{
+public:
+    tgTriStripper( unsigned int cache = 16, unsigned int min_len = 4 ) {
+        cache_size    = cache;
+        min_strip_len = min_len;
+    }
+
+    // Split tris into strips of at least min_strip_len triangles.  Whatever
+    // can't be stripped is returned in leftover, reordered for the vertex cache
+    void Stripify( const tgIndexList& tris, tgIndexGroupList& strips, tgIndexList& leftover ) const;
+
+    // Reorder a triangle list for a post transform vertex cache
+    // (Tom Forsyth's linear-speed vertex cache optimization)
+    static void OptimizeVertexCache( tgIndexList& tris, unsigned int cache_size );
+
+    // Simulate a fifo vertex cache over strips and a triangle list,
+    // and return the number of vertices transformed
+    static unsigned int CountCacheMisses( const tgIndexGroupList& strips, const tgIndexList& tris, unsigned int cache_size );
+
+    // Average cache miss ratio : vertices transformed per triangle
+    static double CalcACMR( const tgIndexGroupList& strips, const tgIndexList& tris, unsigned int cache_size );
+
+    // Number num_verts vertices in the order the strips, then the triangles first
+    // reference them.  Unreferenced vertices keep their relative order at the
+    // end.  remap[old] = new
+    static void FirstUseOrder( const tgIndexGroupList& strips, const tgIndexGroupList& tris, unsigned int num_verts, tgIndexList& remap );
+
+    // Apply a renumbering to index groups, or permute an attribute array by it
+    static void Remap( tgIndexGroupList& groups, const tgIndexList& remap );
+    template <class T>
+    static void Permute( std::vector<T>& list, const tgIndexList& remap ) {
+        std::vector<T> result( list.size() );
+        for ( unsigned int i = 0; i < list.size(); i++ ) {
+            result[remap[i]] = list[i];
+        }
+        list.swap( result );
+    }
+
+private:
+    unsigned int cache_size;
+    unsigned int min_strip_len;
+};
+
+#endif // _TG_TRISTRIP_HXX
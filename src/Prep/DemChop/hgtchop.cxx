@@ -28,11 +28,18 @@
 
 #include <string>
 #include <iostream>
+#include <vector>
+#include <algorithm>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
 
 #include <simgear/bucket/newbucket.hxx>
 #include <simgear/debug/logstream.hxx>
 #include <simgear/misc/sg_path.hxx>
 #include <simgear/misc/sg_dir.hxx>
+#include <simgear/threads/SGThread.hxx>
+#include <simgear/threads/SGGuard.hxx>
 
 #include <Include/version.h>
 #include <HGT/hgt.hxx>
@@ -44,67 +51,114 @@ using std::endl;
 using std::string;
 
 
+// hgt files shared out to the chop threads
+struct HgtJob {
+    int                     resolution;
+    std::vector<string>     files;
+    string                  work_dir;
+    int                     compression;
+    unsigned int            bucket_threads;
+
+    unsigned int            next;
+    SGMutex                 lock;
+};
+
+static void chop_file( HgtJob& job, const string& hgt_name )
+{
+    TGHgt hgt(job.resolution, hgt_name);
+    hgt.set_compression_level( job.compression );
+    hgt.load();
+    hgt.close();
+
+    hgt.write_areas( job.work_dir, 20, job.bucket_threads );
+}
+
+static void chop_thread( HgtJob* job )
+{
+    while ( true ) {
+        string hgt_name;
+        {
+            SGGuard<SGMutex> g(job->lock);
+            if ( job->next >= job->files.size() ) {
+                break;
+            }
+            hgt_name = job->files[job->next++];
+        }
+
+        chop_file( *job, hgt_name );
+    }
+}
+
+static void usage( const char* progname ) {
+    cout << "Usage " << progname << " [--threads=<n>] [--compression=<0-9>] <resolution> <hgt_file...> <work_dir>"
+         << endl;
+    cout << endl;
+    cout << "\tresolution must be either 1 or 3 for 1arcsec or 3arcsec"
+         << endl;
+    exit(-1);
+}
+
 int main(int argc, char **argv) {
     sglog().setLogLevels( SG_ALL, SG_WARN );
     SG_LOG( SG_GENERAL, SG_ALERT, "hgtchop version " << getTGVersion() << "\n" );
 
-    if ( argc != 4 ) {
-	cout << "Usage " << argv[0] << " <resolution> <hgt_file> <work_dir>"
-             << endl;
-        cout << endl;
- 	cout << "\tresolution must be either 1 or 3 for 1arcsec or 3arcsec"
-             << endl;       
-	exit(-1);
+    HgtJob job;
+    unsigned int num_threads = 1;
+    job.compression = 9;
+    job.next = 0;
+
+    int arg_pos;
+    for ( arg_pos = 1; arg_pos < argc; arg_pos++ ) {
+        string arg = argv[arg_pos];
+
+        if ( arg.find("--threads=") == 0 ) {
+            num_threads = atoi( arg.substr(10).c_str() );
+        } else if ( arg.find("--threads") == 0 ) {
+            num_threads = boost::thread::hardware_concurrency();
+        } else if ( arg.find("--compression=") == 0 ) {
+            job.compression = atoi( arg.substr(14).c_str() );
+        } else if ( arg.find("--") == 0 ) {
+            usage( argv[0] );
+        } else {
+            break;
+        }
+    }
+
+    if ( argc - arg_pos < 3 || job.compression < 0 || job.compression > 9 ) {
+        usage( argv[0] );
+    }
+    if ( num_threads < 1 ) {
+        num_threads = 1;
     }
 
-    int resolution = atoi( argv[1] );
-    string hgt_name = argv[2];
-    string work_dir = argv[3];
+    job.resolution = atoi( argv[arg_pos] );
+    for ( int i = arg_pos + 1; i < argc - 1; i++ ) {
+        job.files.push_back( argv[i] );
+    }
+    job.work_dir = argv[argc - 1];
 
     // determine if file is 1arcsec or 3arcsec variety
-    if ( resolution != 1 && resolution != 3 ) {
+    if ( job.resolution != 1 && job.resolution != 3 ) {
         cout << "ERROR: resolution must be 1 or 3." << endl;
         exit( -1 );
     }
 
-    SGPath sgp( work_dir );
+    SGPath sgp( job.work_dir );
     simgear::Dir workDir(sgp);
     workDir.create(0755);
 
-    TGHgt hgt(resolution, hgt_name);
-    hgt.load();
-    hgt.close();
+    // one thread per file, and the rest of the threads on the buckets of each
+    unsigned int file_threads = std::min( num_threads, (unsigned int)job.files.size() );
+    job.bucket_threads = num_threads / file_threads;
 
-    SGVec2d min, max;
-    min.x() = hgt.get_originx() / 3600.0 + SG_HALF_BUCKET_SPAN;
-    min.y() = hgt.get_originy() / 3600.0 + SG_HALF_BUCKET_SPAN;
-    SGBucket b_min( min.x(), min.y() );
-
-    max.x() = (hgt.get_originx() + hgt.get_cols() * hgt.get_col_step()) / 3600.0 - SG_HALF_BUCKET_SPAN;
-    max.y() = (hgt.get_originy() + hgt.get_rows() * hgt.get_row_step()) / 3600.0 - SG_HALF_BUCKET_SPAN;
-    SGBucket b_max( max.x(), max.y() );
-
-    if ( b_min == b_max ) {
-        hgt.write_area( work_dir, b_min );
+    if ( file_threads <= 1 ) {
+        chop_thread( &job );
     } else {
-        SGBucket b_cur;
-        int dx, dy, i, j;
-
-        sgBucketDiff(b_min, b_max, &dx, &dy);
-        cout << "HGT file spans tile boundaries (ok)" << endl;
-        cout << "  dx = " << dx << "  dy = " << dy << endl;
-
-        if ( (dx > 20) || (dy > 20) ) {
-            cout << "somethings really wrong!!!!" << endl;
-            exit(-1);
-        }
-
-        for ( j = 0; j <= dy; j++ ) {
-            for ( i = 0; i <= dx; i++ ) {
-                b_cur = sgBucketOffset(min.x(), min.y(), i, j);
-                hgt.write_area( work_dir, b_cur );
-            }
+        boost::thread_group group;
+        for ( unsigned int i = 0; i < file_threads; i++ ) {
+            group.create_thread( boost::bind( chop_thread, &job ) );
         }
+        group.join_all();
     }
 
     return 0;
@@ -43,6 +43,7 @@
 #include <simgear/misc/sg_dir.hxx>
 
 #include <boost/foreach.hpp>
+#include <boost/thread.hpp>
 #include <tiffio.h>
 #include <zlib.h>
 #include <Lib/HGT/srtmbase.hxx>
@@ -346,37 +347,7 @@ int main(int argc, char **argv) {
     hgt.load();
     hgt.close();
 
-    SGVec2d min, max;
-    min.x() = hgt.get_originx() / 3600.0 + SG_HALF_BUCKET_SPAN;
-    min.y() = hgt.get_originy() / 3600.0 + SG_HALF_BUCKET_SPAN;
-    SGBucket b_min( min.x(), min.y() );
-
-    max.x() = (hgt.get_originx() + hgt.get_cols() * hgt.get_col_step()) / 3600.0 - SG_HALF_BUCKET_SPAN;
-    max.y() = (hgt.get_originy() + hgt.get_rows() * hgt.get_row_step()) / 3600.0 - SG_HALF_BUCKET_SPAN;
-    SGBucket b_max( max.x(), max.y() );
-
-    if ( b_min == b_max ) {
-        hgt.write_area( work_dir, b_min );
-    } else {
-        SGBucket b_cur;
-        int dx, dy, i, j;
-
-        sgBucketDiff(b_min, b_max, &dx, &dy);
-        cout << "HGT file spans tile boundaries (ok)" << endl;
-        cout << "  dx = " << dx << "  dy = " << dy << endl;
-
-        if ( (dx > 50) || (dy > 50) ) {
-            cout << "somethings really wrong!!!!" << endl;
-            exit(-1);
-        }
-
-        for ( j = 0; j <= dy; j++ ) {
-            for ( i = 0; i <= dx; i++ ) {
-                b_cur = sgBucketOffset(min.x(), min.y(), i, j);
-                hgt.write_area( work_dir, b_cur );
-            }
-        }
-    }
+    hgt.write_areas( work_dir, 50, boost::thread::hardware_concurrency() );
 
     return 0;
 }
\ No newline at end of file
@@ -40,6 +40,14 @@
 #include <ogr_spatialref.h>
 
 #include <boost/scoped_array.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include <simgear/threads/SGThread.hxx>
+#include <simgear/threads/SGGuard.hxx>
+
+#include <map>
+#include <vector>
 
 /*
  * A simple benchmark using a 5x5 degree package
@@ -65,6 +73,13 @@
  * - Ralf Gerlich
  */
 
+/*
+ * Buckets are chopped a 1x1 degree chunk at a time : each image covering
+ * the chunk is warped once into a chunk sized buffer, and the bucket
+ * arrays are sliced out of it.  Chunks are processed in parallel, each
+ * thread with its own dataset handles and transformers.
+ */
+
 struct SimpleRasterTransformerInfo {
     GDALTransformerFunc pfnTransformer;
     void* pTransformerArg;
@@ -121,7 +136,7 @@ public:
     }
 
     const char* GetDescription() const {
-        return dataset->GetDescription();
+        return name.c_str();
     }
 
     double GetColStepArcsec() {
@@ -132,16 +147,19 @@ public:
         return pxSizeY * 3600;
     }
 
-    void GetDataChunk(int *buffer,
+    /* WGS84 -> raster transformer for a (thread's) handle of the dataset */
+    void* CreateTransformer(GDALDataset *handle);
+
+    void GetDataChunk(GDALDataset *handle, void *transformer,
+                      int *buffer,
                       double x, double y,
                       double colstep, double rowstep,
                       int w, int h,
                       int srcband = 1, int nodata = -32768);
 
 protected:
-    /* The dataset */
-    GDALDataset *dataset;
-    GDALDataset *dstDataset;
+    /* The dataset name, to open a handle per thread */
+    std::string name;
 
     /* Source spatial reference system */
     OGRSpatialReference srs;
@@ -163,7 +181,7 @@ protected:
 };
 
 ImageInfo::ImageInfo(GDALDataset *dataset) :
-    dataset(dataset),
+    name(dataset->GetDescription()),
     srs(dataset->GetProjectionRef())
 {
     OGRSpatialReference wgs84SRS;
@@ -228,38 +246,42 @@ ImageInfo::ImageInfo(GDALDataset *dataset) :
            " e=" << east << " w=" << west);
 }
 
-void ImageInfo::GetDataChunk(int *buffer,
-                             double x, double y,
-                             double colstep, double rowstep,
-                             int w, int h,
-                             int srcband, int nodata)
+void* ImageInfo::CreateTransformer(GDALDataset *handle)
 {
-	SG_LOG(SG_GENERAL, SG_INFO,"1 GETTING DATA CHUNK!!");
     OGRSpatialReference wgs84SRS;
 
     wgs84SRS.SetWellKnownGeogCS( "EPSG:4326" );
 
     char* wgs84WKT;
     wgs84SRS.exportToWkt(&wgs84WKT);
-	
-	SG_LOG(SG_GENERAL, SG_INFO,"2 GETTING DATA CHUNK!!");
-    /* Setup a raster transformation from WGS84 to raster coordinates of the array files */
-    SimpleRasterTransformerInfo xformData;
-    xformData.pTransformerArg = GDALCreateGenImgProjTransformer(
-        dataset, NULL,
+
+    void* transformer = GDALCreateGenImgProjTransformer(
+        handle, NULL,
         NULL,wgs84WKT,
         FALSE,
         0.0,
         1);
 
+    CPLFree(wgs84WKT);
+
+    return transformer;
+}
+
+void ImageInfo::GetDataChunk(GDALDataset *handle, void *transformer,
+                             int *buffer,
+                             double x, double y,
+                             double colstep, double rowstep,
+                             int w, int h,
+                             int srcband, int nodata)
+{
+    /* Setup a raster transformation from WGS84 to raster coordinates of the array files */
+    SimpleRasterTransformerInfo xformData;
+    xformData.pTransformerArg = transformer;
     xformData.pfnTransformer = GDALGenImgProjTransform;
     xformData.x0 = x - pxSizeX * 0.5;
     xformData.y0 = y - pxSizeY * 0.5;
     xformData.col_step = colstep;
     xformData.row_step = rowstep;
-	
-	SG_LOG(SG_GENERAL, SG_INFO,"3 GETTING DATA CHUNK!!");
-    // TODO: check if this image can actually cover part of the chunk
 
     /* establish the full source to target transformation */
     GDALWarpOptions *psWarpOptions = GDALCreateWarpOptions();
@@ -271,12 +293,10 @@ void ImageInfo::GetDataChunk(int *buffer,
     double srcNodataImag   =  0.0;
     int    srcHasNodataValue;
 
-    srcNodataReal = dataset->GetRasterBand(srcband)->GetNoDataValue(&srcHasNodataValue);
-	
-	SG_LOG(SG_GENERAL, SG_INFO,"4 GETTING DATA CHUNK!!");
-    psWarpOptions->hSrcDS = dataset;
+    srcNodataReal = handle->GetRasterBand(srcband)->GetNoDataValue(&srcHasNodataValue);
+
+    psWarpOptions->hSrcDS = handle;
     psWarpOptions->hDstDS = NULL;
-	//psWarpOptions->hDstDS = dstDataset;
     psWarpOptions->nBandCount = 1;
     psWarpOptions->panSrcBands = srcBandNumbers;
     psWarpOptions->panDstBands = dstBandNumbers;
@@ -287,35 +307,71 @@ void ImageInfo::GetDataChunk(int *buffer,
     psWarpOptions->padfDstNoDataReal = NULL;
     psWarpOptions->eResampleAlg = GRA_NearestNeighbour;
     psWarpOptions->eWorkingDataType = GDT_Int32;
-	
+
     psWarpOptions->pfnTransformer = SimpleRasterTransformer;
     psWarpOptions->pTransformerArg = &xformData;
-	
-	SG_LOG(SG_GENERAL, SG_INFO,"5 GETTING DATA CHUNK!!  " << " w " << w << " h " << h << " buffer " << buffer[0] );
+
     GDALWarpOperation oOperation;
     oOperation.Initialize( psWarpOptions );
-	
-	SG_LOG(SG_GENERAL, SG_INFO,"5.5 GETTING DATA CHUNK!!  " << " w " << w << " h " << h << " buffer " << buffer[0] );
+
     /* do the warp */
     if (oOperation.WarpRegionToBuffer(0, 0, w, h, buffer, GDT_Int32) != CE_None) {
         SG_LOG(SG_GENERAL, SG_ALERT,
                "Could not warp to buffer on dataset '" << GetDescription() << "'"
                ":" << CPLGetLastErrorMsg());
     }
-	
-	SG_LOG(SG_GENERAL, SG_INFO,"6 GETTING DATA CHUNK!!");
+
     /* clean up */
     psWarpOptions->panSrcBands = NULL;
     psWarpOptions->panDstBands = NULL;
     psWarpOptions->padfSrcNoDataReal = NULL;
     psWarpOptions->padfSrcNoDataImag = NULL;
     psWarpOptions->padfDstNoDataReal = NULL;
-	
-	SG_LOG(SG_GENERAL, SG_INFO,"7 GETTING DATA CHUNK!!");
-    GDALDestroyGenImgProjTransformer( xformData.pTransformerArg );
+
     GDALDestroyWarpOptions( psWarpOptions );
 }
 
+/* Dataset handles and transformers of one chop thread, opened on first use */
+class ChopThreadImages {
+public:
+    ChopThreadImages(ImageInfo** i, int count) :
+        images(i), handles(count, (GDALDataset*)NULL), transformers(count, (void*)NULL) {}
+
+    ~ChopThreadImages() {
+        for (unsigned int i = 0; i < handles.size(); i++) {
+            if (transformers[i]) {
+                GDALDestroyGenImgProjTransformer( transformers[i] );
+            }
+            if (handles[i]) {
+                GDALClose( handles[i] );
+            }
+        }
+    }
+
+    void GetDataChunk(int i, int *buffer,
+                      double x, double y,
+                      double colstep, double rowstep,
+                      int w, int h) {
+        if (!handles[i]) {
+            handles[i] = (GDALDataset*)GDALOpen(images[i]->GetDescription(), GA_ReadOnly);
+            if (handles[i] == NULL) {
+                SG_LOG(SG_GENERAL, SG_ALERT,
+                       "Could not open dataset '" << images[i]->GetDescription() << "'"
+                       ":" << CPLGetLastErrorMsg());
+                exit(1);
+            }
+            transformers[i] = images[i]->CreateTransformer(handles[i]);
+        }
+
+        images[i]->GetDataChunk(handles[i], transformers[i], buffer, x, y, colstep, rowstep, w, h);
+    }
+
+private:
+    ImageInfo**                 images;
+    std::vector<GDALDataset*>   handles;
+    std::vector<void*>          transformers;
+};
+
 void write_bucket(const std::string& work_dir, SGBucket bucket,
                   int* buffer,
                   int min_x, int min_y,
@@ -352,8 +408,28 @@ void write_bucket(const std::string& work_dir, SGBucket bucket,
     gzclose(fp);
 }
 
-void process_bucket(const SGPath& work_dir, SGBucket bucket,
-                    ImageInfo* images[], int imagecount,
+/* The buckets of one 1x1 degree chunk */
+struct ChopChunk {
+    int lon, lat;
+    std::vector<SGBucket> buckets;
+    std::vector<bool>     force;
+};
+
+/* Shared state of all chop threads */
+struct ChopJob {
+    SGPath                  work_dir;
+    ImageInfo**             images;
+    int                     imagecount;
+    double                  col_step, row_step;
+
+    std::vector<ChopChunk>  chunks;
+    unsigned int            next_chunk;
+    SGMutex                 lock;
+};
+
+void process_bucket(ChopJob& job, ChopThreadImages& thread_images,
+                    SGBucket bucket,
+                    const int* chunk_buffer, int chunk_lon, int chunk_lat, int chunk_w, int chunk_h,
                     bool forceWrite = false)
 {
     double bnorth, bsouth, beast, bwest;
@@ -370,23 +446,10 @@ void process_bucket(const SGPath& work_dir, SGBucket bucket,
 
     /* Get the data from the input datasets... */
     int min_x, min_y, span_x, span_y;
+    double col_step = job.col_step, row_step = job.row_step;
 
     min_x = (int)(bwest * 3600.0);
     min_y = (int)(bsouth * 3600.0);
-    printf("Image count: %d\n",imagecount);
-    // Determine minimum common arcsec steps across images
-    double col_step = -1.0, row_step = -1.0;
-    for (int i = 0; i < imagecount; i++) {
-        if ( images[i]->GetColStepArcsec() > col_step ) {
-            //col_step = 0.333;
-			col_step = images[i]->GetColStepArcsec();
-        }
-        if ( images[i]->GetRowStepArcsec() > row_step ) {
-            //row_step = 0.333;;
-            row_step = images[i]->GetRowStepArcsec();
-        }
-    }
-	SG_LOG(SG_GENERAL, SG_INFO, "2 processing bucket " << bucket << "(" << bucket.gen_index() << ") n=" << bnorth << " s=" << bsouth << " e=" << beast << " w=" << bwest);
 
     span_x = (bucket.get_width() * 3600 / col_step) + 1;
     span_y = (bucket.get_height() * 3600 / row_step) + 1;
@@ -394,19 +457,28 @@ void process_bucket(const SGPath& work_dir, SGBucket bucket,
     int cellcount = span_x * span_y;
     boost::scoped_array<int> buffer(new int[cellcount]);
 
-    ::memset(buffer.get(), 0, cellcount * sizeof(int));
-	SG_LOG(SG_GENERAL, SG_INFO, "3 processing bucket, span x " << span_x << "  span_y  " << span_y);
-
-    for (int i = 0; i < imagecount; i++) {
-
-		if ( images[i]->GetBoundingBox().intersects(BucketBounds) ) {
-			SG_LOG(SG_GENERAL, SG_INFO, "i =  " << i << " buffer  width " << bucket.get_width() <<  
-				" height " << bucket.get_height() << " col_step " << col_step << " row_step " << row_step << " span_x " << span_x
-				<< " span_y " << span_y << " bwest " << bwest << " bsouth " << bsouth );
-            images[i]->GetDataChunk(buffer.get(),
-                                    bwest, bsouth,
-                                    col_step / 3600.0, row_step / 3600.0,
-                                    span_x, span_y );
+    /* the bucket's samples are samples of the chunk, if the grids line up */
+    double off_x = (bwest - chunk_lon) * 3600.0 / col_step;
+    double off_y = (bsouth - chunk_lat) * 3600.0 / row_step;
+    int    ix = (int)floor(off_x + 0.5);
+    int    iy = (int)floor(off_y + 0.5);
+
+    if ( chunk_buffer &&
+         fabs(off_x - ix) < 1e-6 && fabs(off_y - iy) < 1e-6 &&
+         ix >= 0 && iy >= 0 && ix + span_x <= chunk_w && iy + span_y <= chunk_h ) {
+        for (int y = 0; y < span_y; y++) {
+            ::memcpy(buffer.get() + y * span_x, chunk_buffer + (iy + y) * chunk_w + ix, span_x * sizeof(int));
+        }
+    } else {
+        ::memset(buffer.get(), 0, cellcount * sizeof(int));
+
+        for (int i = 0; i < job.imagecount; i++) {
+            if ( job.images[i]->GetBoundingBox().intersects(BucketBounds) ) {
+                thread_images.GetDataChunk(i, buffer.get(),
+                                           bwest, bsouth,
+                                           col_step / 3600.0, row_step / 3600.0,
+                                           span_x, span_y );
+            }
         }
     }
 
@@ -430,28 +502,105 @@ void process_bucket(const SGPath& work_dir, SGBucket bucket,
         if (!forceWrite)
             return;
     }
-	SG_LOG(SG_GENERAL, SG_INFO, "4 processing bucket " << bucket << "(" << bucket.gen_index() << ") n=" << bnorth << " s=" << bsouth << " e=" << beast << " w=" << bwest);
 
     /* ...and write it out */
-    write_bucket(work_dir.str(), bucket,
+    write_bucket(job.work_dir.str(), bucket,
                  buffer.get(),
                  min_x, min_y,
                  span_x, span_y,
                  col_step, row_step);
-	SG_LOG(SG_GENERAL, SG_INFO, "wrote bucket " << bucket << "(" << bucket.gen_index() << ") n=" << bnorth << " s=" << bsouth << " e=" << beast << " w=" << bwest);
+    SG_LOG(SG_GENERAL, SG_INFO, "wrote bucket " << bucket << "(" << bucket.gen_index() << ")");
+}
+
+void process_chunk(ChopJob& job, ChopThreadImages& thread_images, const ChopChunk& chunk)
+{
+    tgRectangle ChunkBounds(SGGeod::fromDeg(chunk.lon, chunk.lat), SGGeod::fromDeg(chunk.lon + 1, chunk.lat + 1));
+
+    int chunk_w = (int)(3600.0 / job.col_step + 0.5) + 1;
+    int chunk_h = (int)(3600.0 / job.row_step + 0.5) + 1;
+    int cellcount = chunk_w * chunk_h;
+
+    SG_LOG(SG_GENERAL, SG_INFO, "processing chunk " << chunk.lon << "," << chunk.lat << " with " << chunk.buckets.size() << " buckets");
+
+    /* warp every image covering the chunk once */
+    boost::scoped_array<int> buffer(new int[cellcount]);
+    ::memset(buffer.get(), 0, cellcount * sizeof(int));
+
+    for (int i = 0; i < job.imagecount; i++) {
+        if ( job.images[i]->GetBoundingBox().intersects(ChunkBounds) ) {
+            thread_images.GetDataChunk(i, buffer.get(),
+                                       chunk.lon, chunk.lat,
+                                       job.col_step / 3600.0, job.row_step / 3600.0,
+                                       chunk_w, chunk_h );
+        }
+    }
+
+    for (unsigned int i = 0; i < chunk.buckets.size(); i++) {
+        process_bucket(job, thread_images, chunk.buckets[i],
+                       buffer.get(), chunk.lon, chunk.lat, chunk_w, chunk_h,
+                       chunk.force[i]);
+    }
+}
+
+void chop_thread(ChopJob* job)
+{
+    ChopThreadImages thread_images(job->images, job->imagecount);
+
+    while (true) {
+        unsigned int next;
+        {
+            SGGuard<SGMutex> g(job->lock);
+            next = job->next_chunk++;
+        }
+        if (next >= job->chunks.size()) {
+            break;
+        }
 
+        process_chunk(*job, thread_images, job->chunks[next]);
+    }
+}
+
+void add_bucket(std::map<long, int>& chunk_index, std::vector<ChopChunk>& chunks, const SGBucket& bucket, bool forceWrite)
+{
+    int lon = (int)floor(bucket.get_center_lon());
+    int lat = (int)floor(bucket.get_center_lat());
+    long key = (long)(lon + 180) * 1000 + (lat + 90);
+
+    std::map<long, int>::iterator it = chunk_index.find(key);
+    if (it == chunk_index.end()) {
+        ChopChunk chunk;
+        chunk.lon = lon;
+        chunk.lat = lat;
+        chunks.push_back(chunk);
+
+        it = chunk_index.insert(std::make_pair(key, (int)chunks.size() - 1)).first;
+    }
+
+    chunks[it->second].buckets.push_back(bucket);
+    chunks[it->second].force.push_back(forceWrite);
 }
 
 int main(int argc, const char **argv)
 {
     sglog().setLogLevels( SG_ALL, SG_INFO );
 
+    int num_threads = boost::thread::hardware_concurrency();
+
+    /* leading options */
+    while ( argc > 1 && !strncmp(argv[1], "--threads=", 10) ) {
+        num_threads = atoi(argv[1] + 10);
+        argv++;
+        argc--;
+    }
+    if ( num_threads < 1 ) {
+        num_threads = 1;
+    }
+
     if ( argc < 3 ) {
         SG_LOG(SG_GENERAL, SG_ALERT,
-               "Usage " << argv[0] << " <work_dir> <datasetname...> [-- <bucket-idx> ...]");
+               "Usage " << argv[0] << " [--threads=<n>] <work_dir> <datasetname...> [-- <bucket-idx> ...]");
         exit(-1);
     }
-
     SGPath work_dir(argv[1]);
     work_dir.create_dir( 0755 );
 
@@ -510,6 +659,22 @@ int main(int argc, const char **argv)
 
     SG_LOG(SG_GENERAL, SG_INFO, "Bounds of all datasets: n=" << north << " s=" << south << " e=" << east << " w=" << west);
 
+    // Determine minimum common arcsec steps across images
+    ChopJob job;
+    job.work_dir   = work_dir;
+    job.images     = images.get();
+    job.imagecount = datasetcount;
+    job.col_step   = -1.0;
+    job.row_step   = -1.0;
+    job.next_chunk = 0;
+
+    for (int i = 0; i < datasetcount; i++) {
+        job.col_step = std::max( job.col_step, images[i]->GetColStepArcsec() );
+        job.row_step = std::max( job.row_step, images[i]->GetRowStepArcsec() );
+    }
+
+    std::map<long, int> chunk_index;
+
     /*
      * Step 2: If no tiles were specified, go through all tiles contained in
      *         the common bounds of all datasets and find those which have
@@ -536,7 +701,7 @@ int main(int argc, const char **argv)
             for (int y = 0; y <= dy; y++) {
                 SGBucket bucket = sgBucketOffset(west, south, x, y);
 
-                process_bucket(work_dir, bucket, images.get(), datasetcount);
+                add_bucket(chunk_index, job.chunks, bucket, false);
             }
         }
     } else {
@@ -547,9 +712,20 @@ int main(int argc, const char **argv)
         for (int i = 0; i < tilecount; i++) {
             SGBucket bucket(atol(tilenames[i]));
 
-            process_bucket(work_dir, bucket, images.get(), datasetcount, true);
+            add_bucket(chunk_index, job.chunks, bucket, true);
         }
     }
 
+    /*
+     * Step 3: Chop the chunks in parallel.
+     */
+    SG_LOG(SG_GENERAL, SG_INFO, "Chopping " << job.chunks.size() << " chunks with " << num_threads << " threads");
+
+    boost::thread_group threads;
+    for (int i = 0; i < num_threads; i++) {
+        threads.create_thread( boost::bind( chop_thread, &job ) );
+    }
+    threads.join_all();
+
     return 0;
 }
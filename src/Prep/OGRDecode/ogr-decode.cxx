@@ -24,13 +24,18 @@
 
 #include <string>
 #include <map>
+#include <algorithm>
+#include <deque>
+#include <vector>
 
 #include <boost/thread.hpp>
+#include <boost/unordered_set.hpp>
 #include <ogrsf_frmts.h>
 
 #include <simgear/compiler.h>
 #include <simgear/threads/SGThread.hxx>
 #include <simgear/threads/SGQueue.hxx>
+#include <simgear/threads/SGGuard.hxx>
 #include <simgear/debug/logstream.hxx>
 #include <simgear/math/sg_geodesy.hxx>
 #include <simgear/misc/sg_path.hxx>
@@ -44,6 +49,10 @@
 /* stretch endpoints to reduce slivers in linear data ~.1 meters */
 #define EP_STRETCH  (0.1)
 
+/* features handed to a decoder at a time, and batches buffered per decoder */
+#define FEATURE_BATCH_SIZE      (64)
+#define FEATURE_QUEUE_DEPTH     (4)
+
 using std::string;
 
 // scope?
@@ -63,12 +72,71 @@ string attribute_query;
 bool use_spatial_query=false;
 double spat_min_x, spat_min_y, spat_max_x, spat_max_y;
 int num_threads = 1;
+int read_windows = 1;  // grid of spatial filter windows read in parallel
 bool save_shapefiles=false;
 std::string ds_name=".";
 
 const double gSnap = 0.00000001;      // approx 1 mm
 
-SGLockedQueue<OGRFeature *> global_workQueue;
+typedef std::vector<OGRFeature *> FeatureBatch;
+
+// Bounded queue of feature batches between the layer reader and the
+// decoders.  push() blocks while the queue is full, so only a few batches
+// per thread are held in memory, and pop() blocks until a batch arrives
+// or the reader has closed the queue.
+class FeatureQueue
+{
+public:
+    FeatureQueue() : max_batches(1), closed(false) {}
+
+    void open( unsigned int depth ) {
+        SGGuard<SGMutex> g(mutex);
+        max_batches = depth ? depth : 1;
+        closed      = false;
+    }
+
+    void push( FeatureBatch& batch ) {
+        SGGuard<SGMutex> g(mutex);
+        while ( queue.size() >= max_batches ) {
+            not_full.wait( mutex );
+        }
+        queue.push_back( FeatureBatch() );
+        queue.back().swap( batch );
+        not_empty.signal();
+    }
+
+    // no more batches - wake up all waiting decoders
+    void close( void ) {
+        SGGuard<SGMutex> g(mutex);
+        closed = true;
+        not_empty.broadcast();
+    }
+
+    // returns false once the queue is closed and drained
+    bool pop( FeatureBatch& batch ) {
+        SGGuard<SGMutex> g(mutex);
+        while ( queue.empty() && !closed ) {
+            not_empty.wait( mutex );
+        }
+        if ( queue.empty() ) {
+            return false;
+        }
+        batch.swap( queue.front() );
+        queue.pop_front();
+        not_full.signal();
+        return true;
+    }
+
+private:
+    SGMutex                     mutex;
+    SGWaitCondition             not_empty;
+    SGWaitCondition             not_full;
+    std::deque<FeatureBatch>    queue;
+    unsigned int                max_batches;
+    bool                        closed;
+};
+
+FeatureQueue global_workQueue;
 
 /* very GDAL specific here... */
 inline static bool is_ocean_area( const std::string &area ) {
@@ -86,16 +154,26 @@ inline static bool is_null_area( const std::string& area ) {
 class Decoder : public SGThread
 {
 public:
-    Decoder( OGRCoordinateTransformation *poct, int atf, int pwf, int lwf, tgChopper& c ) : chopper(c) {
-        poCT = poct;
+    Decoder( OGRSpatialReference *source_srs, int atf, int pwf, int lwf, tgChopper& c ) : chopper(c) {
+        OGRSpatialReference target_srs;
+        target_srs.SetWellKnownGeogCS( "WGS84" );
+
+        // transformations are not thread safe - each decoder gets its own
+        poCT = OGRCreateCoordinateTransformation( source_srs, &target_srs );
         area_type_field = atf;
         point_width_field = pwf;
         line_width_field = lwf;
     }
 
+    ~Decoder() {
+        OCTDestroyCoordinateTransformation( poCT );
+    }
+
 private:
     virtual void run();
 
+    void processFeature(OGRFeature* poFeature);
+
     void processPoint(OGRPoint* poGeometry, const string& area_type, int width );
     void processLineString(OGRLineString* poGeometry, const string& area_type, int width, int with_texture );
     void processPolygon(OGRPolygon* poGeometry, const string& area_type );
@@ -181,8 +259,13 @@ void Decoder::processLineString(OGRLineString* poGeometry, const string& area_ty
     heading = SGGeodesy::courseDeg( p0, p1 );
     line.AddNode( SGGeodesy::direct(p1, heading, EP_STRETCH) );
 
-    // make a plygons from the line segments
-    segments = tgContour::ExpandToPolygons( line, width );
+    // make polygons from the line segments - merged into as few as the
+    // texture frame allows, unless every segment is wanted on its own
+    if ( seperate_segments ) {
+        segments = tgContour::ExpandToPolygons( line, width );
+    } else {
+        segments = tgContour::ExpandToMergedPolygons( line, width, with_texture );
+    }
     for ( unsigned int i=0; i<segments.size(); i++ ) {
         segments[i].SetPreserve3D( false );
         if (with_texture) {
@@ -212,147 +295,302 @@ void Decoder::processPolygon(OGRPolygon* poGeometry, const string& area_type )
     chopper.Add( shape, area_type  );
 }
 
-void Decoder::run()
+void Decoder::processFeature(OGRFeature* poFeature)
 {
-    // as long as we have geometry to parse, do so
-    while (!global_workQueue.empty()) {
-        OGRFeature *poFeature = global_workQueue.pop();
-        // SG_LOG( SG_GENERAL, SG_INFO, " remaining features is " << global_workQueue.size() );
-
-        if ( poFeature ) {
-            OGRGeometry *poGeometry = poFeature->GetGeometryRef();
-
-            if (poGeometry==NULL) {
-                SG_LOG( SG_GENERAL, SG_INFO, "Found feature without geometry!" );
-                if (!continue_on_errors) {
-                    SG_LOG( SG_GENERAL, SG_ALERT, "Aborting!" );
-                    exit( 1 );
-                } else {
-                    continue;
-                }
-            }
+    OGRGeometry *poGeometry = poFeature->GetGeometryRef();
 
-            OGRwkbGeometryType geoType=wkbFlatten(poGeometry->getGeometryType());
-            if (geoType!=wkbPoint && geoType!=wkbMultiPoint &&
-                geoType!=wkbLineString && geoType!=wkbMultiLineString &&
-                geoType!=wkbPolygon && geoType!=wkbMultiPolygon) {
-                    SG_LOG( SG_GENERAL, SG_INFO, "Unknown feature" );
-                    continue;
-            }
+    if (poGeometry==NULL) {
+        SG_LOG( SG_GENERAL, SG_INFO, "Found feature without geometry!" );
+        if (!continue_on_errors) {
+            SG_LOG( SG_GENERAL, SG_ALERT, "Aborting!" );
+            exit( 1 );
+        } else {
+            return;
+        }
+    }
 
-            string area_type_name=area_type;
-            if (area_type_field!=-1) {
-                area_type_name=poFeature->GetFieldAsString(area_type_field);
-            }
+    OGRwkbGeometryType geoType=wkbFlatten(poGeometry->getGeometryType());
+    if (geoType!=wkbPoint && geoType!=wkbMultiPoint &&
+        geoType!=wkbLineString && geoType!=wkbMultiLineString &&
+        geoType!=wkbPolygon && geoType!=wkbMultiPolygon) {
+            SG_LOG( SG_GENERAL, SG_INFO, "Unknown feature" );
+            return;
+    }
 
-            if ( is_ocean_area(area_type_name) ) {
-                // interior of polygon is ocean, holes are islands
+    string area_type_name=area_type;
+    if (area_type_field!=-1) {
+        area_type_name=poFeature->GetFieldAsString(area_type_field);
+    }
 
-                SG_LOG(  SG_GENERAL, SG_ALERT, "Ocean area ... SKIPPING!" );
+    if ( is_ocean_area(area_type_name) ) {
+        // interior of polygon is ocean, holes are islands
 
-                // Ocean data now comes from GSHHS so we want to ignore
-                // all other ocean data
-                continue;
-            } else if ( is_void_area(area_type_name) ) {
-                // interior is ????
+        SG_LOG(  SG_GENERAL, SG_ALERT, "Ocean area ... SKIPPING!" );
 
-                // skip for now
-                SG_LOG(  SG_GENERAL, SG_ALERT, "Void area ... SKIPPING!" );
+        // Ocean data now comes from GSHHS so we want to ignore
+        // all other ocean data
+        return;
+    } else if ( is_void_area(area_type_name) ) {
+        // interior is ????
 
-                continue;
-            } else if ( is_null_area(area_type_name) ) {
-                // interior is ????
+        // skip for now
+        SG_LOG(  SG_GENERAL, SG_ALERT, "Void area ... SKIPPING!" );
 
-                // skip for now
-                SG_LOG(  SG_GENERAL, SG_ALERT, "Null area ... SKIPPING!" );
+        return;
+    } else if ( is_null_area(area_type_name) ) {
+        // interior is ????
 
-                continue;
-            }
+        // skip for now
+        SG_LOG(  SG_GENERAL, SG_ALERT, "Null area ... SKIPPING!" );
 
-            poGeometry->transform( poCT );
-
-            switch (geoType) {
-            case wkbPoint: {
-                SG_LOG( SG_GENERAL, SG_DEBUG, "Point feature" );
-                int width=point_width;
-                if (point_width_field!=-1) {
-                    width=poFeature->GetFieldAsInteger(point_width_field);
-                    if (width == 0) {
-                        width=point_width;
-                    }
-                }
-                processPoint((OGRPoint*)poGeometry, area_type_name, width);
-                break;
+        return;
+    }
+
+    poGeometry->transform( poCT );
+
+    switch (geoType) {
+    case wkbPoint: {
+        SG_LOG( SG_GENERAL, SG_DEBUG, "Point feature" );
+        int width=point_width;
+        if (point_width_field!=-1) {
+            width=poFeature->GetFieldAsInteger(point_width_field);
+            if (width == 0) {
+                width=point_width;
             }
-            case wkbMultiPoint: {
-                SG_LOG( SG_GENERAL, SG_DEBUG, "MultiPoint feature" );
-                int width=point_width;
-                if (point_width_field!=-1) {
-                    width=poFeature->GetFieldAsInteger(point_width_field);
-                    if (width == 0) {
-                        width=point_width;
-                    }
-                }
-                OGRMultiPoint* multipt=(OGRMultiPoint*)poGeometry;
-                for (int i=0;i<multipt->getNumGeometries();i++) {
-                    processPoint((OGRPoint*)(multipt->getGeometryRef(i)), area_type_name, width);
-                }
-                break;
+        }
+        processPoint((OGRPoint*)poGeometry, area_type_name, width);
+        break;
+    }
+    case wkbMultiPoint: {
+        SG_LOG( SG_GENERAL, SG_DEBUG, "MultiPoint feature" );
+        int width=point_width;
+        if (point_width_field!=-1) {
+            width=poFeature->GetFieldAsInteger(point_width_field);
+            if (width == 0) {
+                width=point_width;
             }
-            case wkbLineString: {
-                SG_LOG( SG_GENERAL, SG_DEBUG, "LineString feature" );
-                int width=line_width;
-                if (line_width_field!=-1) {
-                    width=poFeature->GetFieldAsInteger(line_width_field);
-                    if (width == 0) {
-                        width=line_width;
-                    }
-                }
-
-                processLineString((OGRLineString*)poGeometry, area_type_name, width, texture_lines);
-                break;
+        }
+        OGRMultiPoint* multipt=(OGRMultiPoint*)poGeometry;
+        for (int i=0;i<multipt->getNumGeometries();i++) {
+            processPoint((OGRPoint*)(multipt->getGeometryRef(i)), area_type_name, width);
+        }
+        break;
+    }
+    case wkbLineString: {
+        SG_LOG( SG_GENERAL, SG_DEBUG, "LineString feature" );
+        int width=line_width;
+        if (line_width_field!=-1) {
+            width=poFeature->GetFieldAsInteger(line_width_field);
+            if (width == 0) {
+                width=line_width;
             }
-            case wkbMultiLineString: {
-                SG_LOG( SG_GENERAL, SG_DEBUG, "MultiLineString feature" );
-                int width=line_width;
-                if (line_width_field!=-1) {
-                    width=poFeature->GetFieldAsInteger(line_width_field);
-                    if (width == 0) {
-                        width=line_width;
-                    }
-                }
+        }
 
-                OGRMultiLineString* multilines=(OGRMultiLineString*)poGeometry;
-                for (int i=0;i<multilines->getNumGeometries();i++) {
-                    processLineString((OGRLineString*)(multilines->getGeometryRef(i)), area_type_name, width, texture_lines);
-                }
-                break;
-            }
-            case wkbPolygon: {
-                SG_LOG( SG_GENERAL, SG_DEBUG, "Polygon feature" );
-                processPolygon((OGRPolygon*)poGeometry, area_type_name);
-                break;
+        processLineString((OGRLineString*)poGeometry, area_type_name, width, texture_lines);
+        break;
+    }
+    case wkbMultiLineString: {
+        SG_LOG( SG_GENERAL, SG_DEBUG, "MultiLineString feature" );
+        int width=line_width;
+        if (line_width_field!=-1) {
+            width=poFeature->GetFieldAsInteger(line_width_field);
+            if (width == 0) {
+                width=line_width;
             }
-            case wkbMultiPolygon: {
-                SG_LOG( SG_GENERAL, SG_DEBUG, "MultiPolygon feature" );
-                OGRMultiPolygon* multipoly=(OGRMultiPolygon*)poGeometry;
-                for (int i=0;i<multipoly->getNumGeometries();i++) {
-                    processPolygon((OGRPolygon*)(multipoly->getGeometryRef(i)), area_type_name);
+        }
+
+        OGRMultiLineString* multilines=(OGRMultiLineString*)poGeometry;
+        for (int i=0;i<multilines->getNumGeometries();i++) {
+            processLineString((OGRLineString*)(multilines->getGeometryRef(i)), area_type_name, width, texture_lines);
+        }
+        break;
+    }
+    case wkbPolygon: {
+        SG_LOG( SG_GENERAL, SG_DEBUG, "Polygon feature" );
+        processPolygon((OGRPolygon*)poGeometry, area_type_name);
+        break;
+    }
+    case wkbMultiPolygon: {
+        SG_LOG( SG_GENERAL, SG_DEBUG, "MultiPolygon feature" );
+        OGRMultiPolygon* multipoly=(OGRMultiPolygon*)poGeometry;
+        for (int i=0;i<multipoly->getNumGeometries();i++) {
+            processPolygon((OGRPolygon*)(multipoly->getGeometryRef(i)), area_type_name);
+        }
+        break;
+    }
+    default:
+        /* Ignore unhandled objects */
+        break;
+    }
+}
+
+void Decoder::run()
+{
+    FeatureBatch batch;
+
+    // as long as the reader delivers features to parse, do so
+    while ( global_workQueue.pop( batch ) ) {
+        for ( unsigned int i = 0; i < batch.size(); i++ ) {
+            processFeature( batch[i] );
+            OGRFeature::DestroyFeature( batch[i] );
+        }
+        batch.clear();
+    }
+}
+
+// FIDs of features crossing a window border, so they are decoded once
+class FidSet
+{
+public:
+    void clear( void ) {
+        SGGuard<SGMutex> g(mutex);
+        fids.clear();
+    }
+
+    // returns true the first time fid is seen
+    bool insert( long fid ) {
+        SGGuard<SGMutex> g(mutex);
+        return fids.insert( fid ).second;
+    }
+
+private:
+    SGMutex                     mutex;
+    boost::unordered_set<long>  fids;
+};
+
+FidSet global_borderFids;
+
+// Reads the features of one spatial filter window through its own
+// datasource handle, and feeds them to the decoders
+class WindowReader : public SGThread
+{
+public:
+    WindowReader( const string& ds, const string& ln, double x0, double y0, double x1, double y1 ) :
+        datasource(ds), layername(ln), min_x(x0), min_y(y0), max_x(x1), max_y(y1) {}
+
+    int features;
+
+private:
+    virtual void run();
+
+    string datasource;
+    string layername;
+    double min_x, min_y, max_x, max_y;
+};
+
+void WindowReader::run()
+{
+    features = 0;
+
+    OGRDataSource* poDS = OGRSFDriverRegistrar::Open( datasource.c_str(), FALSE );
+    if ( poDS == NULL ) {
+        SG_LOG( SG_GENERAL, SG_ALERT, "Failed opening datasource " << datasource );
+        exit( 1 );
+    }
+
+    OGRLayer* poLayer = poDS->GetLayerByName( layername.c_str() );
+    if ( poLayer == NULL ) {
+        SG_LOG( SG_GENERAL, SG_ALERT, "Failed opening layer " << layername << " from datasource " << datasource );
+        exit( 1 );
+    }
+
+    poLayer->SetSpatialFilterRect( min_x, min_y, max_x, max_y );
+    if (use_attribute_query) {
+        poLayer->SetAttributeFilter( attribute_query.c_str() );
+    }
+
+    OGRFeature *poFeature;
+    FeatureBatch batch;
+    batch.reserve( FEATURE_BATCH_SIZE );
+
+    while ( ( poFeature = poLayer->GetNextFeature()) != NULL )
+    {
+        // features strictly inside the window can't be returned by any
+        // other reader - those touching a border can.  Features without
+        // a FID can't be told apart, layerHasFids() keeps such layers
+        // out of windows
+        OGRGeometry* poGeometry = poFeature->GetGeometryRef();
+        if ( poGeometry && poFeature->GetFID() != OGRNullFID ) {
+            OGREnvelope env;
+            poGeometry->getEnvelope( &env );
+
+            if ( env.MinX <= min_x || env.MinY <= min_y || env.MaxX >= max_x || env.MaxY >= max_y ) {
+                if ( !global_borderFids.insert( poFeature->GetFID() ) ) {
+                    OGRFeature::DestroyFeature( poFeature );
+                    continue;
                 }
-                break;
-            }
-            default:
-                /* Ignore unhandled objects */
-                break;
             }
+        }
 
-            OGRFeature::DestroyFeature( poFeature );
+        features++;
+        batch.push_back( poFeature );
+        if ( batch.size() >= FEATURE_BATCH_SIZE ) {
+            global_workQueue.push( batch );
+            batch.reserve( FEATURE_BATCH_SIZE );
         }
     }
+    if ( batch.size() ) {
+        global_workQueue.push( batch );
+    }
+
+    OGRDataSource::DestroyDataSource( poDS );
+}
+
+// Border features are told apart by FID, so windows only work for
+// layers whose features have one
+bool layerHasFids( OGRLayer* poLayer )
+{
+    poLayer->ResetReading();
+    OGRFeature* poFeature = poLayer->GetNextFeature();
+    bool has_fids = ( poFeature == NULL || poFeature->GetFID() != OGRNullFID );
+    if ( poFeature ) {
+        OGRFeature::DestroyFeature( poFeature );
+    }
+    poLayer->ResetReading();
+
+    return has_fids;
+}
+
+// Read the layer with one reader per window of a grid over the extent
+void readLayerWindows( const string& datasource, OGRLayer* poLayer, const OGREnvelope& extent )
+{
+    string layername = poLayer->GetLayerDefn()->GetName();
+    double dx = ( extent.MaxX - extent.MinX ) / read_windows;
+    double dy = ( extent.MaxY - extent.MinY ) / read_windows;
+
+    SG_LOG( SG_GENERAL, SG_ALERT, "Reading layer " << layername << " in " << read_windows << "x" << read_windows << " windows" );
+
+    global_borderFids.clear();
+
+    std::vector<WindowReader *> readers;
+    for (int y=0; y<read_windows; y++) {
+        for (int x=0; x<read_windows; x++) {
+            // outer windows reach to the extent exactly, so edge features aren't lost to rounding
+            double x0 = ( x == 0 ) ? extent.MinX : extent.MinX + x * dx;
+            double y0 = ( y == 0 ) ? extent.MinY : extent.MinY + y * dy;
+            double x1 = ( x == read_windows-1 ) ? extent.MaxX : extent.MinX + (x+1) * dx;
+            double y1 = ( y == read_windows-1 ) ? extent.MaxY : extent.MinY + (y+1) * dy;
+
+            WindowReader* reader = new WindowReader( datasource, layername, x0, y0, x1, y1 );
+            reader->start();
+            readers.push_back( reader );
+        }
+    }
+
+    int total = 0;
+    for (unsigned int i=0; i<readers.size(); i++) {
+        readers[i]->join();
+        total += readers[i]->features;
+        delete readers[i];
+    }
+
+    global_borderFids.clear();
+
+    SG_LOG( SG_GENERAL, SG_ALERT, "Read " << total << " features from layer " << layername );
 }
 
 // Main Thread
-void processLayer(OGRLayer* poLayer, tgChopper& results )
+void processLayer(const string& datasource, OGRLayer* poLayer, tgChopper& results )
 {
     int feature_count=poLayer->GetFeatureCount();
 
@@ -408,9 +646,10 @@ void processLayer(OGRLayer* poLayer, tgChopper& results )
 
     oTargetSRS.SetWellKnownGeogCS( "WGS84" );
 
-    OGRCoordinateTransformation *poCT = OGRCreateCoordinateTransformation(oSourceSRS, &oTargetSRS);
-
     /* setup attribute and spatial queries */
+    OGREnvelope extent;
+    bool have_extent = false;
+
     if (use_spatial_query) {
         double trans_min_x,trans_min_y,trans_max_x,trans_max_y;
         /* do a simple reprojection of the source SRS */
@@ -428,6 +667,16 @@ void processLayer(OGRLayer* poLayer, tgChopper& results )
 
         poLayer->SetSpatialFilterRect(trans_min_x, trans_min_y,
                                       trans_max_x, trans_max_y);
+
+        extent.MinX = std::min( trans_min_x, trans_max_x );
+        extent.MinY = std::min( trans_min_y, trans_max_y );
+        extent.MaxX = std::max( trans_min_x, trans_max_x );
+        extent.MaxY = std::max( trans_min_y, trans_max_y );
+        have_extent = true;
+
+        OCTDestroyCoordinateTransformation( poCTinverse );
+    } else if ( read_windows > 1 ) {
+        have_extent = ( poLayer->GetExtent( &extent, TRUE ) == OGRERR_NONE );
     }
 
     if (use_attribute_query) {
@@ -437,29 +686,49 @@ void processLayer(OGRLayer* poLayer, tgChopper& results )
         }
     }
 
-    // Generate the work queue for this layer
-    OGRFeature *poFeature;
-    poLayer->SetNextByIndex(start_record);
-    while ( ( poFeature = poLayer->GetNextFeature()) != NULL )
-    {
-        global_workQueue.push( poFeature );
-    }
-
-    // Now process the workqueue with threads
+    // Start the decoders first, so they work while the layer is read.
     // this just generates all the tgPolygons
+    global_workQueue.open( num_threads * FEATURE_QUEUE_DEPTH );
+
     std::vector<Decoder *> decoders;
     for (int i=0; i<num_threads; i++) {
-        Decoder* decoder = new Decoder( poCT, area_type_field, point_width_field, line_width_field, results );
+        Decoder* decoder = new Decoder( oSourceSRS, area_type_field, point_width_field, line_width_field, results );
         decoder->start();
         decoders.push_back( decoder );
     }
 
+    if ( read_windows > 1 && have_extent && start_record == 0 && layerHasFids( poLayer ) ) {
+        readLayerWindows( datasource, poLayer, extent );
+    } else {
+        // Feed the work queue for this layer, a batch at a time
+        OGRFeature *poFeature;
+        FeatureBatch batch;
+        batch.reserve( FEATURE_BATCH_SIZE );
+
+        if ( read_windows > 1 ) {
+            SG_LOG( SG_GENERAL, SG_ALERT, "Layer " << layername << " is read by a single reader" );
+        }
+
+        poLayer->SetNextByIndex(start_record);
+        while ( ( poFeature = poLayer->GetNextFeature()) != NULL )
+        {
+            batch.push_back( poFeature );
+            if ( batch.size() >= FEATURE_BATCH_SIZE ) {
+                global_workQueue.push( batch );
+                batch.reserve( FEATURE_BATCH_SIZE );
+            }
+        }
+        if ( batch.size() ) {
+            global_workQueue.push( batch );
+        }
+    }
+    global_workQueue.close();
+
     // Then wait until they are finished
     for (unsigned int i=0; i<decoders.size(); i++) {
         decoders[i]->join();
+        delete decoders[i];
     }
-
-    OCTDestroyCoordinateTransformation ( poCT );
 }
 
 void usage(char* progname) {
@@ -493,10 +762,15 @@ void usage(char* progname) {
     SG_LOG( SG_GENERAL, SG_ALERT, "        spatial query extents" );
     SG_LOG( SG_GENERAL, SG_ALERT, "--texture-lines" );
     SG_LOG( SG_GENERAL, SG_ALERT, "        Enable textured lines" );
+    SG_LOG( SG_GENERAL, SG_ALERT, "--seperate-segments" );
+    SG_LOG( SG_GENERAL, SG_ALERT, "        Generate one polygon per line segment, instead of merging them" );
     SG_LOG( SG_GENERAL, SG_ALERT, "--threads" );
     SG_LOG( SG_GENERAL, SG_ALERT, "        Enable multithreading with user specified number of threads" );
     SG_LOG( SG_GENERAL, SG_ALERT, "--all-threads" );
     SG_LOG( SG_GENERAL, SG_ALERT, "        Enable multithreading with all available cpu cores" );
+    SG_LOG( SG_GENERAL, SG_ALERT, "--read-windows n" );
+    SG_LOG( SG_GENERAL, SG_ALERT, "        Read the layer in parallel, through a grid of n x n spatial windows" );
+    SG_LOG( SG_GENERAL, SG_ALERT, "        over the --spat extents, or the layer extents" );
     SG_LOG( SG_GENERAL, SG_ALERT, "" );
     SG_LOG( SG_GENERAL, SG_ALERT, "<work_dir>" );
     SG_LOG( SG_GENERAL, SG_ALERT, "        Directory to put the polygon files in" );
@@ -609,6 +883,13 @@ int main( int argc, char **argv ) {
             num_threads=atoi(argv[2]);
             argv+=2;
             argc-=2;
+        } else if (!strcmp(argv[1],"--read-windows")) {
+            if (argc<3) {
+                usage(progname);
+            }
+            read_windows=atoi(argv[2]);
+            argv+=2;
+            argc-=2;
         } else if (!strcmp(argv[1],"--all-threads")) {
             num_threads=boost::thread::hardware_concurrency(); 
             argv+=1;
@@ -670,7 +951,7 @@ int main( int argc, char **argv ) {
                 SG_LOG( SG_GENERAL, SG_ALERT, "Failed opening layer " << argv[i] << " from datasource " << datasource );
                 exit( 1 );
             }
-            processLayer(poLayer, results );
+            processLayer(datasource, poLayer, results );
         }
     } else {
         for (int i=0;i<poDS->GetLayerCount();i++) {
@@ -678,7 +959,7 @@ int main( int argc, char **argv ) {
 
             assert(poLayer != NULL);
 
-            processLayer(poLayer, results );
+            processLayer(datasource, poLayer, results );
         }
     }
 
@@ -91,6 +91,7 @@ public:
 
     inline T& ref(int i, int j);
     inline T& operator()(int i,int j) { return ref(i,j); }
+    inline T *row(int j) { return data + j*w; }
     inline int width() { return w; }
     inline int height() { return h; }
 };
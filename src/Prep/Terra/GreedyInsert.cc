@@ -1,9 +1,22 @@
 #include <assert.h>
 #include <iostream>
+#include <vector>
 #include "GreedyInsert.h"
 
 #include "Mask.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || ( defined(_M_IX86_FP) && _M_IX86_FP >= 2 )
+#  include <emmintrin.h>
+#  define TERRA_SSE2
+#endif
+
+//
+// A batch only takes candidates whose importance is at least this
+// fraction of the current best, and looks at no more than
+// BATCH_MAX_EXTRACT times the batch size heap entries.
+#define BATCH_MIN_IMPORT   0.5
+#define BATCH_MAX_EXTRACT  4
+
 using std::cerr;
 using std::endl;
 
@@ -21,7 +34,7 @@ void TrackedTriangle::update(Subdivision& s)
 
 
 
-GreedySubdivision::GreedySubdivision(Map *map)
+GreedySubdivision::GreedySubdivision(Map *map, bool direct_scan)
 {
     H = map;
     heap = new Heap(128);
@@ -30,6 +43,17 @@ GreedySubdivision::GreedySubdivision(Map *map)
     int h = H->height;
     real range = H->max - H->min;
 
+    //
+    // elevations are whole meters, so a float copy is exact
+    grid = NULL;
+    if( direct_scan )
+    {
+	grid = new float[w*h];
+	for(int y=0;y<h;y++)
+	    for(int x=0;x<w;x++)
+		grid[y*w + x] = (float)H->eval(x,y);
+    }
+
     is_used.init(w, h);
     int x,y;
     for(x=0;x<w;x++)
@@ -68,6 +92,7 @@ GreedySubdivision::GreedySubdivision(Map *map)
 GreedySubdivision::~GreedySubdivision()
 {
     delete heap;
+    delete[] grid;
     is_used.free();
 }
 
@@ -159,8 +184,85 @@ void GreedySubdivision::scan_triangle_line(Plane& plane,
 }
 
 
+//
+// Same scanline as above, reading the height field from the contiguous
+// grid.  The plane is evaluated per pixel instead of accumulated, and
+// with SSE2 two pixels are done at a time.  Ties go to the leftmost
+// pixel, as in the scalar scan.
+void GreedySubdivision::scan_direct_line(Plane& plane,
+					 int y,
+					 real x1, real x2,
+					 Candidate& candidate)
+{
+    int startx = (int)ceil(MIN(x1,x2));
+    int endx   = (int)floor(MAX(x1,x2));
+
+    if( startx > endx ) return;
+
+    const float *heights = grid + y*H->width;
+    const char  *used    = is_used.row(y);
+    real zrow = plane.b*y + plane.c;
+    int x = startx;
+
+    if( !MASK->identity() )
+    {
+	for(;x<=endx;x++)
+	    if( !used[x] )
+		candidate.consider(x, y,
+				   MASK->apply(x, y, fabs(heights[x] - (plane.a*x + zrow))));
+	return;
+    }
+
+#ifdef TERRA_SSE2
+    if( endx - startx >= 3 )
+    {
+	const __m128d sign = _mm_set1_pd(-0.0);
+	const __m128d skip_val = _mm_set1_pd(-HUGE_VAL);
+	const __m128d two = _mm_set1_pd(2.0);
+	const __m128d a = _mm_set1_pd(plane.a);
+	const __m128d zr = _mm_set1_pd(zrow);
+
+	__m128d xv = _mm_set_pd(x+1, x);
+	__m128d best = skip_val;
+	__m128d best_x = xv;
+
+	for(;x+1<=endx;x+=2)
+	{
+	    __m128d z = _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64((const __m128i *)(heights + x))));
+	    __m128d z0 = _mm_add_pd(_mm_mul_pd(a, xv), zr);
+	    __m128d diff = _mm_andnot_pd(sign, _mm_sub_pd(z, z0));
+
+	    __m128d skip = _mm_castsi128_pd(_mm_set_epi32(-(used[x+1]!=0), -(used[x+1]!=0),
+							  -(used[x]!=0),   -(used[x]!=0)));
+	    diff = _mm_or_pd(_mm_and_pd(skip, skip_val), _mm_andnot_pd(skip, diff));
+
+	    __m128d gt = _mm_cmpgt_pd(diff, best);
+	    best   = _mm_or_pd(_mm_and_pd(gt, diff), _mm_andnot_pd(gt, best));
+	    best_x = _mm_or_pd(_mm_and_pd(gt, xv), _mm_andnot_pd(gt, best_x));
+
+	    xv = _mm_add_pd(xv, two);
+	}
+
+	double b[2], bx[2];
+	_mm_storeu_pd(b, best);
+	_mm_storeu_pd(bx, best_x);
+
+	int lane = ( b[1] > b[0] || ( b[1] == b[0] && bx[1] < bx[0] ) ) ? 1 : 0;
+	if( b[lane] > -HUGE_VAL )
+	    candidate.consider((int)bx[lane], y, b[lane]);
+    }
+#endif
+
+    for(;x<=endx;x++)
+	if( !used[x] )
+	    candidate.consider(x, y, fabs(heights[x] - (plane.a*x + zrow)));
+}
+
+
 void GreedySubdivision::scanTriangle(TrackedTriangle& T)
 {
+    T.rescanned();
+
     Plane z_plane;
     compute_plane(z_plane, T, *H);
 
@@ -184,7 +286,10 @@ void GreedySubdivision::scanTriangle(TrackedTriangle& T)
     starty = (int)v0[Y];
     endy   = (int)v1[Y];
     for(y=starty;y<endy;y++) {
-	scan_triangle_line(z_plane, y, x1, x2, candidate);
+	if( grid )
+	    scan_direct_line(z_plane, y, x1, x2, candidate);
+	else
+	    scan_triangle_line(z_plane, y, x1, x2, candidate);
 
         x1 += dx1;
         x2 += dx2;
@@ -198,7 +303,10 @@ void GreedySubdivision::scanTriangle(TrackedTriangle& T)
     starty = (int)v1[Y];
     endy   = (int)v2[Y];
     for(y=starty;y<=endy;y++) {
-	scan_triangle_line(z_plane, y, x1, x2, candidate);
+	if( grid )
+	    scan_direct_line(z_plane, y, x1, x2, candidate);
+	else
+	    scan_triangle_line(z_plane, y, x1, x2, candidate);
 
         x1 += dx1;
         x2 += dx2;
@@ -229,6 +337,19 @@ void GreedySubdivision::scanTriangle(TrackedTriangle& T)
     }
 }
 
+static void rescan_face(Triangle& t, void *closure)
+{
+    ((GreedySubdivision *)closure)->scanTriangle((TrackedTriangle&)t);
+}
+
+//
+// Rescan all faces of the mesh.  Needed when is_used has been changed
+// from outside, so no candidate points at an ignored pixel.
+void GreedySubdivision::rescanAll()
+{
+    overFaces(rescan_face, this);
+}
+
 Edge *GreedySubdivision::select(int sx, int sy, Triangle *t)
 {
     if( is_used(sx, sy) )
@@ -258,6 +379,82 @@ int GreedySubdivision::greedyInsert()
     return True;
 }
 
+//
+// Insert up to max_points candidates in one pass.  The top heap entries
+// are taken as long as they are close to the best importance and their
+// triangles share no vertex with one already taken.  A taken triangle
+// that is rescanned by an earlier insertion of the batch is skipped - it
+// is back in the heap with a new candidate.
+//
+// Returns the number of points inserted.
+int GreedySubdivision::greedyInsertBatch(int max_points)
+{
+    struct Pick {
+	TrackedTriangle *T;
+	real import;
+	unsigned int scans;
+    };
+
+    std::vector<Pick> picks;
+    std::vector<Pick> rejects;
+    std::vector<Vec2> corners;
+    real limit = 0.0;
+
+    for(int tries=0; tries < max_points*BATCH_MAX_EXTRACT &&
+	    (int)picks.size() < max_points; tries++)
+    {
+	heap_node *node = heap->top();
+	if( !node ) break;
+	if( picks.size() && node->import < limit ) break;
+
+	Pick p;
+	p.T = (TrackedTriangle *)node->obj;
+	p.import = node->import;
+	heap->extract();
+	p.scans = p.T->scanCount();
+
+	bool adjacent = false;
+	const Vec2 *pts[3] = { &p.T->point1(), &p.T->point2(), &p.T->point3() };
+	for(unsigned int i=0; i<corners.size() && !adjacent; i++)
+	    for(int k=0; k<3; k++)
+		if( corners[i] == *pts[k] ) { adjacent = true; break; }
+
+	if( adjacent )
+	{
+	    rejects.push_back(p);
+	    continue;
+	}
+
+	if( picks.empty() )
+	    limit = p.import * BATCH_MIN_IMPORT;
+
+	picks.push_back(p);
+	for(int k=0; k<3; k++)
+	    corners.push_back(*pts[k]);
+    }
+
+    //
+    // rejected triangles are untouched - put them back before
+    // anything is inserted
+    for(unsigned int i=0; i<rejects.size(); i++)
+	heap->insert(rejects[i].T, rejects[i].import);
+
+    int inserted = 0;
+    for(unsigned int i=0; i<picks.size(); i++)
+    {
+	TrackedTriangle &T = *picks[i].T;
+	if( T.scanCount() != picks[i].scans )
+	    continue;
+
+	int sx, sy;
+	T.getCandidate(&sx, &sy);
+	if( select(sx, sy, &T) )
+	    inserted++;
+    }
+
+    return inserted;
+}
+
 real GreedySubdivision::maxError()
 {
     heap_node *node = heap->top();
@@ -13,11 +13,16 @@ class TrackedTriangle : public Triangle
     // candidate position
     int sx, sy;
 
+    //
+    // bumped on every rescan, so a batch can tell if the
+    // candidate it extracted is still current
+    unsigned int scans;
 
 public:
     TrackedTriangle(Edge *e, int t=NOT_IN_HEAP)
 	: Triangle(e, t)
     {
+	scans = 0;
     }
 
     void update(Subdivision&);
@@ -25,6 +30,9 @@ public:
 
     void setCandidate(int x,int y, real) { sx=x; sy=y; }
     void getCandidate(int *x, int *y) { *x=sx; *y=sy; }
+
+    void rescanned() { scans++; }
+    unsigned int scanCount() { return scans; }
 };
 
 
@@ -58,6 +66,11 @@ protected:
 
     Map *H;
 
+    //
+    // direct scan mode : a contiguous copy of the height field, so
+    // scanlines don't go through Map::eval / MASK->apply per pixel
+    float *grid;
+
     Triangle *allocFace(Edge *e);
 
     void compute_plane(Plane&, Triangle&, Map&);
@@ -65,9 +78,12 @@ protected:
     void scan_triangle_line(Plane& plane,
 			    int y, real x1, real x2,
 			    Candidate& candidate);
+    void scan_direct_line(Plane& plane,
+			  int y, real x1, real x2,
+			  Candidate& candidate);
 
 public:
-    GreedySubdivision(Map *map);
+    GreedySubdivision(Map *map, bool direct_scan=false);
     ~GreedySubdivision();
 
     array2<char> is_used;
@@ -77,7 +93,9 @@ public:
     Map& getData() { return *H; }
 
     void scanTriangle(TrackedTriangle& t);
+    void rescanAll();
     int greedyInsert();
+    int greedyInsertBatch(int max_points);
 
     unsigned int pointCount() { return count; }
     real maxError();
@@ -17,6 +17,9 @@ public:
 
 
     virtual real apply(int /*x*/, int /*y*/, real val) { return val; }
+
+    // true if apply() leaves every value alone
+    virtual bool identity() { return true; }
 };
 
 
@@ -29,6 +32,7 @@ public:
 
     inline real& ref(int x, int y);
     real apply(int x, int y, real val) { return ref(x,y) * val; }
+    bool identity() { return false; }
 };
 
 
@@ -118,6 +118,13 @@ Terra::real error_threshold=40.0;
 unsigned int min_points=50;
 unsigned int point_limit=1000;
 bool force=false;
+bool text_fit=false;
+int fit_compression=6;
+bool direct_scan=false;
+int batch_size=1;
+bool compare_greedy=false;
+bool pin_borders=false;
+int border_step=0;
 unsigned int num_threads = 1;
 
 inline int goal_not_met(Terra::GreedySubdivision* mesh)
@@ -136,18 +143,194 @@ static void announce_goal(Terra::GreedySubdivision* mesh)
     SG_LOG(SG_GENERAL, SG_INFO, "     points=" << mesh->pointCount() << " [limit=" << point_limit << "]");
 }
 
-void greedy_insertion(Terra::GreedySubdivision* mesh)
+void greedy_insertion(Terra::GreedySubdivision* mesh, int batch)
 {
 
     while( goal_not_met(mesh) )
     {
-        if( !mesh->greedyInsert() )
-            break;
+        if ( batch > 1 ) {
+            // don't overshoot the point limit, but keep going if we are
+            // still below the minimum
+            int n = batch;
+            if ( mesh->pointCount() < point_limit && point_limit - mesh->pointCount() < (unsigned int)n ) {
+                n = point_limit - mesh->pointCount();
+            }
+
+            if( !mesh->greedyInsertBatch(n) )
+                break;
+        } else {
+            if( !mesh->greedyInsert() )
+                break;
+        }
     }
 
     announce_goal(mesh);
 }
 
+// Pick the nodes along the samples first to last of one array border.
+// The choice only depends on the elevations between them, so the
+// neighbouring bucket picks exactly the same nodes for the piece of edge
+// they share.  With a step, every step-th sample is kept, otherwise the
+// profile is split at its worst sample until it is within
+// error_threshold.
+static void fit_border(const std::vector<Terra::real>& elev, int first, int last, std::vector<bool>& keep)
+{
+    keep[first] = keep[last] = true;
+
+    if (border_step > 0) {
+        for (int i = first + border_step; i < last; i += border_step) {
+            keep[i] = true;
+        }
+        return;
+    }
+
+    // void samples are never pinned, and are left out of the profile
+    std::vector<int> valid;
+    for (int i = first; i <= last; i++) {
+        if (elev[i] > -9000) {
+            valid.push_back(i);
+        }
+    }
+    if (valid.size() < 3) {
+        return;
+    }
+
+    std::vector< std::pair<int,int> > spans;
+    spans.push_back( std::make_pair(0, (int)valid.size() - 1) );
+    while (!spans.empty()) {
+        int a = spans.back().first;
+        int b = spans.back().second;
+        spans.pop_back();
+
+        int ia = valid[a], ib = valid[b];
+        int worst = -1;
+        Terra::real worst_err = error_threshold;
+        for (int k = a + 1; k < b; k++) {
+            int i = valid[k];
+            Terra::real z = elev[ia] + (elev[ib] - elev[ia]) * (i - ia) / (ib - ia);
+            Terra::real err = fabs(elev[i] - z);
+
+            if (err > worst_err) {
+                worst_err = err;
+                worst = k;
+            }
+        }
+
+        if (worst > 0) {
+            keep[valid[worst]] = true;
+            spans.push_back( std::make_pair(a, worst) );
+            spans.push_back( std::make_pair(worst, b) );
+        }
+    }
+}
+
+// The samples of a horizontal border of n samples at lat where a bucket
+// of the row beyond it (dir 1 north, -1 south) ends.  Bucket widths
+// change at some latitudes, so that row may be split differently from
+// ours; the pieces between these samples are the edges shared with one
+// neighbour each.
+static void neighbour_splits(const TGArray& array, int n, double lat, int dir, std::vector<int>& splits)
+{
+    double row_lat = lat + dir * SG_HALF_BUCKET_SPAN;
+    if (row_lat <= -90.0 || row_lat >= 90.0) {
+        return;
+    }
+
+    double west = array.get_originx() / 3600.0;
+    double step = array.get_col_step() / 3600.0;
+
+    // start half a sample in, so rounding can't find the bucket west of us
+    double lon = west + 0.5 * step;
+    for (;;) {
+        SGBucket b = sgBucketOffset(lon, row_lat, 0, 0);
+        double east = b.get_center_lon() + 0.5 * b.get_width();
+        int i = (int)floor((east - west) / step + 0.5);
+
+        if (i >= n-1) {
+            break;
+        }
+        if (i > 0) {
+            splits.push_back(i);
+        }
+        lon = east + 0.5 * step;
+    }
+}
+
+// Insert the border nodes before the greedy fit, and keep it from
+// adding any others on the border
+static void pin_border_nodes(Terra::GreedySubdivision* mesh, ArrayMap* DEM, const TGArray& array)
+{
+    int w = DEM->width;
+    int h = DEM->height;
+    std::vector<SGVec2i> pins;
+
+    for (int side = 0; side < 4; side++) {
+        // south, north, west, east
+        bool horizontal = (side < 2);
+        int  n = horizontal ? w : h;
+        int  fixed = (side == 0 || side == 2) ? 0 : (horizontal ? h-1 : w-1);
+
+        std::vector<Terra::real> elev(n);
+        for (int i = 0; i < n; i++) {
+            elev[i] = horizontal ? DEM->eval(i, fixed) : DEM->eval(fixed, i);
+        }
+
+        // fit the border piece by piece between the ends of the
+        // neighbouring buckets, which are always pinned
+        std::vector<int> ends;
+        ends.push_back(0);
+        if (horizontal) {
+            double lat = (array.get_originy() + fixed * array.get_row_step()) / 3600.0;
+            neighbour_splits(array, n, lat, (side == 0) ? -1 : 1, ends);
+        }
+        ends.push_back(n-1);
+
+        std::vector<bool> keep(n, false);
+        for (unsigned int k = 0; k+1 < ends.size(); k++) {
+            fit_border(elev, ends[k], ends[k+1], keep);
+        }
+
+        for (int i = 0; i < n; i++) {
+            int x = horizontal ? i : fixed;
+            int y = horizontal ? fixed : i;
+
+            if (mesh->is_used(x,y) != DATA_POINT_UNUSED) {
+                continue;
+            }
+            if (keep[i]) {
+                pins.push_back(SGVec2i(x, y));
+            } else {
+                mesh->is_used(x,y) = DATA_POINT_IGNORED;
+            }
+        }
+    }
+
+    for (unsigned int i = 0; i < pins.size(); i++) {
+        if (mesh->is_used(pins[i].x(), pins[i].y()) == DATA_POINT_UNUSED) {
+            mesh->select(pins[i].x(), pins[i].y());
+        }
+    }
+
+    // candidates found before the border was ignored may sit on it
+    mesh->rescanAll();
+
+    SG_LOG(SG_GENERAL, SG_INFO, "Pinned " << pins.size() << " border nodes");
+}
+
+// fit the same data with plain greedy insertion, and report how the
+// requested mode compares
+static void compare_fit(ArrayMap* DEM, Terra::GreedySubdivision* mesh, const SGPath& path)
+{
+    Terra::GreedySubdivision strict(DEM);
+    greedy_insertion(&strict, 1);
+
+    SG_LOG(SG_GENERAL, SG_ALERT, "Compare " << path.file() << ":");
+    SG_LOG(SG_GENERAL, SG_ALERT, "     greedy: points=" << strict.pointCount() <<
+           " max error=" << strict.maxError() << " rms error=" << strict.rmsError());
+    SG_LOG(SG_GENERAL, SG_ALERT, "     fitted: points=" << mesh->pointCount() <<
+           " max error=" << mesh->maxError() << " rms error=" << mesh->rmsError());
+}
+
 bool endswith(const std::string& s1, const std::string& suffix) {
     size_t s1len=s1.size();
     size_t sufflen=suffix.size();
@@ -177,37 +360,32 @@ void fit_file(const SGPath& path) {
 
     Terra::GreedySubdivision *mesh;
 
-    mesh=new Terra::GreedySubdivision(DEM);
+    mesh=new Terra::GreedySubdivision(DEM, direct_scan);
 
-    greedy_insertion(mesh);
+    if (pin_borders) {
+        pin_border_nodes(mesh, DEM, inarray);
+    }
 
-    gzFile fp;
-    if ( (fp = gzopen( outPath.c_str(), "wb9" )) == NULL ) {
-        SG_LOG(SG_GENERAL, SG_ALERT, "ERROR: opening " << outPath << " for writing!");
-        return;
+    greedy_insertion(mesh, batch_size);
+
+    if (compare_greedy) {
+        compare_fit(DEM, mesh, path);
     }
 
-    gzprintf(fp,"%d\n",mesh->pointCount());
-	int c=0;
+    std::vector<SGVec2i> nodes;
+    nodes.reserve(mesh->pointCount());
     for (int x=0;x<DEM->width;x++) {
         for (int y=0;y<DEM->height;y++) {
             if (mesh->is_used(x,y) != DATA_POINT_USED)
                 continue;
-            double vx,vy,vz;
-            vx=(inarray.get_originx()+x*inarray.get_col_step())/3600.0;
-            vy=(inarray.get_originy()+y*inarray.get_row_step())/3600.0;
-			//vx=(inarray.get_originx()+x*0.333)/3600.0;
-			//vy=(inarray.get_originy()+y*0.333)/3600.0;
-            vz=DEM->eval(x,y);			
-			if (c++ % 100 == 0) printf("z=%f - %+03.8f %+02.8f %0.2f\n",vz,vx,vy,vz);
-            gzprintf(fp,"%+03.8f %+02.8f %0.2f\n",vx,vy,vz);
+            nodes.push_back(SGVec2i(x,y));
         }
     }
 
     delete mesh;
     delete DEM;
 
-    gzclose(fp);
+    inarray.write_fitted(outPath.str(), nodes, text_fit, fit_compression);
 }
 
 void queue_fit_file(const SGPath& path)
@@ -270,6 +448,12 @@ void usage(char* progname, const std::string& msg) {
     SG_LOG(SG_GENERAL,SG_INFO, "\t -e | --maxerror 40");
     SG_LOG(SG_GENERAL,SG_INFO, "\t -f | --force");
     SG_LOG(SG_GENERAL,SG_INFO, "\t -j | --threads <number>");
+    SG_LOG(SG_GENERAL,SG_INFO, "\t -t | --text");
+    SG_LOG(SG_GENERAL,SG_INFO, "\t -z | --compression 6");
+    SG_LOG(SG_GENERAL,SG_INFO, "\t -d | --direct");
+    SG_LOG(SG_GENERAL,SG_INFO, "\t -b | --batch 1");
+    SG_LOG(SG_GENERAL,SG_INFO, "\t -c | --compare");
+    SG_LOG(SG_GENERAL,SG_INFO, "\t -p | --pin-borders [step]");
     SG_LOG(SG_GENERAL,SG_INFO, "\t -v | --version");
     SG_LOG(SG_GENERAL,SG_INFO, "");
     SG_LOG(SG_GENERAL,SG_INFO, "Algorithm will produce at least <minnodes> fitted nodes, but no");
@@ -283,6 +467,18 @@ void usage(char* progname, const std::string& msg) {
     SG_LOG(SG_GENERAL,SG_INFO, "The input file must be a .arr.gz file such as that produced");
     SG_LOG(SG_GENERAL,SG_INFO, "by demchop or hgtchop utils.");
     SG_LOG(SG_GENERAL,SG_INFO, "");
+    SG_LOG(SG_GENERAL,SG_INFO, "Direct scans the height grid from a flat buffer, and batch inserts up");
+    SG_LOG(SG_GENERAL,SG_INFO, "to <batch> points from non adjacent triangles per step.  Both are");
+    SG_LOG(SG_GENERAL,SG_INFO, "faster on large arrays but don't give exactly the greedy result;");
+    SG_LOG(SG_GENERAL,SG_INFO, "compare also runs the plain greedy fit and logs both errors.");
+    SG_LOG(SG_GENERAL,SG_INFO, "");
+    SG_LOG(SG_GENERAL,SG_INFO, "Pin borders fits the array borders first, from the border samples");
+    SG_LOG(SG_GENERAL,SG_INFO, "alone (to <maxerror>, or every <step>th sample), and keeps the");
+    SG_LOG(SG_GENERAL,SG_INFO, "greedy fit off the border.  Adjacent buckets then have exactly the");
+    SG_LOG(SG_GENERAL,SG_INFO, "same fitted nodes along their shared edges.  Where the bucket width");
+    SG_LOG(SG_GENERAL,SG_INFO, "changes between rows, a border is fitted separately between the");
+    SG_LOG(SG_GENERAL,SG_INFO, "ends of the neighbouring buckets.");
+    SG_LOG(SG_GENERAL,SG_INFO, "");
     SG_LOG(SG_GENERAL,SG_INFO, "Force will overwrite existing .arr.gz files, even if the input is older");
     SG_LOG(SG_GENERAL,SG_INFO, "");
     SG_LOG(SG_GENERAL,SG_INFO, "**** NOTE ****:");
@@ -292,6 +488,10 @@ void usage(char* progname, const std::string& msg) {
     SG_LOG(SG_GENERAL,SG_INFO, "The output file(s) is/are called .fit.gz and is simply a list of");
     SG_LOG(SG_GENERAL,SG_INFO, "from the resulting fitted surface nodes.  The user of the");
     SG_LOG(SG_GENERAL,SG_INFO, ".fit.gz file will need to retriangulate the surface.");
+    SG_LOG(SG_GENERAL,SG_INFO, "");
+    SG_LOG(SG_GENERAL,SG_INFO, "Nodes are written as binary grid indices and elevations, unless");
+    SG_LOG(SG_GENERAL,SG_INFO, "--text is given to write the older lon lat elev text list.  Both");
+    SG_LOG(SG_GENERAL,SG_INFO, "are read by tg-construct.");
 }
 
 struct option options[]={
@@ -302,6 +502,12 @@ struct option options[]={
     {"force",no_argument,NULL,'f'},
     {"version",no_argument,NULL,'v'},
     {"threads",required_argument,NULL,'j'},
+    {"text",no_argument,NULL,'t'},
+    {"compression",required_argument,NULL,'z'},
+    {"direct",no_argument,NULL,'d'},
+    {"batch",required_argument,NULL,'b'},
+    {"compare",no_argument,NULL,'c'},
+    {"pin-borders",optional_argument,NULL,'p'},
     {NULL,0,NULL,0}
 };
 
@@ -309,7 +515,7 @@ int main(int argc, char** argv) {
     sglog().setLogLevels( SG_ALL, SG_INFO );
     int option;
 
-    while ((option=getopt_long(argc,argv,"hm:x:e:fvj:",options,NULL))!=-1) {
+    while ((option=getopt_long(argc,argv,"hm:x:e:fvj:tz:db:cp::",options,NULL))!=-1) {
         switch (option) {
             case 'h':
                 usage(argv[0],"");
@@ -333,6 +539,34 @@ int main(int argc, char** argv) {
             case 'j':
                 num_threads = atoi(optarg);
                 break;
+            case 't':
+                text_fit=true;
+                break;
+            case 'z':
+                fit_compression=atoi(optarg);
+                if (fit_compression<0 || fit_compression>9) {
+                    usage(argv[0],"Compression level must be 0 - 9");
+                    exit(1);
+                }
+                break;
+            case 'd':
+                direct_scan=true;
+                break;
+            case 'b':
+                batch_size=atoi(optarg);
+                if (batch_size<1) {
+                    batch_size=1;
+                }
+                break;
+            case 'c':
+                compare_greedy=true;
+                break;
+            case 'p':
+                pin_borders=true;
+                if (optarg) {
+                    border_step=atoi(optarg);
+                }
+                break;
             case '?':
                 usage(argv[0],std::string("Unknown option:")+(char)optopt);
                 exit(1);
@@ -343,6 +577,11 @@ int main(int argc, char** argv) {
     SG_LOG(SG_GENERAL, SG_INFO, "Min points = " << min_points);
     SG_LOG(SG_GENERAL, SG_INFO, "Max points = " << point_limit);
     SG_LOG(SG_GENERAL, SG_INFO, "Max error  = " << error_threshold);
+    SG_LOG(SG_GENERAL, SG_INFO, "Scan       = " << (direct_scan ? "direct" : "map") << ", batch " << batch_size);
+    if (pin_borders) {
+        SG_LOG(SG_GENERAL, SG_INFO, "Borders    = pinned, " << (border_step ? "step " : "fit") << (border_step ? border_step : error_threshold));
+    }
+    SG_LOG(SG_GENERAL, SG_INFO, "Output     = " << (text_fit ? "text" : "binary") << ", compression " << fit_compression);
 
     if (optind<argc) {
         while (optind<argc) {
@@ -0,0 +1,222 @@
+// btgstats.cxx -- Report vertex cache and size statistics of btg files,
+//                 optionally comparing two builds of the same tiles
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+
+#include <simgear/compiler.h>
+
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <boost/foreach.hpp>
+
+#include <simgear/debug/logstream.hxx>
+#include <simgear/io/sg_binobj.hxx>
+#include <simgear/misc/sg_path.hxx>
+#include <simgear/misc/sg_dir.hxx>
+
+#include <terragear/tg_tristrip.hxx>
+
+using std::string;
+
+struct BtgStats {
+    BtgStats() : valid(false), nodes(0), tris(0), strips(0), misses(0), index_jump(0.0), size(0) {}
+
+    bool          valid;
+    unsigned int  nodes;
+    unsigned int  tris;
+    unsigned int  strips;
+    unsigned int  misses;
+    double        index_jump;   // mean distance between consecutive node indices
+    long          size;
+
+    double acmr( void ) const { return tris ? (double)misses / tris : 0.0; }
+};
+
+static unsigned int cache_size = 16;
+
+static BtgStats read_stats( const string& file )
+{
+    BtgStats     stats;
+    SGBinObject  obj;
+    struct stat  buf;
+
+    if ( stat( file.c_str(), &buf ) != 0 || !obj.read_bin( file ) ) {
+        return stats;
+    }
+
+    // strips and fans both run through the cache as one vertex sequence per group
+    tgIndexGroupList strips = obj.get_strips_v();
+    const group_list& fans  = obj.get_fans_v();
+    strips.insert( strips.end(), fans.begin(), fans.end() );
+
+    tgIndexList tris;
+    const group_list& tris_v = obj.get_tris_v();
+    for ( unsigned int i = 0; i < tris_v.size(); i++ ) {
+        tris.insert( tris.end(), tris_v[i].begin(), tris_v[i].end() );
+    }
+
+    stats.valid  = true;
+    stats.size   = buf.st_size;
+    stats.nodes  = obj.get_wgs84_nodes().size();
+    stats.strips = strips.size();
+    stats.tris   = tris.size() / 3;
+    for ( unsigned int i = 0; i < strips.size(); i++ ) {
+        if ( strips[i].size() > 2 ) {
+            stats.tris += strips[i].size() - 2;
+        }
+    }
+    stats.misses = tgTriStripper::CountCacheMisses( strips, tris, cache_size );
+
+    double       jump  = 0.0;
+    unsigned int count = 0;
+    int          last  = -1;
+    for ( unsigned int i = 0; i < strips.size(); i++ ) {
+        for ( unsigned int j = 0; j < strips[i].size(); j++ ) {
+            if ( last >= 0 ) {
+                jump += abs( strips[i][j] - last );
+                count++;
+            }
+            last = strips[i][j];
+        }
+    }
+    for ( unsigned int i = 0; i < tris.size(); i++ ) {
+        if ( last >= 0 ) {
+            jump += abs( tris[i] - last );
+            count++;
+        }
+        last = tris[i];
+    }
+    stats.index_jump = count ? jump / count : 0.0;
+
+    return stats;
+}
+
+static BtgStats total_a, total_b;
+
+static void add_total( BtgStats& total, const BtgStats& s )
+{
+    total.valid       = true;
+    total.nodes      += s.nodes;
+    total.tris       += s.tris;
+    total.strips     += s.strips;
+    total.misses     += s.misses;
+    total.index_jump += s.index_jump * s.tris;
+    total.size       += s.size;
+}
+
+static void report( const string& name, const BtgStats& a, const BtgStats& b )
+{
+    if ( !b.valid ) {
+        printf( "%-40s nodes %7u tris %8u strips %6u ACMR %.3f jump %9.1f size %9ld\n",
+                name.c_str(), a.nodes, a.tris, a.strips, a.acmr(), a.index_jump, a.size );
+    } else {
+        printf( "%-40s tris %8u -> %8u  ACMR %.3f -> %.3f  jump %9.1f -> %9.1f  size %9ld -> %9ld (%+.1f%%)\n",
+                name.c_str(), a.tris, b.tris, a.acmr(), b.acmr(), a.index_jump, b.index_jump,
+                a.size, b.size, a.size ? 100.0 * ( b.size - a.size ) / a.size : 0.0 );
+    }
+}
+
+static void process_path( const SGPath& path, const string& rel, const string& compare_root )
+{
+    if ( path.isDir() ) {
+        // recurse downwards!
+        simgear::Dir d(path);
+        int flags = simgear::Dir::TYPE_FILE | simgear::Dir::TYPE_DIR |
+            simgear::Dir::NO_DOT_OR_DOTDOT;
+        BOOST_FOREACH(const SGPath& c, d.children(flags)) {
+            process_path( c, rel.empty() ? c.file() : rel + "/" + c.file(), compare_root );
+        }
+
+        return;
+    }
+
+    string lext = path.complete_lower_extension();
+    if ( (lext != "btg.gz") && (lext != "btg") ) {
+        return;
+    }
+
+    BtgStats a = read_stats( path.str() );
+    if ( !a.valid ) {
+        SG_LOG(SG_GENERAL, SG_ALERT, "Failed to read " << path.str() );
+        return;
+    }
+
+    BtgStats b;
+    if ( !compare_root.empty() ) {
+        SGPath other( compare_root );
+        if ( !rel.empty() ) {
+            other.append( rel );
+        }
+        b = read_stats( other.str() );
+        if ( !b.valid ) {
+            SG_LOG(SG_GENERAL, SG_ALERT, "No matching tile for " << path.str() );
+            return;
+        }
+        add_total( total_b, b );
+    }
+    add_total( total_a, a );
+
+    report( rel.empty() ? path.file() : rel, a, b );
+}
+
+static void usage( const char* progname )
+{
+    SG_LOG(SG_GENERAL, SG_ALERT, "Usage: " << progname << " [--vertex-cache=<size>] <btg file or dir> [<btg file or dir to compare>]");
+    SG_LOG(SG_GENERAL, SG_ALERT, "");
+    SG_LOG(SG_GENERAL, SG_ALERT, "Reports triangle count, simulated vertex cache miss ratio (ACMR),");
+    SG_LOG(SG_GENERAL, SG_ALERT, "mean node index jump and compressed size per tile.  With a second");
+    SG_LOG(SG_GENERAL, SG_ALERT, "path, the same tiles are read from it and the deltas reported.");
+    exit(-1);
+}
+
+int main( int argc, char** argv )
+{
+    sglog().setLogLevels( SG_ALL, SG_ALERT );
+
+    int arg_pos;
+    for (arg_pos = 1; arg_pos < argc; arg_pos++) {
+        string arg = argv[arg_pos];
+
+        if (arg.find("--vertex-cache=") == 0) {
+            cache_size = atoi( arg.substr(15).c_str() );
+        } else if (arg.find("--") == 0) {
+            usage( argv[0] );
+        } else {
+            break;
+        }
+    }
+
+    if ( arg_pos >= argc || argc - arg_pos > 2 ) {
+        usage( argv[0] );
+    }
+
+    string compare_root = ( argc - arg_pos == 2 ) ? argv[arg_pos+1] : "";
+    process_path( SGPath( argv[arg_pos] ), "", compare_root );
+
+    if ( total_a.tris ) {
+        total_a.index_jump /= total_a.tris;
+        if ( total_b.tris ) {
+            total_b.index_jump /= total_b.tris;
+        }
+        report( "total", total_a, total_b );
+    }
+
+    return 0;
+}